@@ -0,0 +1,283 @@
+/* FILE: admission.c
+ *
+ * AUTHOR: Tariq Soliman
+ * STUDENT NO.: 45287316
+ *
+ * DESCRIPTION:
+ * A waiting room for connections accepted while the server is full. See
+ * admission.h.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "admission.h"
+
+#define USECS_PER_SEC 1000000L
+#define NSECS_PER_USEC 1000L
+#define NSECS_PER_SEC 1000000000L
+#define USECS_PER_MSEC 1000L
+#define WAIT_SAMPLES 1024   // Admitted waits kept for percentiles
+#define NUM_PERCENTILES 4
+
+/* The percentiles reported, in thousandths.*/
+static const int percentiles[NUM_PERCENTILES] = {500, 900, 990, 1000};
+
+/* The names of the reported percentiles.*/
+static const char* percentileNames[NUM_PERCENTILES] = {
+        "p50", "p90", "p99", "max"};
+
+// A connection waiting for a slot and when it must be admitted by.
+typedef struct Waiter {
+    int fd;
+    struct timespec arrived;
+    struct timespec deadline;
+} Waiter;
+
+struct Admission {
+    ClaimHandler claim;
+    ConnectionHandler admit;
+    ConnectionHandler reject;
+    void* arg;
+    long maxWaitUsecs;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;     // A connection arrived or a slot was freed
+    unsigned long slotsFreed;   // Counts frees so none is missed
+    Waiter* waiters;            // A ring buffer of maxWaiting connections
+    int maxWaiting;
+    int head;                   // The connection that has waited longest
+    int depth;                  // The number of connections waiting
+    int maxDepth;
+    unsigned long numAdmitted;
+    unsigned long numTimedOut;
+    unsigned long numQueueFull;
+    unsigned long waitUsecs[WAIT_SAMPLES];  // A ring of recent waits
+    int numSamples;
+    int nextSample;
+};
+
+/* Get the number of microseconds from one time to another.
+ *
+ * Params:
+ *      from: The earlier time.
+ *      to: The later time.
+ *
+ * Return:
+ *      The number of microseconds between the times.
+ */
+static unsigned long usecs_between(const struct timespec* from,
+        const struct timespec* to) {
+    return (to->tv_sec - from->tv_sec) * USECS_PER_SEC +
+            (to->tv_nsec - from->tv_nsec) / NSECS_PER_USEC;
+}
+
+/* Check whether one time is at or after another.
+ *
+ * Params:
+ *      time: The time to check.
+ *      other: The time to compare it to.
+ *
+ * Return:
+ *      true if time is not before other.
+ */
+static bool reached(const struct timespec* time,
+        const struct timespec* other) {
+    return time->tv_sec > other->tv_sec || (time->tv_sec == other->tv_sec &&
+            time->tv_nsec >= other->tv_nsec);
+}
+
+/* Take the connection that has waited longest off the queue. The queue's
+ * lock must be held and the queue must not be empty.
+ *
+ * Params:
+ *      admission: The queue.
+ *
+ * Return:
+ *      The connection.
+ */
+static Waiter pop_waiter(Admission* admission) {
+    Waiter waiter = admission->waiters[admission->head];
+    admission->head = (admission->head + 1) % admission->maxWaiting;
+    admission->depth--;
+    return waiter;
+}
+
+/* The admission thread. Every time a connection arrives, a slot is freed or
+ * the oldest connection's deadline passes, it turns away the connections
+ * that have waited too long and admits the oldest of the rest for as long as
+ * there are free slots. Waiting connections all have the same maximum wait,
+ * so they reach their deadlines in the order they arrived. The queue's lock
+ * is dropped while a handler is called, as the claim handler takes locks
+ * that are held while the queue's statistics are printed. Only this thread
+ * takes connections off the queue, so the one at its head stays there while
+ * the lock is dropped.
+ *
+ * Params:
+ *      arg: A pointer to the Admission.
+ */
+static void* admission_thread(void* arg) {
+    Admission* admission = (Admission*)arg;
+    pthread_mutex_lock(&admission->lock);
+    while (1) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        while (admission->depth &&
+                reached(&now, &admission->waiters[admission->head].deadline)) {
+            Waiter waiter = pop_waiter(admission);
+            admission->numTimedOut++;
+            pthread_mutex_unlock(&admission->lock);
+            admission->reject(waiter.fd, admission->arg);
+            pthread_mutex_lock(&admission->lock);
+        }
+        unsigned long slotsFreed = admission->slotsFreed;
+        while (admission->depth) {
+            slotsFreed = admission->slotsFreed;
+            pthread_mutex_unlock(&admission->lock);
+            bool claimed = admission->claim(admission->arg);
+            pthread_mutex_lock(&admission->lock);
+            if (!claimed) {
+                break;
+            }
+            Waiter waiter = pop_waiter(admission);
+            admission->numAdmitted++;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            admission->waitUsecs[admission->nextSample] =
+                    usecs_between(&waiter.arrived, &now);
+            admission->nextSample = (admission->nextSample + 1) %
+                    WAIT_SAMPLES;
+            if (admission->numSamples < WAIT_SAMPLES) {
+                admission->numSamples++;
+            }
+            pthread_mutex_unlock(&admission->lock);
+            admission->admit(waiter.fd, admission->arg);
+            pthread_mutex_lock(&admission->lock);
+        }
+
+        // A slot freed since the last claim was made has already signalled,
+        // so try again rather than waiting for a signal that has been missed
+        if (admission->slotsFreed != slotsFreed) {
+            continue;
+        }
+        if (!admission->depth) {
+            pthread_cond_wait(&admission->changed, &admission->lock);
+        } else {
+            pthread_cond_timedwait(&admission->changed, &admission->lock,
+                    &admission->waiters[admission->head].deadline);
+        }
+    }
+    return NULL;
+}
+
+Admission* admission_init(int maxWaiting, int maxWaitMsecs,
+        ClaimHandler claim, ConnectionHandler admit, ConnectionHandler reject,
+        void* arg) {
+    Admission* admission = calloc(1, sizeof(Admission));
+    if (!admission) {
+        return NULL;
+    }
+    admission->waiters = malloc(sizeof(Waiter) * maxWaiting);
+    if (!admission->waiters) {
+        free(admission);
+        return NULL;
+    }
+    admission->claim = claim;
+    admission->admit = admit;
+    admission->reject = reject;
+    admission->arg = arg;
+    admission->maxWaiting = maxWaiting;
+    admission->maxWaitUsecs = maxWaitMsecs * USECS_PER_MSEC;
+    pthread_mutex_init(&admission->lock, NULL);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&admission->changed, &attr);
+    pthread_condattr_destroy(&attr);
+
+    pthread_t threadId;
+    if (pthread_create(&threadId, NULL, admission_thread, admission)) {
+        return NULL;
+    }
+    pthread_detach(threadId);
+    return admission;
+}
+
+bool admission_wait(Admission* admission, int fd) {
+    pthread_mutex_lock(&admission->lock);
+    if (admission->depth == admission->maxWaiting) {
+        admission->numQueueFull++;
+        pthread_mutex_unlock(&admission->lock);
+        return false;
+    }
+    Waiter* waiter = &admission->waiters[(admission->head + admission->depth)
+            % admission->maxWaiting];
+    waiter->fd = fd;
+    clock_gettime(CLOCK_MONOTONIC, &waiter->arrived);
+    waiter->deadline = waiter->arrived;
+    waiter->deadline.tv_nsec += admission->maxWaitUsecs % USECS_PER_SEC *
+            NSECS_PER_USEC;
+    waiter->deadline.tv_sec += admission->maxWaitUsecs / USECS_PER_SEC +
+            waiter->deadline.tv_nsec / NSECS_PER_SEC;
+    waiter->deadline.tv_nsec %= NSECS_PER_SEC;
+    admission->depth++;
+    if (admission->depth > admission->maxDepth) {
+        admission->maxDepth = admission->depth;
+    }
+    pthread_cond_signal(&admission->changed);
+    pthread_mutex_unlock(&admission->lock);
+    return true;
+}
+
+int admission_num_waiting(Admission* admission) {
+    pthread_mutex_lock(&admission->lock);
+    int depth = admission->depth;
+    pthread_mutex_unlock(&admission->lock);
+    return depth;
+}
+
+void admission_slot_freed(Admission* admission) {
+    pthread_mutex_lock(&admission->lock);
+    admission->slotsFreed++;
+    pthread_cond_signal(&admission->changed);
+    pthread_mutex_unlock(&admission->lock);
+}
+
+/* Compare two wait times for sorting.
+ *
+ * Params:
+ *      a: A pointer to the first wait.
+ *      b: A pointer to the second wait.
+ *
+ * Return:
+ *      Negative, zero or positive as a is less than, equal to or greater
+ *      than b.
+ */
+static int compare_wait(const void* a, const void* b) {
+    unsigned long x = *(const unsigned long*)a;
+    unsigned long y = *(const unsigned long*)b;
+    return (x > y) - (x < y);
+}
+
+void admission_print_stats(Admission* admission, FILE* out) {
+    unsigned long waits[WAIT_SAMPLES];
+    pthread_mutex_lock(&admission->lock);
+    fprintf(out, "Admission queue depth:%d\n", admission->depth);
+    fprintf(out, "Admission queue max depth:%d\n", admission->maxDepth);
+    fprintf(out, "Admitted after waiting:%lu\n", admission->numAdmitted);
+    fprintf(out, "Rejected after max wait:%lu\n", admission->numTimedOut);
+    fprintf(out, "Rejected with queue full:%lu\n", admission->numQueueFull);
+    int numSamples = admission->numSamples;
+    memcpy(waits, admission->waitUsecs, sizeof(unsigned long) * numSamples);
+    pthread_mutex_unlock(&admission->lock);
+
+    qsort(waits, numSamples, sizeof(unsigned long), compare_wait);
+    fprintf(out, "Admission wait (us):");
+    for (int i = 0; i < NUM_PERCENTILES; i++) {
+        // The nth thousandth of the samples, counting from 1
+        int index = (numSamples * percentiles[i] + 999) / 1000 - 1;
+        fprintf(out, " %s:%lu", percentileNames[i],
+                numSamples ? waits[index < 0 ? 0 : index] : 0);
+    }
+    fprintf(out, "\n");
+}
@@ -0,0 +1,99 @@
+/* FILE: admission.h
+ *
+ * AUTHOR: Tariq Soliman
+ * STUDENT NO.: 45287316
+ *
+ * DESCRIPTION:
+ * A waiting room for connections accepted while the server is full. Rather
+ * than being turned away at once, a connection waits in a bounded queue and
+ * is admitted, oldest first, as soon as a connection slot frees up. One that
+ * has waited longer than the maximum wait is turned away instead, as is one
+ * that arrives while the queue is full. While any connection is waiting, new
+ * ones join the back of the queue too, so a freed slot goes to the oldest.
+ *
+ * A thread sleeps until a slot is freed or the oldest connection's deadline
+ * passes. The handlers it calls are given the argument the queue was started
+ * with.
+ *
+ * How long admitted connections waited is kept for the most recent ones, so
+ * percentiles of the wait can be reported.
+ */
+
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+/* A function that claims a free connection slot, returning false if there
+ * isn't one.
+ */
+typedef bool (*ClaimHandler)(void* arg);
+
+/* A function that serves a connection that has been given a slot (admit) or
+ * turns it away (reject). Either way the function takes over the socket.
+ */
+typedef void (*ConnectionHandler)(int fd, void* arg);
+
+/* A queue of connections waiting to be admitted.*/
+typedef struct Admission Admission;
+
+/* Start a queue of waiting connections and the thread that admits them.
+ *
+ * Params:
+ *      maxWaiting: The most connections that can wait at once.
+ *      maxWaitMsecs: The longest a connection waits before it is rejected.
+ *      claim: The function to claim a free slot with.
+ *      admit: The function to serve an admitted connection with.
+ *      reject: The function to turn a connection away with.
+ *      arg: The argument passed to the handlers.
+ *
+ * Return:
+ *      The Admission or NULL if it could not be started.
+ */
+Admission* admission_init(int maxWaiting, int maxWaitMsecs,
+        ClaimHandler claim, ConnectionHandler admit, ConnectionHandler reject,
+        void* arg);
+
+/* Make a connection wait for a slot.
+ *
+ * Params:
+ *      admission: The queue to wait in.
+ *      fd: The connection's socket.
+ *
+ * Return:
+ *      false if the queue is full, in which case the caller still owns the
+ *      socket.
+ */
+bool admission_wait(Admission* admission, int fd);
+
+/* Get the number of connections waiting in the queue.
+ *
+ * Params:
+ *      admission: The queue of interest.
+ *
+ * Return:
+ *      The number of connections waiting.
+ */
+int admission_num_waiting(Admission* admission);
+
+/* Tell the queue that a connection slot has been freed, so a waiting
+ * connection can be admitted. This must not be called while holding a lock
+ * that the claim handler takes.
+ *
+ * Params:
+ *      admission: The queue of waiting connections.
+ */
+void admission_slot_freed(Admission* admission);
+
+/* Print statistics about the queue: how many connections are waiting, the
+ * most that have waited at once, how many were admitted and rejected, and
+ * percentiles of how long recently admitted connections waited.
+ *
+ * Params:
+ *      admission: The queue of interest.
+ *      out: Where to print the statistics.
+ */
+void admission_print_stats(Admission* admission, FILE* out);
+
+#endif
@@ -0,0 +1,217 @@
+/* FILE: bgsave.c
+ *
+ * AUTHOR: Tariq Soliman
+ * STUDENT NO.: 45287316
+ *
+ * DESCRIPTION:
+ * Saves the databases to a file in the background by forking a child
+ * process. See bgsave.h.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "bgsave.h"
+#include "journal.h"
+
+#define SMAPS_PATH "/proc/self/smaps_rollup"
+#define PRIVATE_DIRTY_FIELD "Private_Dirty:"
+#define SMAPS_LINE_SIZE 256
+#define BYTES_PER_KB 1024
+#define USECS_PER_SEC 1000000L
+#define NSECS_PER_USEC 1000L
+#define USECS_PER_MSEC 1000L
+
+struct BgSave {
+    char* path;
+    Database** dbs;
+    int numDbs;
+    pthread_mutex_t lock;
+    pid_t child;                // The running save or 0 if there isn't one
+    int pipeFd;                 // Read end of the pipe from the child
+    struct timespec started;
+    unsigned long numSaves;
+    unsigned long numFailed;
+    unsigned long lastForkUsecs;
+    unsigned long maxForkUsecs;
+    unsigned long lastCowPages;
+    unsigned long lastSaveMsecs;
+};
+
+/* Get the number of microseconds from one time to another.
+ *
+ * Params:
+ *      from: The earlier time.
+ *      to: The later time.
+ *
+ * Return:
+ *      The number of microseconds between the times.
+ */
+static unsigned long usecs_between(struct timespec* from,
+        struct timespec* to) {
+    return (to->tv_sec - from->tv_sec) * USECS_PER_SEC +
+            (to->tv_nsec - from->tv_nsec) / NSECS_PER_USEC;
+}
+
+/* Get the number of bytes of this process's memory that are private and
+ * dirty. In a forked child this is the memory that has been copied since the
+ * fork rather than shared with the parent.
+ *
+ * Return:
+ *      The number of bytes or 0 if it could not be read.
+ */
+static uint64_t private_dirty_bytes(void) {
+    FILE* smaps = fopen(SMAPS_PATH, "r");
+    if (!smaps) {
+        return 0;
+    }
+
+    uint64_t total = 0;
+    char line[SMAPS_LINE_SIZE];
+    while (fgets(line, sizeof(line), smaps)) {
+        unsigned long kb;
+        if (!strncmp(line, PRIVATE_DIRTY_FIELD, strlen(PRIVATE_DIRTY_FIELD))
+                && sscanf(line + strlen(PRIVATE_DIRTY_FIELD), "%lu",
+                &kb) == 1) {
+            total += (uint64_t)kb * BYTES_PER_KB;
+        }
+    }
+    fclose(smaps);
+    return total;
+}
+
+/* Save the databases in the child process, report the memory copied for it
+ * to the parent and exit. The databases are a frozen copy of the parent's so
+ * they are read without locking.
+ *
+ * Params:
+ *      save: The BgSave of the databases to save.
+ *      fd: The write end of the pipe to the parent.
+ */
+static void save_child(BgSave* save, int fd) {
+    bool ok = journal_dump(save->path, save->dbs, save->numDbs);
+    uint64_t cowBytes = private_dirty_bytes();
+    ok = write(fd, &cowBytes, sizeof(cowBytes)) == sizeof(cowBytes) && ok;
+    _exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+BgSave* bgsave_init(const char* path, Database** dbs, int numDbs) {
+    BgSave* save = calloc(1, sizeof(BgSave));
+    if (!save) {
+        return NULL;
+    }
+    save->path = strdup(path);
+    save->dbs = malloc(sizeof(Database*) * numDbs);
+    if (!save->path || !save->dbs) {
+        free(save->path);
+        free(save->dbs);
+        free(save);
+        return NULL;
+    }
+    memcpy(save->dbs, dbs, sizeof(Database*) * numDbs);
+    save->numDbs = numDbs;
+    pthread_mutex_init(&save->lock, NULL);
+    return save;
+}
+
+BgSaveResult bgsave_start(BgSave* save) {
+    pthread_mutex_lock(&save->lock);
+    if (save->child) {
+        pthread_mutex_unlock(&save->lock);
+        return BGSAVE_IN_PROGRESS;
+    }
+    int fds[2];
+    if (pipe(fds) < 0) {
+        save->numFailed++;
+        pthread_mutex_unlock(&save->lock);
+        return BGSAVE_FAILED;
+    }
+
+    // With every shard locked no other thread is part way through changing
+    // a store, so the child gets a consistent copy of all of them
+    for (int i = 0; i < save->numDbs; i++) {
+        database_lock_all(save->dbs[i]);
+    }
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pid_t pid = fork();
+    if (!pid) {
+        close(fds[0]);
+        save_child(save, fds[1]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    for (int i = save->numDbs - 1; i >= 0; i--) {
+        database_unlock_all(save->dbs[i]);
+    }
+
+    close(fds[1]);
+    if (pid < 0) {
+        close(fds[0]);
+        save->numFailed++;
+        pthread_mutex_unlock(&save->lock);
+        return BGSAVE_FAILED;
+    }
+    save->lastForkUsecs = usecs_between(&start, &end);
+    if (save->lastForkUsecs > save->maxForkUsecs) {
+        save->maxForkUsecs = save->lastForkUsecs;
+    }
+    save->child = pid;
+    save->pipeFd = fds[0];
+    save->started = start;
+
+    pthread_t threadId;
+    pthread_create(&threadId, NULL, bgsave_wait_thread, save);
+    pthread_detach(threadId);
+    pthread_mutex_unlock(&save->lock);
+    return BGSAVE_STARTED;
+}
+
+void* bgsave_wait_thread(void* arg) {
+    BgSave* save = (BgSave*)arg;
+    pthread_mutex_lock(&save->lock);
+    pid_t child = save->child;
+    int pipeFd = save->pipeFd;
+    pthread_mutex_unlock(&save->lock);
+
+    // The child only writes once the save is finished
+    uint64_t cowBytes = 0;
+    bool ok = read(pipeFd, &cowBytes, sizeof(cowBytes)) == sizeof(cowBytes);
+    close(pipeFd);
+    int status;
+    ok = waitpid(child, &status, 0) == child && WIFEXITED(status) &&
+            WEXITSTATUS(status) == EXIT_SUCCESS && ok;
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    pthread_mutex_lock(&save->lock);
+    if (ok) {
+        save->numSaves++;
+        save->lastCowPages = cowBytes / sysconf(_SC_PAGESIZE);
+        save->lastSaveMsecs = usecs_between(&save->started, &end) /
+                USECS_PER_MSEC;
+    } else {
+        save->numFailed++;
+    }
+    save->child = 0;
+    pthread_mutex_unlock(&save->lock);
+    return NULL;
+}
+
+void bgsave_print_stats(BgSave* save, FILE* out) {
+    pthread_mutex_lock(&save->lock);
+    fprintf(out, "Background saves:%lu\n", save->numSaves);
+    fprintf(out, "Background save failures:%lu\n", save->numFailed);
+    fprintf(out, "Background save in progress:%s\n",
+            save->child ? "yes" : "no");
+    fprintf(out, "Background save last fork (us):%lu\n",
+            save->lastForkUsecs);
+    fprintf(out, "Background save max fork (us):%lu\n", save->maxForkUsecs);
+    fprintf(out, "Background save last COW pages:%lu\n",
+            save->lastCowPages);
+    fprintf(out, "Background save last duration (ms):%lu\n",
+            save->lastSaveMsecs);
+    pthread_mutex_unlock(&save->lock);
+}
@@ -0,0 +1,77 @@
+/* FILE: bgsave.h
+ *
+ * AUTHOR: Tariq Soliman
+ * STUDENT NO.: 45287316
+ *
+ * DESCRIPTION:
+ * Saves the databases to a file in the background. Every shard is locked
+ * just long enough to fork() a child process, which writes the databases out
+ * with journal_dump() while the parent carries on serving clients. The
+ * kernel shares the parent's memory with the child copy-on-write, so a page
+ * is only copied if the parent changes it before the child has finished.
+ *
+ * The time taken by fork() and the number of pages copied for the child (its
+ * private dirty memory, as reported by /proc/self/smaps_rollup once the save
+ * is written) are recorded for each save.
+ */
+
+#ifndef BGSAVE_H
+#define BGSAVE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "database.h"
+
+/* The background saves of a set of databases.*/
+typedef struct BgSave BgSave;
+
+/* The outcome of asking for a background save.*/
+typedef enum BgSaveResult {
+    BGSAVE_STARTED,
+    BGSAVE_IN_PROGRESS,     // A save is already running
+    BGSAVE_FAILED           // The child could not be started
+} BgSaveResult;
+
+/* Create the state needed to save a set of databases in the background.
+ *
+ * Params:
+ *      path: The file to save the databases to.
+ *      dbs: The databases to save (the array is copied), in the order used
+ *      for the journal so the file can be used as a journal snapshot.
+ *      numDbs: The number of databases.
+ *
+ * Return:
+ *      The new BgSave or NULL if it could not be allocated.
+ */
+BgSave* bgsave_init(const char* path, Database** dbs, int numDbs);
+
+/* Start saving the databases in a child process, unless a save is already
+ * running. This returns as soon as the child has been forked.
+ *
+ * Params:
+ *      save: The BgSave of the databases to save.
+ *
+ * Return:
+ *      Whether the save was started.
+ */
+BgSaveResult bgsave_start(BgSave* save);
+
+/* A thread that waits for a background save's child to finish and records
+ * how the save went.
+ *
+ * Params:
+ *      arg: A pointer to the BgSave whose child to wait for.
+ */
+void* bgsave_wait_thread(void* arg);
+
+/* Print statistics about the background saves.
+ *
+ * Params:
+ *      save: The BgSave of interest.
+ *      out: Where to print the statistics.
+ */
+void bgsave_print_stats(BgSave* save, FILE* out);
+
+#endif
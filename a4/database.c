@@ -0,0 +1,606 @@
+/* FILE: database.c
+ *
+ * AUTHOR: Tariq Soliman
+ * STUDENT NO.: 45287316
+ *
+ * DESCRIPTION:
+ * A database made up of one or more independently locked StringStore shards.
+ * Each key always hashes to the same shard so clients working on different
+ * keys can usually access the database at the same time. Shards can be
+ * protected by a mutex, by a reader-writer lock or, for GETs, by nothing at
+ * all. See database.h.
+ */
+
+#define _GNU_SOURCE     // For pthread_rwlockattr_setkind_np()
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "database.h"
+#include "journal.h"
+
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+#define SHARD_HASH_SHIFT 32
+#define NSECS_PER_MSEC 1000000L
+
+struct Database {
+    Shard* shards;
+    int numShards;
+    Journal* journal;
+    int dbId;
+    unsigned long numExpired;
+    int snapShard;      // The shard whose snapshot is being read
+};
+
+/* Hash a key to pick a shard using 64 bit FNV-1a. Only the upper half of the
+ * hash is used since the StringStore uses the lower bits to place the key
+ * within its table, and reusing those would crowd each shard's keys together.
+ *
+ * Params:
+ *      key: The string to hash.
+ *
+ * Return:
+ *      The hash of the key.
+ */
+static uint32_t shard_hash(const char* key) {
+    uint64_t hash = FNV_OFFSET;
+    for (const unsigned char* c = (const unsigned char*)key; *c; c++) {
+        hash ^= *c;
+        hash *= FNV_PRIME;
+    }
+    return (uint32_t)(hash >> SHARD_HASH_SHIFT);
+}
+
+/* Initialise the lock for a shard. Reader-writer locks prefer writers, so a
+ * steady stream of GETs can't keep a PUT or DELETE waiting forever; GETs that
+ * must never wait use LOCK_LOCKFREE instead.
+ *
+ * Params:
+ *      shard: The shard whose lock should be initialised.
+ *      mode: The kind of lock to use.
+ */
+static void shard_lock_init(Shard* shard, LockMode mode) {
+    shard->mode = mode;
+    shard->writing = false;
+    if (mode != LOCK_RWLOCK) {
+        pthread_mutex_init(&shard->mutex, NULL);
+        return;
+    }
+
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setkind_np(&attr,
+            PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&shard->rwlock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+}
+
+Database* database_init(int numShards, LockMode mode) {
+    Database* db = malloc(sizeof(Database));
+    if (!db) {
+        return NULL;
+    }
+    db->shards = calloc(numShards, sizeof(Shard));
+    if (!db->shards) {
+        free(db);
+        return NULL;
+    }
+    db->numShards = numShards;
+    db->journal = NULL;
+    db->dbId = 0;
+    db->numExpired = 0;
+    db->snapShard = 0;
+
+    for (int i = 0; i < numShards; i++) {
+        db->shards[i].store = stringstore_init();
+        shard_lock_init(&db->shards[i], mode);
+        if (!db->shards[i].store) {
+            db->numShards = i + 1;
+            return database_free(db);
+        }
+        if (mode == LOCK_LOCKFREE) {
+            stringstore_enable_unlocked_reads(db->shards[i].store);
+        }
+    }
+    return db;
+}
+
+Database* database_free(Database* db) {
+    for (int i = 0; i < db->numShards; i++) {
+        if (db->shards[i].store) {
+            stringstore_free(db->shards[i].store);
+        }
+        if (db->shards[i].mode == LOCK_RWLOCK) {
+            pthread_rwlock_destroy(&db->shards[i].rwlock);
+        } else {
+            pthread_mutex_destroy(&db->shards[i].mutex);
+        }
+    }
+    free(db->shards);
+    free(db);
+    return NULL;
+}
+
+Shard* database_get_shard(Database* db, const char* key) {
+    if (db->numShards == 1) {
+        return &db->shards[0];
+    }
+    return &db->shards[shard_hash(key) % db->numShards];
+}
+
+Shard* database_shard_at(Database* db, int index) {
+    return &db->shards[index];
+}
+
+void database_set_journal(Database* db, Journal* journal, int dbId) {
+    db->journal = journal;
+    db->dbId = dbId;
+}
+
+uint64_t database_log_put(Database* db, const char* key, const char* value,
+        size_t valueLen) {
+    if (!db->journal) {
+        return 0;
+    }
+    return journal_log_put(db->journal, db->dbId, key, value, valueLen);
+}
+
+uint64_t database_log_expire(Database* db, const char* key,
+        uint64_t expiresAt) {
+    if (!db->journal) {
+        return 0;
+    }
+    return journal_log_expire(db->journal, db->dbId, key, expiresAt);
+}
+
+uint64_t database_log_value(Database* db, StringStore* store,
+        const char* key) {
+    if (!db->journal) {
+        return 0;
+    }
+    // The value was just written so it isn't compressed and this can't fail
+    const char* value = stringstore_retrieve_ref(store, key);
+    if (!value) {
+        return 0;
+    }
+    uint64_t ticket = journal_log_put(db->journal, db->dbId, key, value,
+            stringstore_value_len(value));
+    stringstore_release(value);
+    // A PUT clears the expiry, so it has to be logged again after it
+    uint64_t expiresAt = stringstore_get_expiry(store, key);
+    if (expiresAt) {
+        ticket = journal_log_expire(db->journal, db->dbId, key, expiresAt);
+    }
+    return ticket;
+}
+
+uint64_t database_log_delete(Database* db, const char* key) {
+    if (!db->journal) {
+        return 0;
+    }
+    return journal_log_delete(db->journal, db->dbId, key);
+}
+
+void database_wait_logged(Database* db, uint64_t ticket) {
+    if (db->journal) {
+        journal_wait_commit(db->journal, ticket);
+    }
+}
+
+/* Apply a run of consecutive PUTs in a batch to a shard, which must be locked
+ * for writing. If the arrays stringstore_add_many() needs can't be
+ * allocated, the PUTs are added one at a time instead.
+ *
+ * Params:
+ *      db: The database the shard belongs to.
+ *      shard: The shard to add to.
+ *      ops: The batch.
+ *      order: The positions of the shard's operations in the batch, in order.
+ *      count: The number of PUTs in the run.
+ *      ticket: Set to the ticket of the last PUT logged.
+ */
+static void apply_puts(Database* db, Shard* shard, BatchOp* ops,
+        const int* order, int count, uint64_t* ticket) {
+    const char** keys = malloc(sizeof(char*) * count);
+    const char** values = malloc(sizeof(char*) * count);
+    size_t* lens = malloc(sizeof(size_t) * count);
+    int* results = malloc(sizeof(int) * count);
+    if (!keys || !values || !lens || !results) {
+        for (int i = 0; i < count; i++) {
+            BatchOp* op = &ops[order[i]];
+            op->success = stringstore_add_len(shard->store, op->key,
+                    op->value, op->valueLen);
+            if (op->success) {
+                *ticket = database_log_put(db, op->key, op->value,
+                        op->valueLen);
+            }
+        }
+    } else {
+        for (int i = 0; i < count; i++) {
+            keys[i] = ops[order[i]].key;
+            values[i] = ops[order[i]].value;
+            lens[i] = ops[order[i]].valueLen;
+        }
+        stringstore_add_many(shard->store, count, keys, values, lens,
+                results);
+        for (int i = 0; i < count; i++) {
+            ops[order[i]].success = results[i];
+            if (results[i]) {
+                *ticket = database_log_put(db, keys[i], values[i], lens[i]);
+            }
+        }
+    }
+    free(keys);
+    free(values);
+    free(lens);
+    free(results);
+}
+
+/* Apply the operations of a batch that belong to one shard, holding the
+ * shard's lock for all of them.
+ *
+ * Params:
+ *      db: The database the shard belongs to.
+ *      shard: The shard to apply the operations to.
+ *      ops: The batch.
+ *      order: The positions of the shard's operations in the batch, in order.
+ *      count: The number of operations for the shard.
+ *
+ * Return:
+ *      The ticket of the last change logged (0 if there were none).
+ */
+static uint64_t apply_shard_ops(Database* db, Shard* shard, BatchOp* ops,
+        const int* order, int count) {
+    bool readOnly = true;
+    for (int i = 0; i < count; i++) {
+        readOnly = readOnly && ops[order[i]].type == BATCH_GET;
+    }
+    if (readOnly) {
+        shard_read_lock(shard);
+    } else {
+        shard_write_lock(shard);
+    }
+
+    uint64_t ticket = 0;
+    for (int i = 0; i < count; i++) {
+        BatchOp* op = &ops[order[i]];
+        if (op->type == BATCH_PUT) {
+            int run = 1;
+            while (i + run < count && ops[order[i + run]].type == BATCH_PUT) {
+                run++;
+            }
+            apply_puts(db, shard, ops, order + i, run, &ticket);
+            i += run - 1;
+        } else if (op->type == BATCH_DELETE) {
+            op->success = stringstore_delete(shard->store, op->key);
+            if (op->success) {
+                ticket = database_log_delete(db, op->key);
+            }
+        } else {
+            op->value = stringstore_retrieve_ref(shard->store, op->key);
+            op->success = op->value != NULL;
+            op->valueLen = op->success ? stringstore_value_len(op->value) : 0;
+        }
+    }
+    shard_unlock(shard);
+    return ticket;
+}
+
+bool database_apply_batch(Database* db, BatchOp* ops, int numOps) {
+    // Sort the operations by shard, keeping them in order within each shard
+    // (so operations on the same key still happen in order)
+    int* shardStart = calloc(db->numShards + 1, sizeof(int));
+    int* shardOf = malloc(sizeof(int) * numOps);
+    int* order = malloc(sizeof(int) * numOps);
+    int* next = malloc(sizeof(int) * db->numShards);
+    if (!shardStart || !shardOf || !order || !next) {
+        free(shardStart);
+        free(shardOf);
+        free(order);
+        free(next);
+        return false;
+    }
+    for (int i = 0; i < numOps; i++) {
+        shardOf[i] = database_get_shard(db, ops[i].key) - db->shards;
+        shardStart[shardOf[i] + 1]++;
+    }
+    for (int i = 0; i < db->numShards; i++) {
+        shardStart[i + 1] += shardStart[i];
+    }
+    memcpy(next, shardStart, sizeof(int) * db->numShards);
+    for (int i = 0; i < numOps; i++) {
+        order[next[shardOf[i]]++] = i;
+    }
+
+    uint64_t lastTicket = 0;
+    for (int i = 0; i < db->numShards; i++) {
+        int count = shardStart[i + 1] - shardStart[i];
+        if (count) {
+            uint64_t ticket = apply_shard_ops(db, &db->shards[i], ops,
+                    order + shardStart[i], count);
+            if (ticket > lastTicket) {
+                lastTicket = ticket;
+            }
+        }
+    }
+
+    free(shardStart);
+    free(shardOf);
+    free(order);
+    free(next);
+
+    // Records are committed in order so waiting for the last one is enough
+    database_wait_logged(db, lastTicket);
+    return true;
+}
+
+void database_start_expirer(Database* db) {
+    pthread_t threadId;
+    pthread_create(&threadId, NULL, expire_thread, db);
+    pthread_detach(threadId);
+}
+
+void* expire_thread(void* arg) {
+    Database* db = (Database*)arg;
+    struct timespec interval = {.tv_sec = 0,
+            .tv_nsec = EXPIRE_INTERVAL_MS * NSECS_PER_MSEC};
+
+    while (1) {
+        nanosleep(&interval, NULL);
+        for (int i = 0; i < db->numShards; i++) {
+            Shard* shard = &db->shards[i];
+            shard_write_lock(shard);
+            int expired = stringstore_expire(shard->store, EXPIRE_BATCH);
+            stringstore_migrate(shard->store, MIGRATE_BATCH);
+            stringstore_prune_versions(shard->store);
+            shard_unlock(shard);
+            if (expired) {
+                __atomic_add_fetch(&db->numExpired, expired,
+                        __ATOMIC_RELAXED);
+            }
+        }
+    }
+    return NULL;
+}
+
+unsigned long database_num_expired(Database* db) {
+    return __atomic_load_n(&db->numExpired, __ATOMIC_RELAXED);
+}
+
+void database_set_max_bytes(Database* db, size_t maxBytes) {
+    size_t shardBytes = maxBytes / db->numShards;
+    if (maxBytes && !shardBytes) {
+        shardBytes = 1;
+    }
+    for (int i = 0; i < db->numShards; i++) {
+        Shard* shard = &db->shards[i];
+        shard_write_lock(shard);
+        stringstore_set_max_bytes(shard->store, shardBytes);
+        shard_unlock(shard);
+    }
+}
+
+void database_memory_stats(Database* db, size_t* usedBytes,
+        uint64_t* evictions) {
+    *usedBytes = 0;
+    *evictions = 0;
+    for (int i = 0; i < db->numShards; i++) {
+        Shard* shard = &db->shards[i];
+        shard_read_lock(shard);
+        *usedBytes += stringstore_used_bytes(shard->store);
+        *evictions += stringstore_evictions(shard->store);
+        shard_unlock(shard);
+    }
+}
+
+void database_set_compression(Database* db, size_t minLen) {
+    for (int i = 0; i < db->numShards; i++) {
+        Shard* shard = &db->shards[i];
+        shard_write_lock(shard);
+        stringstore_set_compression(shard->store, minLen);
+        shard_unlock(shard);
+    }
+}
+
+void database_compression_stats(Database* db, size_t* numValues,
+        size_t* plainBytes, size_t* storedBytes) {
+    *numValues = 0;
+    *plainBytes = 0;
+    *storedBytes = 0;
+    for (int i = 0; i < db->numShards; i++) {
+        Shard* shard = &db->shards[i];
+        size_t values, plain, stored;
+        shard_read_lock(shard);
+        stringstore_compression_stats(shard->store, &values, &plain, &stored);
+        shard_unlock(shard);
+        *numValues += values;
+        *plainBytes += plain;
+        *storedBytes += stored;
+    }
+}
+
+bool database_enable_index(Database* db) {
+    for (int i = 0; i < db->numShards; i++) {
+        Shard* shard = &db->shards[i];
+        shard_write_lock(shard);
+        int ok = stringstore_enable_index(shard->store);
+        shard_unlock(shard);
+        if (!ok) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* A key and its value found by a scan. */
+typedef struct ScanResult {
+    char* key;
+    const char* value;
+} ScanResult;
+
+/* Compare two ScanResults by key for qsort().
+ *
+ * Params:
+ *      a: The first ScanResult.
+ *      b: The second ScanResult.
+ *
+ * Return:
+ *      A negative, zero or positive number if a's key is less than, equal to
+ *      or greater than b's key.
+ */
+static int compare_results(const void* a, const void* b) {
+    return strcmp(((const ScanResult*)a)->key, ((const ScanResult*)b)->key);
+}
+
+int database_scan(Database* db, const char* prefix, const char* after,
+        int limit, char** keys, const char** values) {
+    // Each shard can contribute up to limit keys, so find that many from
+    // every shard then keep the smallest
+    ScanResult* results = malloc(sizeof(ScanResult) * limit * db->numShards);
+    char** shardKeys = malloc(sizeof(char*) * limit);
+    const char** shardValues = malloc(sizeof(char*) * limit);
+    int numResults = 0;
+    if (!results || !shardKeys || !shardValues) {
+        free(results);
+        free(shardKeys);
+        free(shardValues);
+        return -2;
+    }
+
+    for (int i = 0; i < db->numShards; i++) {
+        Shard* shard = &db->shards[i];
+        shard_read_lock(shard);
+        int found = stringstore_scan(shard->store, prefix, after, limit,
+                shardKeys, shardValues);
+        shard_unlock(shard);
+
+        if (found < 0) {
+            for (int j = 0; j < numResults; j++) {
+                free(results[j].key);
+                stringstore_release(results[j].value);
+            }
+            numResults = found;
+            break;
+        }
+        for (int j = 0; j < found; j++) {
+            results[numResults].key = shardKeys[j];
+            results[numResults++].value = shardValues[j];
+        }
+    }
+
+    int count = numResults < limit ? numResults : limit;
+    if (numResults > 0) {
+        qsort(results, numResults, sizeof(ScanResult), compare_results);
+        for (int i = 0; i < numResults; i++) {
+            if (i < count) {
+                keys[i] = results[i].key;
+                values[i] = results[i].value;
+            } else {
+                free(results[i].key);
+                stringstore_release(results[i].value);
+            }
+        }
+    }
+
+    free(results);
+    free(shardKeys);
+    free(shardValues);
+    return count;
+}
+
+bool database_begin_snapshot(Database* db) {
+    database_lock_all(db);
+    bool ok = true;
+    for (int i = 0; i < db->numShards; i++) {
+        ok = stringstore_snapshot_begin(db->shards[i].store) && ok;
+    }
+    database_unlock_all(db);
+    db->snapShard = 0;
+    return ok;
+}
+
+int database_read_snapshot(Database* db, SnapshotItem* items, int maxItems) {
+    while (db->snapShard < db->numShards) {
+        Shard* shard = &db->shards[db->snapShard];
+        shard_write_lock(shard);
+        int count = stringstore_snapshot_read(shard->store, items, maxItems);
+        shard_unlock(shard);
+        if (count) {
+            return count;
+        }
+        db->snapShard++;
+    }
+    return 0;
+}
+
+void database_end_snapshot(Database* db) {
+    for (int i = 0; i < db->numShards; i++) {
+        Shard* shard = &db->shards[i];
+        shard_write_lock(shard);
+        stringstore_snapshot_end(shard->store);
+        shard_unlock(shard);
+    }
+}
+
+void database_lock_all(Database* db) {
+    // Shards are always locked in the same order so this can't deadlock
+    for (int i = 0; i < db->numShards; i++) {
+        shard_write_lock(&db->shards[i]);
+    }
+}
+
+void database_unlock_all(Database* db) {
+    for (int i = db->numShards - 1; i >= 0; i--) {
+        shard_unlock(&db->shards[i]);
+    }
+}
+
+void shard_read_lock(Shard* shard) {
+    if (shard->mode == LOCK_RWLOCK) {
+        pthread_rwlock_rdlock(&shard->rwlock);
+    } else {
+        pthread_mutex_lock(&shard->mutex);
+    }
+}
+
+void shard_write_lock(Shard* shard) {
+    if (shard->mode == LOCK_RWLOCK) {
+        pthread_rwlock_wrlock(&shard->rwlock);
+        return;
+    }
+    pthread_mutex_lock(&shard->mutex);
+    if (shard->mode == LOCK_LOCKFREE) {
+        // Unlocked readers check for this, so it is only needed for writes
+        shard->writing = true;
+        stringstore_write_begin(shard->store);
+    }
+}
+
+void shard_unlock(Shard* shard) {
+    if (shard->mode == LOCK_RWLOCK) {
+        pthread_rwlock_unlock(&shard->rwlock);
+        return;
+    }
+    if (shard->writing) {
+        shard->writing = false;
+        stringstore_write_end(shard->store);
+    }
+    pthread_mutex_unlock(&shard->mutex);
+}
+
+bool parse_lock_mode(const char* name, LockMode* mode) {
+    if (!strcmp(name, LOCK_MUTEX_NAME)) {
+        *mode = LOCK_MUTEX;
+    } else if (!strcmp(name, LOCK_RWLOCK_NAME)) {
+        *mode = LOCK_RWLOCK;
+    } else if (!strcmp(name, LOCK_LOCKFREE_NAME)) {
+        *mode = LOCK_LOCKFREE;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+int database_num_shards(Database* db) {
+    return db->numShards;
+}
@@ -0,0 +1,416 @@
+/* FILE: database.h
+ *
+ * AUTHOR: Tariq Soliman
+ * STUDENT NO.: 45287316
+ *
+ * DESCRIPTION:
+ * A database made up of one or more independently locked StringStore shards.
+ * Each key always hashes to the same shard so clients working on different
+ * keys can usually access the database at the same time. Shards can be
+ * protected by a mutex, by a reader-writer lock, which lets any number of
+ * readers retrieve values from a shard at once, or be read without a lock.
+ * The reader-writer lock prefers writers, so a waiting writer holds back new
+ * readers rather than waiting for as long as readers keep arriving. Without
+ * a lock, writers still take a mutex but GETs take nothing and never wait
+ * for each other or for a writer to be let in; one that overlaps a write
+ * just looks again (see stringstore_retrieve_unlocked()).
+ */
+
+#ifndef DATABASE_H
+#define DATABASE_H
+
+#define DEFAULT_SHARDS 1
+#define MAX_SHARDS 4096
+#define LOCK_MUTEX_NAME "mutex"
+#define LOCK_RWLOCK_NAME "rwlock"
+#define LOCK_LOCKFREE_NAME "lockfree"
+#define EXPIRE_INTERVAL_MS 100  // How often expired keys are removed
+#define EXPIRE_BATCH 1024       // The most timers handled per shard each time
+#define MIGRATE_BATCH 4096      // The most slots migrated per shard each time
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "stringstoreExt.h"
+
+/* The kind of lock used to protect each shard.*/
+typedef enum LockMode {
+    LOCK_MUTEX,
+    LOCK_RWLOCK,
+    LOCK_LOCKFREE   // A mutex for writers, nothing for GETs
+} LockMode;
+
+/* A single StringStore and the lock that must be held while accessing it.
+ * Only the lock matching mode is used (the mutex for LOCK_LOCKFREE).*/
+typedef struct Shard {
+    StringStore* store;
+    LockMode mode;
+    pthread_mutex_t mutex;
+    pthread_rwlock_t rwlock;
+    bool writing;       // Whether the mutex is held for writing (lockfree)
+} Shard;
+
+/* The kinds of operation that can be applied in a batch.*/
+typedef enum BatchOpType {
+    BATCH_GET,
+    BATCH_PUT,
+    BATCH_DELETE
+} BatchOpType;
+
+/* A single operation in a batch. For a GET, value is set to a reference to
+ * the value found (which must be released with stringstore_release()) or
+ * NULL if the key doesn't exist, and valueLen to its length.*/
+typedef struct BatchOp {
+    BatchOpType type;
+    const char* key;
+    const char* value;
+    size_t valueLen;
+    bool success;
+} BatchOp;
+
+/* A collection of shards that together make up one database.*/
+typedef struct Database Database;
+
+/* The log that changes to a database are recorded in (see journal.h).*/
+struct Journal;
+
+/* Creates a new database with the given number of shards.
+ *
+ * Params:
+ *      numShards: The number of independently locked shards to split the
+ *      keys between (at least 1).
+ *      mode: The kind of lock to protect each shard with.
+ *
+ * Return:
+ *      A pointer to the new database or NULL if it could not be created.
+ */
+Database* database_init(int numShards, LockMode mode);
+
+/* Free all memory associated with the database and return NULL.
+ *
+ * Params:
+ *      db: The database to free.
+ */
+Database* database_free(Database* db);
+
+/* Get the shard that the given key belongs to. The shard's lock is not
+ * acquired.
+ *
+ * Params:
+ *      db: The database the key is in.
+ *      key: The key of interest.
+ *
+ * Return:
+ *      The shard that stores the key.
+ */
+Shard* database_get_shard(Database* db, const char* key);
+
+/* Get a shard by its position in the database.
+ *
+ * Params:
+ *      db: The database of interest.
+ *      index: The position of the shard (0 to database_num_shards() - 1).
+ *
+ * Return:
+ *      The shard at that position.
+ */
+Shard* database_shard_at(Database* db, int index);
+
+/* Record all future changes to the database in a journal.
+ *
+ * Params:
+ *      db: The database whose changes should be recorded.
+ *      journal: The journal to record changes in.
+ *      dbId: The position of the database in the journal.
+ */
+void database_set_journal(Database* db, struct Journal* journal, int dbId);
+
+/* Record a successful PUT in the database's journal, if it has one. The
+ * key's shard must still be locked for writing.
+ *
+ * Params:
+ *      db: The database the key was PUT in.
+ *      key: The key that was PUT.
+ *      value: The new value of the key (which may contain '\0's).
+ *      valueLen: The length of the value.
+ *
+ * Return:
+ *      A ticket to pass to database_wait_logged() after unlocking the shard.
+ */
+uint64_t database_log_put(Database* db, const char* key, const char* value,
+        size_t valueLen);
+
+/* Record the expiry time of a key that was just PUT in the database's
+ * journal, if it has one. The key's shard must still be locked for writing.
+ *
+ * Params:
+ *      db: The database the key was PUT in.
+ *      key: The key that expires.
+ *      expiresAt: The time the key expires in milliseconds since the Unix
+ *      epoch.
+ *
+ * Return:
+ *      A ticket to pass to database_wait_logged() after unlocking the shard.
+ */
+uint64_t database_log_expire(Database* db, const char* key,
+        uint64_t expiresAt);
+
+/* Record the current value of a key that was just changed in place (by an
+ * increment or append) in the database's journal, if it has one. The value
+ * is logged as a PUT, followed by an EXPIRE if the key expires, so that
+ * replaying the records twice (e.g. from both a snapshot and the log that
+ * follows it) gives the same result as replaying them once. The key's shard
+ * must still be locked for writing.
+ *
+ * Params:
+ *      db: The database the key is in.
+ *      store: The store of the key's shard.
+ *      key: The key that was changed.
+ *
+ * Return:
+ *      A ticket to pass to database_wait_logged() after unlocking the shard.
+ */
+uint64_t database_log_value(Database* db, StringStore* store,
+        const char* key);
+
+/* Record a successful DELETE in the database's journal, if it has one. The
+ * key's shard must still be locked for writing.
+ *
+ * Params:
+ *      db: The database the key was deleted from.
+ *      key: The key that was deleted.
+ *
+ * Return:
+ *      A ticket to pass to database_wait_logged() after unlocking the shard.
+ */
+uint64_t database_log_delete(Database* db, const char* key);
+
+/* Wait until a change recorded in the database's journal is durable. This
+ * only waits if the journal uses group commit.
+ *
+ * Params:
+ *      db: The database that was changed.
+ *      ticket: The ticket returned when the change was recorded.
+ */
+void database_wait_logged(Database* db, uint64_t ticket);
+
+/* Limit the memory used by the keys and values in the database. The limit
+ * is split evenly between the shards, each of which evicts its least
+ * recently used keys once it is over its share.
+ *
+ * Params:
+ *      db: The database to limit.
+ *      maxBytes: The most bytes to use or 0 for no limit.
+ */
+void database_set_max_bytes(Database* db, size_t maxBytes);
+
+/* Get the memory used by the database and the number of keys that have been
+ * evicted from it. Each shard is locked in turn while it is checked.
+ *
+ * Params:
+ *      db: The database of interest.
+ *      usedBytes: Where the number of bytes used by keys and values is saved.
+ *      evictions: Where the number of evicted keys is saved.
+ */
+void database_memory_stats(Database* db, size_t* usedBytes,
+        uint64_t* evictions);
+
+/* Compress values added to the database from now on that are at least a
+ * given length. See stringstore_set_compression().
+ *
+ * Params:
+ *      db: The database to compress values in.
+ *      minLen: The shortest value to compress or 0 to stop compressing.
+ */
+void database_set_compression(Database* db, size_t minLen);
+
+/* Get how much the database's compressed values have been compressed by.
+ * Each shard is locked in turn while it is checked.
+ *
+ * Params:
+ *      db: The database of interest.
+ *      numValues: Where the number of compressed values is saved.
+ *      plainBytes: Where their total length before compression is saved.
+ *      storedBytes: Where their total length after compression is saved.
+ */
+void database_compression_stats(Database* db, size_t* numValues,
+        size_t* plainBytes, size_t* storedBytes);
+
+/* Start a thread that removes expired keys from the database every
+ * EXPIRE_INTERVAL_MS milliseconds. Each shard is locked in turn and at most
+ * EXPIRE_BATCH of its timers are handled each time, so a burst of expiring
+ * keys can't hold a shard's lock for long. The thread also migrates up to
+ * MIGRATE_BATCH slots of any shard whose hash table is growing, so growing
+ * finishes even when the shard is only being read.
+ *
+ * Params:
+ *      db: The database to remove expired keys from.
+ */
+void database_start_expirer(Database* db);
+
+/* A thread that periodically removes expired keys from a database.
+ *
+ * Params:
+ *      arg: A pointer to the Database to remove expired keys from.
+ */
+void* expire_thread(void* arg);
+
+/* Get the number of keys that have been removed from the database because
+ * they expired.
+ *
+ * Params:
+ *      db: The database of interest.
+ *
+ * Return:
+ *      The number of expired keys removed.
+ */
+unsigned long database_num_expired(Database* db);
+
+/* Apply a batch of operations to the database. The operations are grouped by
+ * shard and each shard is locked once for all of its operations, which are
+ * applied in the order they appear in the batch. Runs of PUTs are added with
+ * stringstore_add_many(). Returns once every change made is durable.
+ *
+ * Params:
+ *      db: The database to apply the batch to.
+ *      ops: The operations to apply. The success of each is saved in it.
+ *      numOps: The number of operations.
+ *
+ * Return:
+ *      true if the batch was applied or false if memory ran out before any
+ *      of it was.
+ */
+bool database_apply_batch(Database* db, BatchOp* ops, int numOps);
+
+/* Keep an ordered index of the keys in every shard of the database so that
+ * it can be scanned with database_scan().
+ *
+ * Params:
+ *      db: The database to index.
+ *
+ * Return:
+ *      true if the indexes were created.
+ */
+bool database_enable_index(Database* db);
+
+/* Find keys in the database that start with a prefix, in order. Each shard
+ * is scanned separately (only locking that shard) and the results merged.
+ *
+ * Params:
+ *      db: The database to scan.
+ *      prefix: Only keys starting with this are found ("" for all keys).
+ *      after: Only keys greater than this are found (NULL to start from the
+ *      first key).
+ *      limit: The most keys to find.
+ *      keys: An array of at least limit elements. Copies of the keys found
+ *      are saved here and must be freed by the caller.
+ *      values: An array of at least limit elements. References to the values
+ *      of the keys found are saved here and must be released with
+ *      stringstore_release().
+ *
+ * Return:
+ *      The number of keys found, -1 if the database isn't indexed or -2 if
+ *      memory ran out (in which case nothing is saved in keys or values).
+ */
+int database_scan(Database* db, const char* prefix, const char* after,
+        int limit, char** keys, const char** values);
+
+/* Start a snapshot of the whole database. Every shard is locked at once while
+ * its snapshot is started, so the snapshot is consistent across shards, but
+ * the shards are only locked briefly while it is read. Only one snapshot of
+ * a database can be taken at a time, and only one thread may read it.
+ *
+ * Params:
+ *      db: The database to take a snapshot of.
+ *
+ * Return:
+ *      true if the snapshot was started.
+ */
+bool database_begin_snapshot(Database* db);
+
+/* Read the next key/value pairs from the database's snapshot. Each shard is
+ * only locked (for writing, as reading the snapshot moves it along) while a
+ * chunk of its pairs is read.
+ *
+ * Params:
+ *      db: The database whose snapshot to read.
+ *      items: An array of at least maxItems elements where the pairs read are
+ *      saved. Each key must be freed and each value released with
+ *      stringstore_release().
+ *      maxItems: The most pairs to read.
+ *
+ * Return:
+ *      The number of pairs read, 0 once the whole snapshot has been read or
+ *      -1 if the snapshot failed.
+ */
+int database_read_snapshot(Database* db, SnapshotItem* items, int maxItems);
+
+/* Finish with the database's snapshot, abandoning any of it that hasn't been
+ * read. This must be called after every database_begin_snapshot().
+ *
+ * Params:
+ *      db: The database whose snapshot to end.
+ */
+void database_end_snapshot(Database* db);
+
+/* Lock every shard of the database for writing, so nothing else can read or
+ * change it until database_unlock_all() is called. Shards are always locked
+ * in the same order.
+ *
+ * Params:
+ *      db: The database to lock.
+ */
+void database_lock_all(Database* db);
+
+/* Release the locks taken by database_lock_all().
+ *
+ * Params:
+ *      db: The database to unlock.
+ */
+void database_unlock_all(Database* db);
+
+/* Lock a shard for reading. The store must only be read (e.g. with
+ * stringstore_retrieve()) until shard_unlock() is called. Without a lock
+ * for GETs (LOCK_LOCKFREE) this takes the writers' mutex, so only reads that
+ * need a consistent view of more than one key should use it.
+ *
+ * Params:
+ *      shard: The shard to lock.
+ */
+void shard_read_lock(Shard* shard);
+
+/* Lock a shard for writing. The store may be read or modified until
+ * shard_unlock() is called.
+ *
+ * Params:
+ *      shard: The shard to lock.
+ */
+void shard_write_lock(Shard* shard);
+
+/* Release a lock taken by shard_read_lock() or shard_write_lock().
+ *
+ * Params:
+ *      shard: The shard to unlock.
+ */
+void shard_unlock(Shard* shard);
+
+/* Get the lock mode with the given name.
+ *
+ * Params:
+ *      name: The name of the lock mode (LOCK_MUTEX_NAME, LOCK_RWLOCK_NAME or
+ *      LOCK_LOCKFREE_NAME).
+ *      mode: Where the lock mode is saved to.
+ *
+ * Return:
+ *      true if the name was recognised.
+ */
+bool parse_lock_mode(const char* name, LockMode* mode);
+
+/* Get the number of shards in the database.
+ *
+ * Params:
+ *      db: The database of interest.
+ */
+int database_num_shards(Database* db);
+
+#endif
@@ -26,19 +26,52 @@ struct Stats {
     int numGets;
     int numPuts;
     int numDeletes;
+    int numScans;
+    int numBatches;
+    int numIncrements;
+    int numAppends;
+    int numNotModified;
+    int numPreconditionFails;
+    int numSnapshotGets;
+    int numEncodedGets;
+    Journal* journal;
+    Database* publicDb;
+    Database* privateDb;
+    BgSave* bgsave;
+    WorkerPool* workers;
+    EventLoop* loop;
+    Admission* admission;
+    int maxConnex;
     pthread_mutex_t* statsLock;
 };
 
 struct ClientArgs {
     int fd;
-    StringStore* publicDb;
-    StringStore* privateDb;
-    pthread_mutex_t* pubLock;
-    pthread_mutex_t* privLock;
+    Database* publicDb;
+    Database* privateDb;
     const char* authstring;
     Stats* stats;
 };
 
+struct ServerOpts {
+    int numShards;
+    LockMode lockMode;
+    const char* logPath;
+    int compactInterval;
+    bool groupCommit;
+    int syncWindow;
+    int syncBatch;
+    bool orderedIndex;
+    size_t maxMemory;
+    const char* savePath;
+    size_t compressMin;
+    int loopThreads;    // 0 to use a thread per connection instead
+    int numWorkers;     // 0 to start a thread for each connection
+    int workerQueue;
+    int admitWait;      // 0 to turn away connections over the limit at once
+    int admitQueue;
+};
+
 void print_stats(Stats* stats) {
     fprintf(stderr, "Connected clients:%d\n", stats->currConnected);
     fprintf(stderr, "Completed clients:%d\n", stats->totalDisconnected);
@@ -46,12 +79,69 @@ void print_stats(Stats* stats) {
     fprintf(stderr, "GET operations:%d\n", stats->numGets);
     fprintf(stderr, "PUT operations:%d\n", stats->numPuts);
     fprintf(stderr, "DELETE operations:%d\n", stats->numDeletes);
+    fprintf(stderr, "SCAN operations:%d\n", stats->numScans);
+    fprintf(stderr, "BATCH operations:%d\n", stats->numBatches);
+    fprintf(stderr, "INCR operations:%d\n", stats->numIncrements);
+    fprintf(stderr, "APPEND operations:%d\n", stats->numAppends);
+    fprintf(stderr, "Not modified responses:%d\n", stats->numNotModified);
+    fprintf(stderr, "Precondition failures:%d\n",
+            stats->numPreconditionFails);
+    fprintf(stderr, "Snapshot GETs:%d\n", stats->numSnapshotGets);
+    fprintf(stderr, "Read snapshots open:%zu\n", stringstore_num_views());
+    fprintf(stderr, "Compressed GET responses:%d\n", stats->numEncodedGets);
+    if (stats->publicDb) {
+        size_t publicBytes, privateBytes;
+        uint64_t publicEvictions, privateEvictions;
+        database_memory_stats(stats->publicDb, &publicBytes,
+                &publicEvictions);
+        database_memory_stats(stats->privateDb, &privateBytes,
+                &privateEvictions);
+        fprintf(stderr, "Public memory:%zu bytes\n", publicBytes);
+        fprintf(stderr, "Private memory:%zu bytes\n", privateBytes);
+        fprintf(stderr, "Evictions:%" PRIu64 "\n",
+                publicEvictions + privateEvictions);
+        print_compression_stats(stats);
+        fprintf(stderr, "Expired keys:%lu\n",
+                database_num_expired(stats->publicDb) +
+                database_num_expired(stats->privateDb));
+    }
+    if (stats->journal) {
+        journal_print_stats(stats->journal, stderr);
+    }
+    if (stats->bgsave) {
+        bgsave_print_stats(stats->bgsave, stderr);
+    }
+    if (stats->workers) {
+        workerpool_print_stats(stats->workers, stderr);
+    }
+    if (stats->admission) {
+        admission_print_stats(stats->admission, stderr);
+    }
+}
+
+void print_compression_stats(Stats* stats) {
+    size_t numValues, plainBytes, storedBytes;
+    database_compression_stats(stats->publicDb, &numValues, &plainBytes,
+            &storedBytes);
+    size_t privateValues, privatePlain, privateStored;
+    database_compression_stats(stats->privateDb, &privateValues,
+            &privatePlain, &privateStored);
+    numValues += privateValues;
+    plainBytes += privatePlain;
+    storedBytes += privateStored;
+
+    fprintf(stderr, "Compressed values:%zu\n", numValues);
+    fprintf(stderr, "Compression ratio:%.2f\n",
+            storedBytes ? (double)plainBytes / storedBytes : 1.0);
+    fprintf(stderr, "Compression saved:%zu bytes\n",
+            plainBytes - storedBytes);
 }
 
 void setup_sig_handling(Stats* stats) {
     sigset_t* set = malloc(sizeof(sigset_t));
     sigemptyset(set);
     sigaddset(set, SIGHUP);
+    sigaddset(set, BGSAVE_SIGNAL);
     int s = pthread_sigmask(SIG_BLOCK, set, NULL);
     pthread_t threadId;
 
@@ -71,13 +161,10 @@ void setup_sig_handling(Stats* stats) {
 }
 
 void client_args_init(ClientArgs* clientArgs, int fd, const char* authstring,
-        StringStore* publicDb, StringStore* privateDb,
-        pthread_mutex_t* pubLock, pthread_mutex_t* privLock, Stats* stats) {
+        Database* publicDb, Database* privateDb, Stats* stats) {
     clientArgs->fd = fd;
     clientArgs->publicDb = publicDb;
     clientArgs->privateDb = privateDb;
-    clientArgs->pubLock = pubLock;
-    clientArgs->privLock = privLock;
     clientArgs->authstring = authstring;
     clientArgs->stats = stats;
 }
@@ -97,12 +184,39 @@ Stats* stats_init(void) {
     stats->numGets = 0;
     stats->numPuts = 0;
     stats->numDeletes = 0;
+    stats->numScans = 0;
+    stats->numBatches = 0;
+    stats->numIncrements = 0;
+    stats->numAppends = 0;
+    stats->numNotModified = 0;
+    stats->numPreconditionFails = 0;
+    stats->numSnapshotGets = 0;
+    stats->numEncodedGets = 0;
+    stats->journal = NULL;
+    stats->publicDb = NULL;
+    stats->privateDb = NULL;
+    stats->bgsave = NULL;
+    stats->workers = NULL;
+    stats->loop = NULL;
+    stats->admission = NULL;
     stats->statsLock = statsLock;
     return stats;
 }
 
+void count_op(int* counter) {
+    __atomic_fetch_add(counter, 1, __ATOMIC_RELAXED);
+}
+
 int main(int argc, char* argv[]) {
-    check_args(argc, argv);
+    ServerOpts opts = {.numShards = DEFAULT_SHARDS, .lockMode = LOCK_MUTEX,
+            .logPath = NULL, .compactInterval = DEFAULT_COMPACT_INTERVAL,
+            .groupCommit = false, .syncWindow = DEFAULT_SYNC_WINDOW,
+            .syncBatch = DEFAULT_SYNC_BATCH, .orderedIndex = false,
+            .maxMemory = 0, .savePath = NULL,
+            .compressMin = DEFAULT_COMPRESS_MIN, .loopThreads = 0,
+            .numWorkers = 0, .workerQueue = DEFAULT_WORKER_QUEUE,
+            .admitWait = 0, .admitQueue = DEFAULT_ADMIT_QUEUE};
+    check_args(&argc, argv, &opts);
     const char* authstring = get_authstring(argv[AUTH_POS]);
     const int maxConnex = atoi(argv[NUM_CONNEX_POS]);
 
@@ -120,19 +234,156 @@ int main(int argc, char* argv[]) {
 
     // Server opened
     fprintf(stderr, "%u\n", portNum);
-    process_connections(fdServer, maxConnex, authstring);
+    process_connections(fdServer, maxConnex, authstring, &opts);
 
     return 0;
 }
 
-void check_args(int argc, char* argv[]) {
-    bool isValidCommandline = is_valid_commandline(argc, argv);
+void check_args(int* argc, char* argv[], ServerOpts* opts) {
+    bool isValidCommandline = parse_options(argc, argv, opts) &&
+            is_valid_commandline(*argc, argv);
     if (!isValidCommandline) {
         fprintf(stderr, USAGE_MSG);
         exit(USAGE_EXIT_CODE);
     }
 }
 
+bool parse_options(int* argc, char* argv[], ServerOpts* opts) {
+    int numPositional = 0;
+    for (int i = 0; i < *argc; i++) {
+        if (strncmp(argv[i], OPT_PREFIX, strlen(OPT_PREFIX))) {
+            argv[numPositional++] = argv[i];
+            continue;
+        }
+
+        // Every option takes a value
+        if (i + 1 >= *argc) {
+            return false;
+        }
+        char* opt = argv[i];
+        char* value = argv[++i];
+
+        if (!strcmp(opt, SHARDS_OPT)) {
+            if (!parse_int_opt(value, 1, MAX_SHARDS, &opts->numShards)) {
+                return false;
+            }
+        } else if (!strcmp(opt, LOCK_OPT)) {
+            if (!parse_lock_mode(value, &opts->lockMode)) {
+                return false;
+            }
+        } else if (!strcmp(opt, LOG_OPT)) {
+            opts->logPath = value;
+        } else if (!strcmp(opt, COMPACT_OPT)) {
+            if (!parse_int_opt(value, 1, MAX_COMPACT_INTERVAL,
+                    &opts->compactInterval)) {
+                return false;
+            }
+        } else if (!strcmp(opt, SYNC_OPT)) {
+            if (!parse_sync_mode(value, &opts->groupCommit)) {
+                return false;
+            }
+        } else if (!strcmp(opt, SYNC_WINDOW_OPT)) {
+            if (!parse_int_opt(value, 0, MAX_SYNC_WINDOW, &opts->syncWindow)) {
+                return false;
+            }
+        } else if (!strcmp(opt, SYNC_BATCH_OPT)) {
+            if (!parse_int_opt(value, 1, MAX_SYNC_BATCH, &opts->syncBatch)) {
+                return false;
+            }
+        } else if (!strcmp(opt, INDEX_OPT)) {
+            if (strcmp(value, INDEX_NONE_NAME) &&
+                    strcmp(value, INDEX_ORDERED_NAME)) {
+                return false;
+            }
+            opts->orderedIndex = !strcmp(value, INDEX_ORDERED_NAME);
+        } else if (!strcmp(opt, MAX_MEMORY_OPT)) {
+            if (!parse_size_opt(value, &opts->maxMemory)) {
+                return false;
+            }
+        } else if (!strcmp(opt, SAVE_OPT)) {
+            opts->savePath = value;
+        } else if (!strcmp(opt, COMPRESS_OPT)) {
+            if (!parse_size_opt(value, &opts->compressMin)) {
+                return false;
+            }
+        } else if (!strcmp(opt, EVENT_LOOP_OPT)) {
+            if (!parse_int_opt(value, 1, MAX_LOOP_THREADS,
+                    &opts->loopThreads)) {
+                return false;
+            }
+        } else if (!strcmp(opt, WORKERS_OPT)) {
+            if (!parse_int_opt(value, 1, MAX_WORKERS, &opts->numWorkers)) {
+                return false;
+            }
+        } else if (!strcmp(opt, WORKER_QUEUE_OPT)) {
+            if (!parse_int_opt(value, 1, MAX_WORKER_QUEUE,
+                    &opts->workerQueue)) {
+                return false;
+            }
+        } else if (!strcmp(opt, ADMIT_WAIT_OPT)) {
+            if (!parse_int_opt(value, 1, MAX_ADMIT_WAIT, &opts->admitWait)) {
+                return false;
+            }
+        } else if (!strcmp(opt, ADMIT_QUEUE_OPT)) {
+            if (!parse_int_opt(value, 1, MAX_ADMIT_QUEUE,
+                    &opts->admitQueue)) {
+                return false;
+            }
+        } else {
+            return false;
+        }
+    }
+    // Connections are served either by the event loop or by the workers
+    if (opts->loopThreads && opts->numWorkers) {
+        return false;
+    }
+
+    *argc = numPositional;
+    argv[numPositional] = NULL;
+    return true;
+}
+
+bool parse_int_opt(char* arg, int min, int max, int* value) {
+    if (!is_int(arg)) {
+        return false;
+    }
+
+    errno = 0;
+    long num = strtol(arg, NULL, 10);
+    if (errno == ERANGE || num < min || num > max) {
+        return false;
+    }
+    *value = (int)num;
+    return true;
+}
+
+bool parse_size_opt(char* arg, size_t* value) {
+    if (!isdigit((unsigned char)arg[0])) {
+        return false;
+    }
+
+    errno = 0;
+    char* end;
+    unsigned long long num = strtoull(arg, &end, 10);
+    if (*end) {
+        const char* suffix = strchr(SIZE_SUFFIXES, toupper(*end));
+        if (!suffix || end[1]) {
+            return false;
+        }
+        for (const char* s = SIZE_SUFFIXES; s <= suffix; s++) {
+            if (num > SIZE_MAX / 1024) {
+                return false;
+            }
+            num *= 1024;
+        }
+    }
+    if (errno == ERANGE || num > SIZE_MAX) {
+        return false;
+    }
+    *value = (size_t)num;
+    return true;
+}
+
 bool is_valid_commandline(int argc, char* argv[]) {
     int invalidNumArgs = check_num_args(argc, MIN_ARGS, MAX_ARGS);
     if (invalidNumArgs) {
@@ -223,16 +474,73 @@ int open_listen(char* port, uint16_t* portNum) {
 }
 
 void process_connections(int fdServer, const int maxConnex,
-        const char* authstring) {
+        const char* authstring, const ServerOpts* opts) {
     Stats* stats = stats_init();
     setup_sig_handling(stats);
 
-    StringStore* publicDb = stringstore_init();
-    StringStore* privateDb = stringstore_init();
-    pthread_mutex_t* pubLock = malloc(sizeof(pthread_mutex_t));
-    pthread_mutex_t* privLock = malloc(sizeof(pthread_mutex_t));
-    pthread_mutex_init(pubLock, NULL);
-    pthread_mutex_init(privLock, NULL);
+    Database* publicDb = database_init(opts->numShards, opts->lockMode);
+    Database* privateDb = database_init(opts->numShards, opts->lockMode);
+    if (!publicDb || !privateDb) {
+        perror("Error creating databases");
+        exit(EXIT_FAILURE);
+    }
+    // Index before loading the log so loaded keys are indexed as they're added
+    if (opts->orderedIndex && (!database_enable_index(publicDb) ||
+            !database_enable_index(privateDb))) {
+        perror("Error indexing databases");
+        exit(EXIT_FAILURE);
+    }
+    // Only the public database can be filled by anyone, so only it is capped
+    database_set_max_bytes(publicDb, opts->maxMemory);
+    // Compress before loading the log too so loaded values are compressed
+    database_set_compression(publicDb, opts->compressMin);
+    database_set_compression(privateDb, opts->compressMin);
+    stats->publicDb = publicDb;
+    stats->privateDb = privateDb;
+    if (opts->logPath) {
+        stats->journal = open_journal(publicDb, privateDb, opts);
+    }
+    if (opts->savePath) {
+        Database* dbs[NUM_DBS];
+        dbs[PUBLIC_DB_ID] = publicDb;
+        dbs[PRIVATE_DB_ID] = privateDb;
+        stats->bgsave = bgsave_init(opts->savePath, dbs, NUM_DBS);
+        if (!stats->bgsave) {
+            perror("Error setting up background saves");
+            exit(EXIT_FAILURE);
+        }
+    }
+    database_start_expirer(publicDb);
+    database_start_expirer(privateDb);
+    if (opts->loopThreads) {
+        stats->loop = eventloop_init(opts->loopThreads,
+                handle_client_request, handle_client_close);
+        if (!stats->loop) {
+            perror("Error starting event loop");
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (opts->numWorkers) {
+        stats->workers = workerpool_init(opts->numWorkers, opts->workerQueue,
+                serve_client);
+        if (!stats->workers) {
+            perror("Error starting worker pool");
+            exit(EXIT_FAILURE);
+        }
+    }
+    // The arguments every connection is started with, apart from its socket
+    ClientArgs* serverArgs = malloc(sizeof(ClientArgs));
+    client_args_init(serverArgs, -1, authstring, publicDb, privateDb, stats);
+    stats->maxConnex = maxConnex;
+    if (opts->admitWait) {
+        stats->admission = admission_init(opts->admitQueue, opts->admitWait,
+                claim_connection, admit_connection, reject_connection,
+                serverArgs);
+        if (!stats->admission) {
+            perror("Error starting admission queue");
+            exit(EXIT_FAILURE);
+        }
+    }
 
     int fd;
     struct sockaddr_in fromAddr;
@@ -244,35 +552,104 @@ void process_connections(int fdServer, const int maxConnex,
         if (fd < 0) {
             perror("Error accepting connection");
         }
-        
+
+        // A slot freed while connections are waiting is theirs, so join the
+        // back of the queue rather than taking it
+        if (stats->admission && admission_num_waiting(stats->admission)) {
+            if (!admission_wait(stats->admission, fd)) {
+                reject_connection(fd, serverArgs);
+            }
+            continue;
+        }
         pthread_mutex_lock(stats->statsLock);
         stats->currConnected++;
 
-        if (stats->currConnected > maxConnex) {
+        if (stats->currConnected > maxConnex && stats->admission) {
+            // Wait for a slot instead of taking one
+            stats->currConnected--;
+            pthread_mutex_unlock(stats->statsLock);
+            if (!admission_wait(stats->admission, fd)) {
+                reject_connection(fd, serverArgs);
+            }
+        } else if (stats->currConnected > maxConnex) {
             disconnect_max_connex(fd, stats);
         } else {
             pthread_mutex_unlock(stats->statsLock);
+            admit_connection(fd, serverArgs);
+        }
+    }
+}
+
+bool claim_connection(void* arg) {
+    Stats* stats = ((ClientArgs*)arg)->stats;
+    pthread_mutex_lock(stats->statsLock);
+    bool claimed = stats->currConnected < stats->maxConnex;
+    if (claimed) {
+        stats->currConnected++;
+    }
+    pthread_mutex_unlock(stats->statsLock);
+    return claimed;
+}
 
-            ClientArgs* clientArgs = malloc(sizeof(ClientArgs));
-            client_args_init(clientArgs, fd, authstring,
-                    publicDb, privateDb, pubLock, privLock, stats);
+void admit_connection(int fd, void* arg) {
+    ClientArgs* clientArgs = malloc(sizeof(ClientArgs));
+    *clientArgs = *(ClientArgs*)arg;
+    clientArgs->fd = fd;
+    Stats* stats = clientArgs->stats;
 
-            pthread_t threadId;
-            pthread_create(&threadId, NULL, client_thread, clientArgs);
-            pthread_detach(threadId);
+    if (stats->loop) {
+        if (!eventloop_add(stats->loop, fd, clientArgs)) {
+            close(fd);
+            handle_client_close(clientArgs);
         }
+        return;
     }
+    if (stats->workers) {
+        // Waits for room in the queue, leaving new connections in the
+        // listen backlog until a worker frees up
+        workerpool_submit(stats->workers, clientArgs);
+        return;
+    }
+
+    pthread_t threadId;
+    pthread_create(&threadId, NULL, client_thread, clientArgs);
+    pthread_detach(threadId);
+}
+
+Journal* open_journal(Database* publicDb, Database* privateDb,
+        const ServerOpts* opts) {
+    Database** dbs = malloc(sizeof(Database*) * NUM_DBS);
+    dbs[PUBLIC_DB_ID] = publicDb;
+    dbs[PRIVATE_DB_ID] = privateDb;
+
+    Journal* journal = journal_open(opts->logPath, dbs, NUM_DBS);
+    if (!journal) {
+        fprintf(stderr, LOG_MSG);
+        exit(LOG_EXIT_CODE);
+    }
+    database_set_journal(publicDb, journal, PUBLIC_DB_ID);
+    database_set_journal(privateDb, journal, PRIVATE_DB_ID);
+    journal_start_compactor(journal, opts->compactInterval);
+    if (opts->groupCommit) {
+        journal_start_group_commit(journal, opts->syncWindow, opts->syncBatch);
+    }
+    return journal;
 }
 
 void disconnect_max_connex(int fd, Stats* stats) {
+    reject_connection(fd, NULL);
+    stats->currConnected--;
+    pthread_mutex_unlock(stats->statsLock);
+}
+
+void reject_connection(int fd, void* arg) {
     char* response = construct_HTTP_response(503,
             "Service Unavailable", NULL, NULL);
     FILE* to = fdopen(fd, "w");
     fprintf(to, response);
     fflush(to);
     fclose(to);
-    stats->currConnected--;
-    pthread_mutex_unlock(stats->statsLock);
+    free(response);
 }
 
 void* report_thread(void* arg) {
@@ -280,6 +657,7 @@ void* report_thread(void* arg) {
     sigset_t set;
     sigemptyset(&set);
     sigaddset(&set, SIGHUP);
+    sigaddset(&set, BGSAVE_SIGNAL);
     int s, sig;
 
     while (1) {
@@ -288,6 +666,14 @@ void* report_thread(void* arg) {
             errno = s;
             perror("sigwait");
         }
+        if (sig == BGSAVE_SIGNAL) {
+            if (!stats->bgsave) {
+                fprintf(stderr, BGSAVE_DISABLED_MSG);
+            } else if (bgsave_start(stats->bgsave) == BGSAVE_FAILED) {
+                perror("Error starting background save");
+            }
+            continue;
+        }
         pthread_mutex_lock(stats->statsLock);
         print_stats(stats);
         pthread_mutex_unlock(stats->statsLock);
@@ -295,65 +681,95 @@ void* report_thread(void* arg) {
 }
 
 void* client_thread(void* arg) {
-    ClientArgs clientArgs = *(ClientArgs*)arg;
-    free(arg);
+    serve_client(arg);
+    pthread_exit(NULL);
+}
 
-    int fd = clientArgs.fd;
-    int fd2 = dup(fd);
-    FILE* to = fdopen(fd, "w");
-    FILE* from = fdopen(fd2, "r");
-    Stats* stats = clientArgs.stats;
+void serve_client(void* arg) {
+    ClientArgs* clientArgs = (ClientArgs*)arg;
+    pipeline_serve(clientArgs->fd, handle_client_request, clientArgs);
+    close(clientArgs->fd);
+    handle_client_close(clientArgs);
+}
 
-    while (process_request(from, to, clientArgs)) {
-        // Continue processing
-    }
+bool handle_client_request(const HttpRequest* request, FILE* to,
+        void* arg) {
+    process_request(request, to, *(ClientArgs*)arg);
+    return true;
+}
 
+void handle_client_close(void* arg) {
+    ClientArgs* clientArgs = (ClientArgs*)arg;
+    client_disconnected(clientArgs->stats);
+    free(clientArgs);
+}
+
+void client_disconnected(Stats* stats) {
     pthread_mutex_lock(stats->statsLock);
     stats->currConnected--;
     stats->totalDisconnected++;
     pthread_mutex_unlock(stats->statsLock);
-
-    fclose(to);
-    fclose(from);
-
-    pthread_exit(NULL);
+    if (stats->admission) {
+        admission_slot_freed(stats->admission);
+    }
 }
 
-bool process_request(FILE* from, FILE* to, ClientArgs clientArgs) {
+void process_request(const HttpRequest* request, FILE* to,
+        ClientArgs clientArgs) {
     Stats* stats = clientArgs.stats;
-    char* method;
-    char* address;
-    HttpHeader** headers;
-    char* body;
-    if (!get_HTTP_request(from, &method, &address, &headers, &body)) {
-        // request could not be processed
-        return false;
+    const char* method = request->method.data;
+    char* address = request->address.data;
+
+    if (!strcmp(method, "GET") &&
+            !strncmp(address, SCAN_PREFIX, strlen(SCAN_PREFIX))) {
+        handle_scan_req(to, clientArgs, address, request);
+        return;
+    }
+    if (!strcmp(method, "POST") &&
+            !strncmp(address, BATCH_PREFIX, strlen(BATCH_PREFIX))) {
+        handle_batch_req(to, clientArgs, address, request);
+        return;
+    }
+    if (!strcmp(method, "POST") &&
+            !strncmp(address, INCR_PREFIX, strlen(INCR_PREFIX))) {
+        handle_incr_req(to, clientArgs, address, request);
+        return;
+    }
+    if (!strcmp(method, "POST") &&
+            !strncmp(address, APPEND_PREFIX, strlen(APPEND_PREFIX))) {
+        handle_append_req(to, clientArgs, address, request);
+        return;
+    }
+    if (!strcmp(method, "POST") && !strcmp(address, SNAPSHOT_ADDRESS)) {
+        handle_snapshot_open_req(to, request);
+        return;
+    }
+    if (!strcmp(method, "DELETE") &&
+            !strncmp(address, SNAPSHOT_PREFIX, strlen(SNAPSHOT_PREFIX))) {
+        handle_snapshot_close_req(to, address);
+        return;
+    }
+    if (!strcmp(method, "POST") && !strcmp(address, BGSAVE_ADDRESS)) {
+        handle_bgsave_req(to, clientArgs, request);
+        return;
     }
 
-    for (int methodNum = 0; methodNum < NUM_METHODS; methodNum++) {
+    const char* db = get_db_name(request->db);
+    for (int methodNum = 0; db && methodNum < NUM_METHODS; methodNum++) {
         if (!strcmp(method, methodNames[methodNum])) {
-            char** dbAndKey = get_db_key(address);
-            if (!dbAndKey) {
-                break;
-            }
-            char* key = dbAndKey[KEY_POS];
-            char* db = dbAndKey[DB_POS];
-
-            if (!is_authorised(headers, db, clientArgs.authstring)) {
+            if (!is_authorised(request, db, clientArgs.authstring)) {
                 unauthorised_connection(to, stats); 
-                return true;
+                return;
             }
 
             // Check which db is authorised
-            StringStore* authorisedDb = (!strcmp(db, DB_PUBLIC)) ? 
+            Database* authorisedDb = (!strcmp(db, DB_PUBLIC)) ? 
                     clientArgs.publicDb : clientArgs.privateDb;
-            pthread_mutex_t* dbLock = (!strcmp(db, DB_PUBLIC)) ?
-                    clientArgs.pubLock : clientArgs.privLock;
 
-            // Handler functions
-            methodHandlers[methodNum](to, authorisedDb, dbLock, stats,
-                    key, headers, body);
-            return true;
+            // The rest of the address isn't needed, so the key can end it
+            methodHandlers[methodNum](to, authorisedDb, stats,
+                    view_terminate(request->key), request);
+            return;
         }
     }
 
@@ -361,7 +777,6 @@ bool process_request(FILE* from, FILE* to, ClientArgs clientArgs) {
     char* response = construct_HTTP_response(400, "Bad Request", NULL, NULL);
     fprintf(to, response);
     fflush(to);
-    return true;
 }
 
 void unauthorised_connection(FILE* to, Stats* stats) {
@@ -375,80 +790,253 @@ void unauthorised_connection(FILE* to, Stats* stats) {
     fflush(to);
 }
 
-char** get_db_key(char* address) {
-    char** dbAndKey = split_by_char(address, '/', 0);
-    int numItems = 0;
-    while (dbAndKey[numItems]) {
-        numItems++;
+const char* get_db_name(StrView db) {
+    if (view_equals(db, DB_PUBLIC)) {
+        return DB_PUBLIC;
+    }
+    if (view_equals(db, DB_PRIVATE)) {
+        return DB_PRIVATE;
     }
+    return NULL;
+}
 
-    if (numItems < MIN_ADDR_FIELDS) {
-        return NULL;
+void handle_get_req(FILE* to, Database* db, Stats* stats, char* key,
+        const HttpRequest* request) {
+    const char* snapshot = http_get_header(request, SNAPSHOT_HEADER);
+    const char* acceptEncoding = http_get_header(request,
+            ACCEPT_ENCODING_HEADER);
+    bool sendEncoded = !snapshot && acceptEncoding &&
+            accepts_encoding(acceptEncoding, LZ4_ENCODING);
+    size_t plainLen = 0;
+    const char* val;
+    int found = get_value(db, key, snapshot, sendEncoded ? &plainLen : NULL,
+            &val);
+    if (found == -2) {
+        send_status(to, 400, "Bad Request");
+        return;
+    } else if (found == -1) {
+        send_status(to, 410, "Gone");
+        return;
+    } else if (!found) {
+        // Key not found
+        send_status(to, 404, "Not Found");
+        return;
     }
 
-    char* db = dbAndKey[DB_POS];
-    if (strcmp(db, DB_PUBLIC) && strcmp(db, DB_PRIVATE)) {
-        return NULL;
+    count_op(&stats->numGets);
+    if (snapshot) {
+        count_op(&stats->numSnapshotGets);
+    }
+    uint64_t version = stringstore_value_version(val);
+    char etag[ETAG_SIZE];
+    format_etag(etag, version);
+    HttpHeader etagHeader = {.name = ETAG_HEADER, .value = etag};
+    const char* ifNoneMatch = http_get_header(request, IF_NONE_MATCH_HEADER);
+    if (ifNoneMatch && etag_matches(ifNoneMatch, version)) {
+        // The client already has this version so don't send it again
+        count_op(&stats->numNotModified);
+        send_response(to, 304, "Not Modified", &etagHeader, NULL, 0);
+    } else if (plainLen) {
+        count_op(&stats->numEncodedGets);
+        char decodedLen[CONTENT_LENGTH_SIZE];
+        snprintf(decodedLen, sizeof(decodedLen), "%zu", plainLen);
+        HttpHeader encodingHeader = {.name = CONTENT_ENCODING_HEADER,
+                .value = LZ4_ENCODING};
+        HttpHeader decodedHeader = {.name = DECODED_LENGTH_HEADER,
+                .value = decodedLen};
+        HttpHeader* extraHeaders[] = {&etagHeader, &encodingHeader,
+                &decodedHeader, NULL};
+        send_response_headers(to, 200, "OK", extraHeaders, val,
+                stringstore_value_len(val));
+    } else {
+        send_response(to, 200, "OK", &etagHeader, val,
+                stringstore_value_len(val));
+    }
+    stringstore_release(val);
+}
+
+int get_value(Database* db, const char* key, const char* snapshot,
+        size_t* plainLen, const char** value) {
+    uint64_t view = 0;
+    if (snapshot && !parse_version(snapshot, &view)) {
+        return -2;
     }
 
-    return dbAndKey;
+    // Pin the value so a concurrent PUT or DELETE can't free it while the
+    // response is being sent
+    Shard* shard = database_get_shard(db, key);
+    if (!snapshot && shard->mode == LOCK_LOCKFREE) {
+        int found = stringstore_retrieve_unlocked(shard->store, key,
+                plainLen, value);
+        if (found >= 0) {
+            return found;
+        }
+    }
+    shard_read_lock(shard);
+    int found;
+    if (snapshot) {
+        found = stringstore_retrieve_at(shard->store, key, view, value);
+    } else if (plainLen) {
+        *value = stringstore_retrieve_encoded(shard->store, key, plainLen);
+        found = *value != NULL;
+    } else {
+        *value = stringstore_retrieve_ref(shard->store, key);
+        found = *value != NULL;
+    }
+    shard_unlock(shard);
+    return found;
 }
 
-void handle_get_req(FILE* to, StringStore* db, pthread_mutex_t* dbLock,
-        Stats* stats, char* key, HttpHeader** headers, char* body) {
-    pthread_mutex_lock(dbLock);
-    const char* val = stringstore_retrieve(db, key);
-    pthread_mutex_unlock(dbLock);
-    char* response;
+bool parse_version(const char* str, uint64_t* version) {
+    if (!isdigit((unsigned char)*str)) {
+        return false;
+    }
+    char* end;
+    errno = 0;
+    *version = strtoull(str, &end, 10);
+    return !*end && errno != ERANGE && *version;
+}
 
-    if (!val) {
-        // Key not found
-        response = construct_HTTP_response(404, "Not Found", NULL, NULL);
+void handle_snapshot_open_req(FILE* to, const HttpRequest* request) {
+    uint64_t expiresAt;
+    if (!get_expiry(request, &expiresAt)) {
+        send_status(to, 400, "Bad Request");
+        return;
+    }
+    if (!expiresAt) {
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        expiresAt = ((uint64_t)now.tv_sec + DEFAULT_SNAPSHOT_TTL) *
+                MSECS_PER_SEC + now.tv_nsec / NSECS_PER_MSEC;
+    }
+
+    uint64_t view = stringstore_view_open(expiresAt);
+    if (!view) {
+        send_status(to, 500, "Internal Server Error");
+        return;
+    }
+    char viewStr[VERSION_SIZE];
+    int len = snprintf(viewStr, sizeof(viewStr), "%" PRIu64, view);
+    HttpHeader viewHeader = {.name = SNAPSHOT_HEADER, .value = viewStr};
+    send_response(to, 200, "OK", &viewHeader, viewStr, len);
+}
+
+void handle_snapshot_close_req(FILE* to, char* address) {
+    uint64_t view;
+    if (!parse_version(address + strlen(SNAPSHOT_PREFIX), &view)) {
+        send_status(to, 400, "Bad Request");
+    } else if (stringstore_view_close(view)) {
+        send_status(to, 200, "OK");
     } else {
-        pthread_mutex_lock(stats->statsLock);
-        stats->numGets++;
-        pthread_mutex_unlock(stats->statsLock);
-        response = construct_HTTP_response(200, "OK", NULL, val);
+        send_status(to, 404, "Not Found");
     }
+}
 
-    fprintf(to, response);
-    fflush(to);
+bool preconditions_met(const HttpRequest* request, StringStore* store,
+        const char* key) {
+    const char* ifMatch = http_get_header(request, IF_MATCH_HEADER);
+    const char* ifNoneMatch = http_get_header(request, IF_NONE_MATCH_HEADER);
+    if (!ifMatch && !ifNoneMatch) {
+        return true;
+    }
+    uint64_t version = stringstore_get_version(store, key);
+    return (!ifMatch || etag_matches(ifMatch, version)) &&
+            (!ifNoneMatch || !etag_matches(ifNoneMatch, version));
 }
 
-void handle_put_req(FILE* to, StringStore* db, pthread_mutex_t* dbLock,
-        Stats* stats, char* key, HttpHeader** headers, char* body) {
-    char* response;
-    pthread_mutex_lock(dbLock);
-    int addSuccess = stringstore_add(db, key, body);
-    pthread_mutex_unlock(dbLock);
+void handle_put_req(FILE* to, Database* db, Stats* stats, char* key,
+        const HttpRequest* request) {
+    uint64_t expiresAt;
+    if (!get_expiry(request, &expiresAt)) {
+        send_status(to, 400, "Bad Request");
+        return;
+    }
 
+    // The body may contain '\0's so use its length from the request
+    const char* body = request->body.data;
+    size_t len = request->body.len;
+    Shard* shard = database_get_shard(db, key);
+    shard_write_lock(shard);
+    // The preconditions are checked under the same lock as the PUT so no
+    // other change can come between them
+    if (!preconditions_met(request, shard->store, key)) {
+        shard_unlock(shard);
+        count_op(&stats->numPreconditionFails);
+        send_status(to, 412, "Precondition Failed");
+        return;
+    }
+    // Reserve the expiry first so a PUT is never applied without its TTL
+    int addSuccess = !expiresAt || stringstore_reserve_expiry(shard->store);
     if (addSuccess) {
-        pthread_mutex_lock(stats->statsLock);
-        stats->numPuts++;
-        pthread_mutex_unlock(stats->statsLock);
+        addSuccess = stringstore_add_len(shard->store, key, body, len);
+    }
+    uint64_t ticket = 0;
+    if (addSuccess) {
+        ticket = database_log_put(db, key, body, len);
+    }
+    if (addSuccess && expiresAt) {
+        stringstore_set_expiry(shard->store, key, expiresAt);
+        ticket = database_log_expire(db, key, expiresAt);
+    }
+    uint64_t version = addSuccess ?
+            stringstore_get_version(shard->store, key) : 0;
+    shard_unlock(shard);
 
-        response = construct_HTTP_response(200, "OK", NULL, NULL);
+    // Don't acknowledge the PUT until it is durable
+    if (addSuccess) {
+        database_wait_logged(db, ticket);
+    }
+
+    if (addSuccess) {
+        count_op(&stats->numPuts);
+        char etag[ETAG_SIZE];
+        format_etag(etag, version);
+        HttpHeader etagHeader = {.name = ETAG_HEADER, .value = etag};
+        send_response(to, 200, "OK", &etagHeader, NULL, 0);
     } else {
-        response = construct_HTTP_response(500, "Internal Server Error",
-                NULL, NULL);
+        send_status(to, 500, "Internal Server Error");
     }
+}
 
-    fprintf(to, response);
-    fflush(to);
+bool get_expiry(const HttpRequest* request, uint64_t* expiresAt) {
+    *expiresAt = 0;
+    const char* ttlStr = http_get_header(request, EXPIRY_HEADER);
+    if (!ttlStr) {
+        return true;
+    }
+
+    int ttl;
+    if (!parse_int_opt((char*)ttlStr, 1, MAX_TTL, &ttl)) {
+        return false;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    *expiresAt = ((uint64_t)now.tv_sec + ttl) * MSECS_PER_SEC +
+            now.tv_nsec / NSECS_PER_MSEC;
+    return true;
 }
 
-void handle_delete_req(FILE* to, StringStore* db, pthread_mutex_t* dbLock,
-        Stats* stats, char* key, HttpHeader** headers, char* body) {
-    // Not found need to implement the stringstore library
+void handle_delete_req(FILE* to, Database* db, Stats* stats, char* key,
+        const HttpRequest* request) {
     char* response;
-    pthread_mutex_lock(dbLock);
-    int deleteSuccess = stringstore_delete(db, key);
-    pthread_mutex_unlock(dbLock);
+    Shard* shard = database_get_shard(db, key);
+    shard_write_lock(shard);
+    if (!preconditions_met(request, shard->store, key)) {
+        shard_unlock(shard);
+        count_op(&stats->numPreconditionFails);
+        send_status(to, 412, "Precondition Failed");
+        return;
+    }
+    int deleteSuccess = stringstore_delete(shard->store, key);
+    uint64_t ticket = 0;
+    if (deleteSuccess) {
+        ticket = database_log_delete(db, key);
+    }
+    shard_unlock(shard);
 
     if (deleteSuccess) {
-        pthread_mutex_lock(stats->statsLock);
-        stats->numDeletes++;
-        pthread_mutex_unlock(stats->statsLock);
+        database_wait_logged(db, ticket);
+        count_op(&stats->numDeletes);
 
         response = construct_HTTP_response(200, "OK", NULL, NULL);
     } else {
@@ -459,26 +1047,431 @@ void handle_delete_req(FILE* to, StringStore* db, pthread_mutex_t* dbLock,
     fflush(to);
 }
 
-bool is_authorised(HttpHeader** headers, char* db, const char* authstring) {
+void handle_scan_req(FILE* to, ClientArgs clientArgs, char* address,
+        const HttpRequest* request) {
+    char* query = split_query(address);
+    char* db = address + strlen(SCAN_PREFIX);
+    if (strcmp(db, DB_PUBLIC) && strcmp(db, DB_PRIVATE)) {
+        send_status(to, 400, "Bad Request");
+        return;
+    }
+    if (!is_authorised(request, db, clientArgs.authstring)) {
+        unauthorised_connection(to, clientArgs.stats);
+        return;
+    }
+
+    char* prefix;
+    char* cursor;
+    int limit;
+    if (!parse_scan_params(query, &prefix, &cursor, &limit)) {
+        send_status(to, 400, "Bad Request");
+        return;
+    }
+
+    Database* authorisedDb = (!strcmp(db, DB_PUBLIC)) ?
+            clientArgs.publicDb : clientArgs.privateDb;
+    char** keys = malloc(sizeof(char*) * limit);
+    const char** values = malloc(sizeof(char*) * limit);
+    int count = keys && values ? database_scan(authorisedDb, prefix, cursor,
+            limit, keys, values) : -2;
+
+    if (count == -1) {
+        // The server wasn't started with an ordered index
+        send_status(to, 501, "Not Implemented");
+    } else if (count < 0) {
+        send_status(to, 500, "Internal Server Error");
+    } else {
+        count_op(&clientArgs.stats->numScans);
+        send_scan_results(to, keys, values, count, limit);
+    }
+
+    free(keys);
+    free(values);
+    free(prefix);
+    free(cursor);
+}
+
+void handle_batch_req(FILE* to, ClientArgs clientArgs, char* address,
+        const HttpRequest* request) {
+    char* db = address + strlen(BATCH_PREFIX);
+    if (strcmp(db, DB_PUBLIC) && strcmp(db, DB_PRIVATE)) {
+        send_status(to, 400, "Bad Request");
+        return;
+    }
+    if (!is_authorised(request, db, clientArgs.authstring)) {
+        unauthorised_connection(to, clientArgs.stats);
+        return;
+    }
+
+    BatchOp* ops;
+    int numOps = parse_batch(request->body, &ops);
+    if (numOps == -1) {
+        send_status(to, 400, "Bad Request");
+        return;
+    }
+    if (numOps < 0) {
+        send_status(to, 500, "Internal Server Error");
+        return;
+    }
+
+    Database* authorisedDb = (!strcmp(db, DB_PUBLIC)) ?
+            clientArgs.publicDb : clientArgs.privateDb;
+    if (!database_apply_batch(authorisedDb, ops, numOps)) {
+        send_status(to, 500, "Internal Server Error");
+    } else {
+        count_op(&clientArgs.stats->numBatches);
+        send_batch_results(to, clientArgs.stats, ops, numOps);
+    }
+    free(ops);
+}
+
+Database* get_update_db(FILE* to, ClientArgs clientArgs, char* address,
+        const HttpRequest* request, char** key) {
+    StrView addressView = {.data = address, .len = strlen(address)};
+    StrView dbView, keyView;
+    const char* db = http_split_db_key(addressView, &dbView, &keyView) ?
+            get_db_name(dbView) : NULL;
+    if (!db) {
+        send_status(to, 400, "Bad Request");
+        return NULL;
+    }
+    if (!is_authorised(request, db, clientArgs.authstring)) {
+        unauthorised_connection(to, clientArgs.stats);
+        return NULL;
+    }
+    *key = view_terminate(keyView);
+    return (!strcmp(db, DB_PUBLIC)) ? clientArgs.publicDb :
+            clientArgs.privateDb;
+}
+
+void handle_incr_req(FILE* to, ClientArgs clientArgs, char* address,
+        const HttpRequest* request) {
+    // Keep the '/' before the database so the address splits like a GET's
+    char* key;
+    Database* db = get_update_db(to, clientArgs,
+            address + strlen(INCR_PREFIX) - 1, request, &key);
+    if (!db) {
+        return;
+    }
+    int64_t delta;
+    if (!parse_delta(request->body.data, request->body.len, &delta)) {
+        send_status(to, 400, "Bad Request");
+        return;
+    }
+
+    int64_t result;
+    Shard* shard = database_get_shard(db, key);
+    shard_write_lock(shard);
+    int status = stringstore_increment(shard->store, key, delta, &result);
+    uint64_t ticket = 0;
+    if (status > 0) {
+        ticket = database_log_value(db, shard->store, key);
+    }
+    shard_unlock(shard);
+
+    if (status < 0) {
+        send_status(to, 409, "Conflict");
+    } else if (!status) {
+        send_status(to, 500, "Internal Server Error");
+    } else {
+        database_wait_logged(db, ticket);
+        count_op(&clientArgs.stats->numIncrements);
+        char number[INTEGER_SIZE];
+        int len = snprintf(number, sizeof(number), "%" PRId64, result);
+        send_response(to, 200, "OK", NULL, number, len);
+    }
+}
+
+bool parse_delta(const char* body, size_t len, int64_t* delta) {
+    *delta = DEFAULT_DELTA;
+    if (!len) {
+        return true;
+    }
+    if (len >= INTEGER_SIZE || !body) {
+        return false;
+    }
+    // strtoll() would skip leading spaces and stop at a '\0'
+    char number[INTEGER_SIZE];
+    memcpy(number, body, len);
+    number[len] = '\0';
+    if (!isdigit(number[0]) && number[0] != '-') {
+        return false;
+    }
+    char* end;
+    errno = 0;
+    *delta = strtoll(number, &end, 10);
+    return end != number && !*end && errno != ERANGE;
+}
+
+void handle_append_req(FILE* to, ClientArgs clientArgs, char* address,
+        const HttpRequest* request) {
+    char* key;
+    Database* db = get_update_db(to, clientArgs,
+            address + strlen(APPEND_PREFIX) - 1, request, &key);
+    if (!db) {
+        return;
+    }
+
+    const char* body = request->body.data;
+    size_t len = request->body.len;
+    size_t newLen;
+    Shard* shard = database_get_shard(db, key);
+    shard_write_lock(shard);
+    int appendSuccess = stringstore_append(shard->store, key,
+            body, len, &newLen);
+    uint64_t ticket = 0;
+    if (appendSuccess) {
+        ticket = database_log_value(db, shard->store, key);
+    }
+    shard_unlock(shard);
+
+    if (!appendSuccess) {
+        send_status(to, 500, "Internal Server Error");
+    } else {
+        database_wait_logged(db, ticket);
+        count_op(&clientArgs.stats->numAppends);
+        char number[INTEGER_SIZE];
+        int numLen = snprintf(number, sizeof(number), "%zu", newLen);
+        send_response(to, 200, "OK", NULL, number, numLen);
+    }
+}
+
+void handle_bgsave_req(FILE* to, ClientArgs clientArgs,
+        const HttpRequest* request) {
+    if (!is_authorised(request, DB_PRIVATE, clientArgs.authstring)) {
+        unauthorised_connection(to, clientArgs.stats);
+        return;
+    }
+    BgSave* bgsave = clientArgs.stats->bgsave;
+    if (!bgsave) {
+        send_status(to, 400, "Bad Request");
+        return;
+    }
+
+    BgSaveResult result = bgsave_start(bgsave);
+    if (result == BGSAVE_STARTED) {
+        send_status(to, 202, "Accepted");
+    } else if (result == BGSAVE_IN_PROGRESS) {
+        send_status(to, 409, "Conflict");
+    } else {
+        send_status(to, 500, "Internal Server Error");
+    }
+}
+
+int parse_batch(StrView body, BatchOp** ops) {
+    int capacity = INIT_BATCH_OPS;
+    int numOps = 0;
+    *ops = malloc(sizeof(BatchOp) * capacity);
+    if (!*ops) {
+        return -2;
+    }
+
+    char* end = body.data + body.len;
+    char* next;
+    for (char* line = body.data; line < end; line = next) {
+        char* newline = memchr(line, '\n', end - line);
+        size_t lineLen = (newline ? newline : end) - line;
+        next = line + lineLen + 1;
+        char* cr = memchr(line, '\r', lineLen);
+        if (cr) {
+            lineLen = cr - line;
+        }
+        // A '\0' would cut the line short, so it has to be encoded
+        if (memchr(line, '\0', lineLen)) {
+            free(*ops);
+            return -1;
+        }
+        if (!lineLen) {
+            continue;
+        }
+        line[lineLen] = '\0';
+        if (numOps == MAX_BATCH_OPS) {
+            free(*ops);
+            return -1;
+        }
+        if (numOps == capacity) {
+            BatchOp* grown = realloc(*ops, sizeof(BatchOp) * capacity * 2);
+            if (!grown) {
+                free(*ops);
+                return -2;
+            }
+            *ops = grown;
+            capacity *= 2;
+        }
+        if (!parse_batch_op(line, &(*ops)[numOps++])) {
+            free(*ops);
+            return -1;
+        }
+    }
+    return numOps;
+}
+
+bool parse_batch_op(char* line, BatchOp* op) {
+    char* key = strchr(line, ' ');
+    if (!key) {
+        return false;
+    }
+    *key++ = '\0';
+    char* value = strchr(key, ' ');
+    if (value) {
+        *value++ = '\0';
+    }
+
+    if (!strcmp(line, "PUT") && value) {
+        op->type = BATCH_PUT;
+    } else if (!strcmp(line, "GET") && !value) {
+        op->type = BATCH_GET;
+    } else if (!strcmp(line, "DELETE") && !value) {
+        op->type = BATCH_DELETE;
+    } else {
+        return false;
+    }
+
+    if (!*key || !url_decode(key, NULL) ||
+            (value && !url_decode(value, &op->valueLen))) {
+        return false;
+    }
+    op->key = key;
+    op->value = value;
+    op->success = false;
+    return true;
+}
+
+void send_batch_results(FILE* to, Stats* stats, BatchOp* ops, int numOps) {
+    char* body;
+    size_t bodyLen;
+    FILE* bodyStream = open_memstream(&body, &bodyLen);
+    for (int i = 0; i < numOps; i++) {
+        BatchOp* op = &ops[i];
+        if (op->type == BATCH_GET && op->success) {
+            count_op(&stats->numGets);
+            char* encodedVal = url_encode(op->value, op->valueLen);
+            fprintf(bodyStream, "200 %s\n", encodedVal);
+            free(encodedVal);
+            stringstore_release(op->value);
+        } else if (op->success) {
+            count_op(op->type == BATCH_PUT ? &stats->numPuts :
+                    &stats->numDeletes);
+            fputs("200\n", bodyStream);
+        } else {
+            fputs(op->type == BATCH_PUT ? "500\n" : "404\n", bodyStream);
+        }
+    }
+    fclose(bodyStream);
+
+    send_response(to, 200, "OK", NULL, body, bodyLen);
+    free(body);
+}
+
+bool parse_scan_params(const char* query, char** prefix, char** cursor,
+        int* limit) {
+    *limit = DEFAULT_SCAN_LIMIT;
+    char* limitStr = get_query_param(query, "limit");
+    if (limitStr) {
+        bool validLimit = parse_int_opt(limitStr, 1, MAX_SCAN_LIMIT, limit);
+        free(limitStr);
+        if (!validLimit) {
+            return false;
+        }
+    }
+
+    *prefix = get_query_param(query, "prefix");
+    if (!*prefix) {
+        *prefix = strdup("");
+    }
+    *cursor = get_query_param(query, "cursor");
+    return true;
+}
+
+void send_scan_results(FILE* to, char** keys, const char** values, int count,
+        int limit) {
+    char* body;
+    size_t bodyLen;
+    FILE* bodyStream = open_memstream(&body, &bodyLen);
+    for (int i = 0; i < count; i++) {
+        char* encodedKey = url_encode(keys[i], strlen(keys[i]));
+        char* encodedVal = url_encode(values[i],
+                stringstore_value_len(values[i]));
+        fprintf(bodyStream, "%s %s\n", encodedKey, encodedVal);
+        free(encodedKey);
+        free(encodedVal);
+    }
+    fclose(bodyStream);
+
+    // Only a full page can have more results after it
+    HttpHeader cursorHeader = {.name = NEXT_CURSOR_HEADER, .value = NULL};
+    if (count == limit) {
+        cursorHeader.value = url_encode(keys[count - 1],
+                strlen(keys[count - 1]));
+    }
+    send_response(to, 200, "OK", cursorHeader.value ? &cursorHeader : NULL,
+            body, bodyLen);
+
+    for (int i = 0; i < count; i++) {
+        free(keys[i]);
+        stringstore_release(values[i]);
+    }
+    free(cursorHeader.value);
+    free(body);
+}
+
+void send_response(FILE* to, int status, const char* statusExplanation,
+        HttpHeader* header, const char* body, size_t bodyLen) {
+    HttpHeader* extraHeaders[] = {header, NULL};
+    send_response_headers(to, status, statusExplanation, extraHeaders, body,
+            bodyLen);
+}
+
+void send_response_headers(FILE* to, int status,
+        const char* statusExplanation, HttpHeader** extraHeaders,
+        const char* body, size_t bodyLen) {
+    int numExtra = 0;
+    while (extraHeaders[numExtra]) {
+        numExtra++;
+    }
+    char lenStr[CONTENT_LENGTH_SIZE];
+    snprintf(lenStr, sizeof(lenStr), "%zu", bodyLen);
+    HttpHeader lenHeader = {.name = "Content-Length", .value = lenStr};
+    HttpHeader* headers[numExtra + 2];
+    headers[0] = &lenHeader;
+    memcpy(headers + 1, extraHeaders, sizeof(HttpHeader*) * (numExtra + 1));
+
+    // construct_HTTP_response() finds the length of the body with strlen()
+    // so the body is written separately
+    char* response = construct_HTTP_response(status, statusExplanation,
+            headers, NULL);
+    fputs(response, to);
+    fwrite(body, 1, bodyLen, to);
+    fflush(to);
+    free(response);
+}
+
+void send_status(FILE* to, int status, const char* statusExplanation) {
+    char* response = construct_HTTP_response(status, statusExplanation,
+            NULL, NULL);
+    fputs(response, to);
+    fflush(to);
+    free(response);
+}
+
+bool is_authorised(const HttpRequest* request, const char* db,
+        const char* authstring) {
     // User are always allowed public access
     if (!strcmp(db, DB_PUBLIC)) {
         return true;
     }
 
-    int headerNum = 0;
-    while (headers[headerNum]) {
+    for (int headerNum = 0; headerNum < request->numHeaders; headerNum++) {
         // Find the Authorization header
-        if (!strcmp(((*headers[headerNum]).name), "Authorization")) {
+        const HeaderView* header = &request->headers[headerNum];
+        if (view_equals(header->name, "Authorization")) {
             // Check if the user is authorised
-            char* userstring = (*headers[headerNum]).value;
-            if (!strcmp(userstring, authstring)) {
+            if (view_equals(header->value, authstring)) {
                 return true;
             } else { // Do not allow multiple authorisation attempts
                 break;
             }
         }
-
-        headerNum++;
     }
     return false;
 }
@@ -16,26 +16,99 @@
 #define PORT_POS 3
 #define MIN_ARGS 3
 #define MAX_ARGS 4
+#define OPT_PREFIX "--"
+#define SHARDS_OPT "--shards"
+#define LOCK_OPT "--lock"
+#define LOG_OPT "--log"
+#define COMPACT_OPT "--compact"
+#define SYNC_OPT "--sync"
+#define SYNC_WINDOW_OPT "--sync-window"
+#define SYNC_BATCH_OPT "--sync-batch"
+#define INDEX_OPT "--index"
+#define INDEX_NONE_NAME "none"
+#define INDEX_ORDERED_NAME "ordered"
+#define MAX_MEMORY_OPT "--max-memory"
+#define SIZE_SUFFIXES "KMG"     // Multiply by 1024 for each suffix position
+#define SAVE_OPT "--save"
+#define COMPRESS_OPT "--compress"
+#define DEFAULT_COMPRESS_MIN 1024   // Shortest value compressed by default
+#define EVENT_LOOP_OPT "--event-loop"
+#define MAX_LOOP_THREADS 256
+#define WORKERS_OPT "--workers"
+#define MAX_WORKERS 4096
+#define WORKER_QUEUE_OPT "--worker-queue"
+#define DEFAULT_WORKER_QUEUE 128    // Connections waiting for a worker
+#define MAX_WORKER_QUEUE 65536
+#define ADMIT_WAIT_OPT "--admit-wait"
+#define MAX_ADMIT_WAIT 600000       // Milliseconds
+#define ADMIT_QUEUE_OPT "--admit-queue"
+#define DEFAULT_ADMIT_QUEUE 64      // Connections waiting for a slot
+#define MAX_ADMIT_QUEUE 65536
 #define MIN_PORT 1024
 #define MAX_PORT 65535
-#define USAGE_MSG "Usage: dbserver authfile connections [portnum]\n"
+#define USAGE_MSG "Usage: dbserver authfile connections [portnum] " \
+        "[--shards n] [--lock mutex|rwlock|lockfree] [--log file] " \
+        "[--compact secs] [--sync async|group] [--sync-window usecs] " \
+        "[--sync-batch n] [--index none|ordered] " \
+        "[--max-memory bytes[K|M|G]] [--save file] " \
+        "[--compress bytes[K|M|G]] [--event-loop threads] " \
+        "[--workers n] [--worker-queue n] [--admit-wait msecs] " \
+        "[--admit-queue n]\n"
 #define USAGE_EXIT_CODE 1
 #define AUTH_MSG "dbserver: unable to read authentication string\n"
 #define AUTH_EXIT_CODE 2
 #define PORT_MSG "dbserver: unable to open socket for listening\n"
 #define PORT_EXIT_CODE 3
+#define LOG_MSG "dbserver: unable to load log file\n"
+#define LOG_EXIT_CODE 4
 #define DEFAULT_PORT "0"    // Use the ephemeral port by default
 #define MAX_CONNEX_Q 10
 #define NUM_METHODS 3
 #define DB_PUBLIC "public"
 #define DB_PRIVATE "private"
+#define PUBLIC_DB_ID 0      // Positions of the databases in the journal
+#define PRIVATE_DB_ID 1
+#define NUM_DBS 2
 #define DB_POS 1
 #define KEY_POS 2
 #define MIN_ADDR_FIELDS 3
+#define SCAN_PREFIX "/scan/"   // Address of a scan is /scan/db?params
+#define DEFAULT_SCAN_LIMIT 100
+#define MAX_SCAN_LIMIT 1000
+#define NEXT_CURSOR_HEADER "X-Next-Cursor"
+#define BATCH_PREFIX "/batch/" // Address of a batch is /batch/db
+#define MAX_BATCH_OPS 100000
+#define INIT_BATCH_OPS 64
+#define CONTENT_LENGTH_SIZE 21  // Fits any size_t in decimal
+#define ETAG_HEADER "ETag"
+#define IF_MATCH_HEADER "If-Match"
+#define IF_NONE_MATCH_HEADER "If-None-Match"
+#define EXPIRY_HEADER "X-Expire-After"  // Seconds until a PUT key expires
+#define MAX_TTL 315360000               // 10 years
+#define MSECS_PER_SEC 1000
+#define NSECS_PER_MSEC 1000000
+#define INCR_PREFIX "/incr/"     // Address of an increment is /incr/db/key
+#define APPEND_PREFIX "/append/" // Address of an append is /append/db/key
+#define DEFAULT_DELTA 1
+#define INTEGER_SIZE 21         // Fits any int64_t in decimal
+#define SNAPSHOT_ADDRESS "/snapshot"    // POST here to open a read snapshot
+#define SNAPSHOT_PREFIX "/snapshot/"    // DELETE /snapshot/id to close it
+#define SNAPSHOT_HEADER "X-Snapshot"    // Pins a GET to a read snapshot
+#define DEFAULT_SNAPSHOT_TTL 60         // Seconds until a snapshot closes
+#define VERSION_SIZE 21                 // Fits any uint64_t in decimal
+#define BGSAVE_ADDRESS "/admin/bgsave"  // POST here to save in the background
+#define BGSAVE_SIGNAL SIGUSR1           // Or send the server this signal
+#define BGSAVE_DISABLED_MSG "dbserver: background saving needs --save\n"
+#define ACCEPT_ENCODING_HEADER "Accept-Encoding"
+#define CONTENT_ENCODING_HEADER "Content-Encoding"
+#define DECODED_LENGTH_HEADER "X-Decoded-Length" // Length of a decoded value
+#define LZ4_ENCODING "lz4-block"    // A value compressed as an LZ4 block
 
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+#include <ctype.h>
+#include <inttypes.h>
 #include <sys/socket.h>
 #include <netdb.h>
 #include <pthread.h>
@@ -44,6 +117,16 @@
 #include <csse2310a4.h>
 #include <stringstore.h>
 #include <signal.h>
+#include <time.h>
+#include "database.h"
+#include "journal.h"
+#include "bgsave.h"
+#include "eventloop.h"
+#include "pipeline.h"
+#include "httpParser.h"
+#include "workerpool.h"
+#include "admission.h"
+#include "httpUtils.h"
 #include "readCommline.h"
 #include "utilities.h"
 
@@ -53,9 +136,12 @@ typedef struct Stats Stats;
 /* A struct to store the arguments to pass to the client thread.*/
 typedef struct ClientArgs ClientArgs;
 
+/* A struct to store the optional settings given on the commandline.*/
+typedef struct ServerOpts ServerOpts;
+
 /* Functions used to send a HTTP response */
-typedef void (*HandleHttpReq)(FILE*, StringStore*, pthread_mutex_t* dbLock,
-        Stats* stats, char*, HttpHeader**, char*);
+typedef void (*HandleHttpReq)(FILE*, Database*, Stats* stats, char*,
+        const HttpRequest*);
 
 /* Initialise the ClientArgs struct.
  *
@@ -63,25 +149,63 @@ typedef void (*HandleHttpReq)(FILE*, StringStore*, pthread_mutex_t* dbLock,
  *      clientArgs: A pointer to a clientArgs struct to be initialised.
  *      fd: The file dscriptor used to communicate with the client.
  *      authstring: The authorisation string needed to access the privatedDb.
- *      publicDb: A pointer to the public StringStore instance.
- *      privateDb: A pointer to the private StringStore instance.
- *      pubLock: A pointer to the mutex for the publicDb.
- *      privLock: A pointer to the mutex for the privDb.
+ *      publicDb: A pointer to the public database.
+ *      privateDb: A pointer to the private database.
  *      stats: A pointer to a Stats struct used to record server usage info.
  */
 void client_args_init(ClientArgs* clientArgs, int fd, const char* authstring,
-        StringStore* publicDb, StringStore* privateDb,
-        pthread_mutex_t* pubLock, pthread_mutex_t* privLock, Stats* stats);
+        Database* publicDb, Database* privateDb, Stats* stats);
 
 /* Perform checks on the commandline arguments and check if they are valid.
  * If not valid, print an error message and exit the program with the
- * appropriate status code.
+ * appropriate status code. Any options are removed from argv so that only
+ * the positional arguments remain.
  *
  * Params:
- *      argc: the number of arguments passed to the program.
+ *      argc: A pointer to the number of arguments passed to the program.
  *      argv: The arguments passed to the program.
+ *      opts: The ServerOpts struct to save any options to.
+ */
+void check_args(int* argc, char* argv[], ServerOpts* opts);
+
+/* Removes any "--option value" pairs from the commandline arguments and
+ * records them in opts. Options that are not given keep their default value.
+ *
+ * Params:
+ *      argc: A pointer to the number of commandline arguments. This is
+ *      updated to the number of positional arguments left in argv.
+ *      argv: An array of the commandline arguments.
+ *      opts: The ServerOpts struct to save the options to.
+ *
+ * Return:
+ *      true if every option was recognised and had a valid value.
  */
-void check_args(int argc, char* argv[]);
+bool parse_options(int* argc, char* argv[], ServerOpts* opts);
+
+/* Parses the value of an integer option and checks it is within range.
+ *
+ * Params:
+ *      arg: The value given for the option.
+ *      min: The minimum valid value.
+ *      max: The maximum valid value.
+ *      value: Where the parsed value is saved to.
+ *
+ * Return:
+ *      true if the value is an integer in the range [min, max].
+ */
+bool parse_int_opt(char* arg, int min, int max, int* value);
+
+/* Parses the value of a size option, which is a number of bytes optionally
+ * followed by K, M or G.
+ *
+ * Params:
+ *      arg: The value given for the option.
+ *      value: Where the number of bytes is saved to.
+ *
+ * Return:
+ *      true if the value is a valid size.
+ */
+bool parse_size_opt(char* arg, size_t* value);
 
 /* Checks that the command line arguments are valid (correct number of
  * connections, valid port number, valid number of connections).
@@ -121,8 +245,11 @@ int open_listen(char* port, uint16_t* portNum);
 
 /* Process connection requests. Once a connection request is received, a new
  * thread will be created to handle requests from the client so that the server
- * can continue to listen for connections. Public and private databases are
- * initialised here and may be updated via requests from clients.
+ * can continue to listen for connections, or with --event-loop the connection
+ * is handed to one of a fixed number of event loop threads instead. Public and
+ * private databases are initialised here and may be updated via requests from
+ * clients. With --admit-wait a connection over the limit waits for a slot
+ * rather than being sent a 503 at once.
  *
  * Params:
  *      fdServer: The file descriptor for the server to listen on.
@@ -130,9 +257,25 @@ int open_listen(char* port, uint16_t* portNum);
  *      by the server.
  *      authstring: The authorisation string required to access the private
  *      database.
+ *      opts: The optional settings given on the commandline.
  */
 void process_connections(int fdServer, const int maxConnex,
-        const char* authstring);
+        const char* authstring, const ServerOpts* opts);
+
+/* Loads the databases from the log file and records all future changes to
+ * them in it. Exits appropriately if the log can't be loaded.
+ *
+ * Params:
+ *      publicDb: The public database.
+ *      privateDb: The private database.
+ *      opts: The optional settings given on the commandline, including the
+ *      path of the log file.
+ *
+ * Return:
+ *      The opened journal.
+ */
+Journal* open_journal(Database* publicDb, Database* privateDb,
+        const ServerOpts* opts);
 
 /* Disconnects the client and responds with 503 (Service Unavailable). This
  * is to be used if the max connections is reached.
@@ -143,20 +286,48 @@ void process_connections(int fdServer, const int maxConnex,
  */
 void disconnect_max_connex(int fd, Stats* stats);
 
+/* Claims a connection slot for a waiting connection if fewer than the
+ * maximum number of clients are connected. This is the admission queue's
+ * ClaimHandler.
+ *
+ * Params:
+ *      arg: A pointer to the ClientArgs every connection is started with.
+ *
+ * Return:
+ *      true if a slot was claimed.
+ */
+bool claim_connection(void* arg);
+
+/* Starts serving a connection that has been given a slot, on its own
+ * thread, the event loop or the worker pool.
+ *
+ * Params:
+ *      fd: The file descriptor used to communicate with the client.
+ *      arg: A pointer to the ClientArgs every connection is started with,
+ *      which is copied for the connection.
+ */
+void admit_connection(int fd, void* arg);
+
+/* Responds with 503 (Service Unavailable) and closes the connection, without
+ * touching the connection count.
+ *
+ * Params:
+ *      fd: The file descriptor used to communicate with the client.
+ *      arg: Unused, so this can be the admission queue's reject handler.
+ */
+void reject_connection(int fd, void* arg);
+
 /* Process a HTTP request by taking any necessary actions and sending the
  * appropriate response.
  *
  * Params:
- *      from: The file pointer used to receive a request from the client.
+ *      request: The request, parsed in place in the connection's buffer.
  *      to: The file pointer used to send information back to the client.
  *      clientArgs: A clientArgs struct that contains the necessary parameters
  *      for the client_thread.
- *
- * Return:
- *      true if the request could be processed and a response was made or false
- *      if a badly formed request was received.
  */
-bool process_request(FILE* from, FILE* to, ClientArgs clientArgs); 
+void process_request(const HttpRequest* request, FILE* to,
+        ClientArgs clientArgs);
 
 /* A thread used to handle client requests. If a badly formed request is
  * received, the thread will exit. Otherwise, the thread will respond to the
@@ -168,74 +339,411 @@ bool process_request(FILE* from, FILE* to, ClientArgs clientArgs);
  */
 void* client_thread(void* arg);
 
-/* Extracts the database and key from the address string. If either are illegal
- * then the function returns a NULL pointer.
+/* Serves a client's requests until it disconnects or sends a badly formed
+ * request, then closes the connection. Pipelined requests are handled in
+ * batches, with their responses sent together. This is the body of
+ * client_thread, and the WorkHandler of the worker pool.
  *
  * Params:
- *      address: The address string in the format /db/key
+ *      arg: A pointer to the ClientArgs of the connection, which is freed.
+ */
+void serve_client(void* arg);
+
+/* Handles a single request parsed from a client's buffered input. This is
+ * the RequestHandler of both the event loop and serve_client.
+ *
+ * Params:
+ *      request: The request.
+ *      to: The file pointer to write the response to.
+ *      arg: A pointer to the ClientArgs of the connection.
+ *
+ * Return:
+ *      true, as the connection is kept open after any parsed request.
+ */
+bool handle_client_request(const HttpRequest* request, FILE* to,
+        void* arg);
+
+/* Records that a client's connection has been closed. This is the event
+ * loop's CloseHandler.
+ *
+ * Params:
+ *      arg: A pointer to the ClientArgs of the connection, which is freed.
+ */
+void handle_client_close(void* arg);
+
+/* Records that a client has disconnected.
+ *
+ * Params:
+ *      stats: A pointer to the Stats struct to report server usage stats to.
+ */
+void client_disconnected(Stats* stats);
+
+/* Gets the name of the database a request's address refers to.
+ *
+ * Params:
+ *      db: The database slice of the address (which may be missing).
  *
  * Return:
- *      An array containing the db in the first position and the key in the
- *      second or NULL if the key or database was illegal.
+ *      DB_PUBLIC or DB_PRIVATE, or NULL if the database isn't one of them.
  */
-char** get_db_key(char* address);
+const char* get_db_name(StrView db);
 
 /* Handles a GET request from the client by sending the appropriate response.
+ * The version of the value is sent as its ETag. If the request has an
+ * If-None-Match header that matches it, the response is 304 Not Modified and
+ * the value isn't sent again. If the request has an X-Snapshot header, the
+ * value the key had at that read snapshot is sent instead of the current
+ * one, or 410 Gone if the snapshot has closed. A value that is stored
+ * compressed is sent as it is stored, with a Content-Encoding of lz4-block
+ * and its decoded length in an X-Decoded-Length header, if the request's
+ * Accept-Encoding header accepts lz4-block (snapshot GETs are always
+ * decompressed).
  *
  * Params:
  *      to: The file descriptor to send the response to.
  *      db: The database to GET from.
- *      dbLock: A mutex used when accessing the db.
  *      stats: A pointer to a Stats struct that contains server usage info.
  *      key: The key for the value to GET.
- *      headers: The headers from the HTTP request.
- *      body: The body of the HTTP request (not used)
+ *      request: The HTTP request.
  */
-void handle_get_req(FILE* to, StringStore* db, pthread_mutex_t* dbLock,
-        Stats* stats, char* key, HttpHeader** headers, char* body);
+void handle_get_req(FILE* to, Database* db, Stats* stats, char* key,
+        const HttpRequest* request);
 
 /* Handles a PUT request from the client by sending the appropriate response.
+ * If the request has an X-Expire-After header, the key expires after that
+ * many seconds. The response is 412 Precondition Failed if the request has
+ * If-Match or If-None-Match headers that don't hold, and otherwise includes
+ * the new ETag of the key.
  *
  * Params:
  *      to: The file descriptor to send the response to.
  *      db: The database to PUT the key value pair in.
- *      dbLock: A mutex used when accessing the db.
  *      stats: A pointer to a Stats struct that contains server usage info.
  *      key: The key for the value to PUT.
- *      headers: The headers from the HTTP request.
- *      body: The body of the HTTP request which should just contain the value
+ *      request: The HTTP request, whose body should just contain the value
  *      to PUT.
  */
-void handle_put_req(FILE* to, StringStore* db, pthread_mutex_t* dbLock,
-        Stats* stats, char* key, HttpHeader** headers, char* body);
+void handle_put_req(FILE* to, Database* db, Stats* stats, char* key,
+        const HttpRequest* request);
+
+/* Gets the time a key being PUT should expire from the X-Expire-After
+ * header, which gives the number of seconds the key should last for.
+ *
+ * Params:
+ *      request: The HTTP request.
+ *      expiresAt: Where the expiry time is saved, in milliseconds since the
+ *      Unix epoch (0 if the request has no X-Expire-After header).
+ *
+ * Return:
+ *      true unless the header was given but isn't valid.
+ */
+bool get_expiry(const HttpRequest* request, uint64_t* expiresAt);
 
-/* Handles a DELETE request from the client by sending the appropriate response
+/* Checks the If-Match and If-None-Match headers of a request against the
+ * current version of a key. If-Match holds if it matches the key's ETag (or
+ * is "*" and the key exists) and If-None-Match holds if it doesn't. The
+ * key's shard must be locked for writing so the key can't change before the
+ * request is applied.
+ *
+ * Params:
+ *      request: The HTTP request.
+ *      store: The store the key is in.
+ *      key: The key the request changes.
+ *
+ * Return:
+ *      true if every precondition holds (or there are none).
+ */
+bool preconditions_met(const HttpRequest* request, StringStore* store,
+        const char* key);
+
+/* Handles a DELETE request from the client by sending the appropriate response.
+ * The response is 412 Precondition Failed if the request has If-Match or
+ * If-None-Match headers that don't hold.
  *
  * Params:
  *      to: The file descriptor to send the response to.
  *      db: The database to PUT the key value pair in.
- *      dbLock: A mutex used when accessing the db.
  *      stats: A pointer to a Stats struct that contains server usage info.
  *      key: The key for the value to DELETE.
- *      headers: The headers from the HTTP request.
- *      body: The body of the HTTP request (not used).
+ *      request: The HTTP request.
+ */
+void handle_delete_req(FILE* to, Database* db, Stats* stats, char* key,
+        const HttpRequest* request);
+
+/* Handles a scan request (GET /scan/db?prefix=p&limit=n&cursor=c) by sending
+ * a page of the key/value pairs whose keys start with the prefix, in order.
+ * Each pair is sent on its own line as the URL encoded key and value
+ * separated by a space. If the page is full, the X-Next-Cursor header holds
+ * the cursor to pass in the next request to continue the scan.
+ *
+ * Params:
+ *      to: The file pointer to send the response to.
+ *      clientArgs: The ClientArgs for the client that made the request.
+ *      address: The address from the request (modified).
+ *      request: The HTTP request.
+ */
+void handle_scan_req(FILE* to, ClientArgs clientArgs, char* address,
+        const HttpRequest* request);
+
+/* Handles a batch request (POST /batch/db) by applying every operation in
+ * the body of the request and sending back the result of each one. Each
+ * line of the body is an operation: "GET key", "PUT key value" or
+ * "DELETE key", with the key and value URL encoded. Each line of the
+ * response is the status of the matching operation (200, 404 or 500)
+ * followed, for a successful GET, by a space and the URL encoded value.
+ *
+ * Params:
+ *      to: The file pointer to send the response to.
+ *      clientArgs: The ClientArgs for the client that made the request.
+ *      address: The address from the request.
+ *      request: The HTTP request, whose body is modified.
  */
-void handle_delete_req(FILE* to, StringStore* db, pthread_mutex_t* dbLock,
-        Stats* stats, char* key, HttpHeader** headers, char* body);
+void handle_batch_req(FILE* to, ClientArgs clientArgs, char* address,
+        const HttpRequest* request);
+
+/* Finds the database and key that an increment or append applies to and
+ * checks the client may access them, sending an error response if not.
+ *
+ * Params:
+ *      to: The file pointer to send any error response to.
+ *      clientArgs: The ClientArgs for the client that made the request.
+ *      address: The address from the request, after the prefix of the
+ *      operation (modified).
+ *      request: The HTTP request.
+ *      key: Where the key is saved.
+ *
+ * Return:
+ *      The database or NULL if an error response was sent.
+ */
+Database* get_update_db(FILE* to, ClientArgs clientArgs, char* address,
+        const HttpRequest* request, char** key);
+
+/* Handles an increment request (POST /incr/db/key) by atomically adding the
+ * integer in the body (1 if the body is empty) to the value of the key. A key
+ * that doesn't exist counts as 0, and a key keeps its expiry. The response is
+ * 200 with the new value as its body, 400 if the body isn't an integer, 409
+ * if the value isn't an integer or the result would overflow, or 500 if the
+ * new value could not be stored.
+ *
+ * Params:
+ *      to: The file pointer to send the response to.
+ *      clientArgs: The ClientArgs for the client that made the request.
+ *      address: The address from the request (modified).
+ *      request: The HTTP request.
+ */
+void handle_incr_req(FILE* to, ClientArgs clientArgs, char* address,
+        const HttpRequest* request);
+
+/* Parses the amount an increment request adds to a key.
+ *
+ * Params:
+ *      body: The body of the HTTP request.
+ *      len: The length of the body.
+ *      delta: Where the amount is saved.
+ *
+ * Return:
+ *      true if the body is empty or a decimal integer that fits in an
+ *      int64_t.
+ */
+bool parse_delta(const char* body, size_t len, int64_t* delta);
+
+/* Handles an append request (POST /append/db/key) by atomically appending
+ * the body to the value of the key. A key that doesn't exist is added with
+ * the body as its value, and a key keeps its expiry. The response is 200
+ * with the new length of the value as its body or 500 if the value could
+ * not be stored.
+ *
+ * Params:
+ *      to: The file pointer to send the response to.
+ *      clientArgs: The ClientArgs for the client that made the request.
+ *      address: The address from the request (modified).
+ *      request: The HTTP request, whose body may contain '\0's.
+ */
+void handle_append_req(FILE* to, ClientArgs clientArgs, char* address,
+        const HttpRequest* request);
+
+/* Gets the value of a key for a GET request, pinning it so it stays valid
+ * while the response is sent. The shard of the key is locked for reading
+ * while it is found, unless its lock mode lets it be read without a lock.
+ *
+ * Params:
+ *      db: The database to GET from.
+ *      key: The key to GET.
+ *      snapshot: The value of the request's X-Snapshot header or NULL.
+ *      plainLen: If not NULL, the value is got as it is stored without being
+ *      decompressed, and its decompressed length (or 0 if it isn't
+ *      compressed) is saved here. Not used with a snapshot.
+ *      value: Where the value is saved (NULL if the key wasn't found).
+ *
+ * Return:
+ *      1 if the key was found, 0 if it wasn't, -1 if the snapshot is closed
+ *      or -2 if the header isn't valid.
+ */
+int get_value(Database* db, const char* key, const char* snapshot,
+        size_t* plainLen, const char** value);
+
+/* Parses a version or the time of a read snapshot given in decimal.
+ *
+ * Params:
+ *      str: The string to parse.
+ *      version: Where the number is saved.
+ *
+ * Return:
+ *      true if the string is a positive integer that fits in a uint64_t.
+ */
+bool parse_version(const char* str, uint64_t* version);
+
+/* Handles a request to open a read snapshot (POST /snapshot). The snapshot
+ * is sent back as the body and X-Snapshot header of the response, and GETs
+ * with that X-Snapshot header see every key as it was when the snapshot was
+ * opened. The snapshot closes after the number of seconds in the request's
+ * X-Expire-After header (DEFAULT_SNAPSHOT_TTL if there isn't one) unless it
+ * is closed first.
+ *
+ * Params:
+ *      to: The file pointer to send the response to.
+ *      request: The HTTP request.
+ */
+void handle_snapshot_open_req(FILE* to, const HttpRequest* request);
+
+/* Handles a request to close a read snapshot (DELETE /snapshot/id). The
+ * response is 200 if it was closed or 404 if it wasn't open.
+ *
+ * Params:
+ *      to: The file pointer to send the response to.
+ *      address: The address from the request.
+ */
+void handle_snapshot_close_req(FILE* to, char* address);
+
+/* Handles a request to save the databases in the background (POST
+ * /admin/bgsave). This needs the same authorisation as the private database.
+ * The response is 202 if the save was started, 409 if a save is already
+ * running, 400 if the server wasn't started with --save or 500 if the save
+ * could not be started.
+ *
+ * Params:
+ *      to: The file pointer to send the response to.
+ *      clientArgs: The ClientArgs for the client that made the request.
+ *      request: The HTTP request.
+ */
+void handle_bgsave_req(FILE* to, ClientArgs clientArgs,
+        const HttpRequest* request);
+
+/* Splits the body of a batch request into its operations. The keys and
+ * values are decoded in place so the operations point into the body. The
+ * body is read up to its length, and a '\0' in a line makes it invalid.
+ *
+ * Params:
+ *      body: The body of the batch request.
+ *      ops: Where the array of operations is saved (must be freed).
+ *
+ * Return:
+ *      The number of operations, -1 if the body is invalid or has more than
+ *      MAX_BATCH_OPS operations or -2 if memory ran out.
+ */
+int parse_batch(StrView body, BatchOp** ops);
+
+/* Parses a single line of a batch request.
+ *
+ * Params:
+ *      line: The line to parse (modified).
+ *      op: Where the operation is saved.
+ *
+ * Return:
+ *      true if the line is a valid operation.
+ */
+bool parse_batch_op(char* line, BatchOp* op);
+
+/* Sends the results of a batch to the client and releases the values found
+ * by any GETs.
+ *
+ * Params:
+ *      to: The file pointer to send the response to.
+ *      stats: A pointer to the Stats struct to record the operations in.
+ *      ops: The operations that were applied.
+ *      numOps: The number of operations.
+ */
+void send_batch_results(FILE* to, Stats* stats, BatchOp* ops, int numOps);
+
+/* Reads the parameters of a scan request from its query string.
+ *
+ * Params:
+ *      query: The query string of the request.
+ *      prefix: Where the prefix to scan is saved (must be freed).
+ *      cursor: Where the cursor to resume from is saved (must be freed), or
+ *      NULL if the scan should start from the beginning.
+ *      limit: Where the most pairs to return is saved.
+ *
+ * Return:
+ *      true if the parameters are valid.
+ */
+bool parse_scan_params(const char* query, char** prefix, char** cursor,
+        int* limit);
+
+/* Sends the results of a scan to the client, then frees the keys and
+ * releases the values.
+ *
+ * Params:
+ *      to: The file pointer to send the response to.
+ *      keys: The keys that were found.
+ *      values: The values of the keys that were found.
+ *      count: The number of keys that were found.
+ *      limit: The most keys that could have been found. If count reaches
+ *      this, the last key is sent as the cursor for the next page.
+ */
+void send_scan_results(FILE* to, char** keys, const char** values, int count,
+        int limit);
+
+/* Sends a response with a body that may contain '\0's to the client.
+ *
+ * Params:
+ *      to: The file pointer to send the response to.
+ *      status: The HTTP status code.
+ *      statusExplanation: The text explaining the status code.
+ *      header: An extra header to send (may be NULL).
+ *      body: The body of the response.
+ *      bodyLen: The number of bytes in the body.
+ */
+void send_response(FILE* to, int status, const char* statusExplanation,
+        HttpHeader* header, const char* body, size_t bodyLen);
+
+/* Sends a response like send_response() with any number of extra headers.
+ *
+ * Params:
+ *      to: The file pointer to send the response to.
+ *      status: The HTTP status code.
+ *      statusExplanation: The text explaining the status code.
+ *      extraHeaders: A NULL terminated array of extra headers to send.
+ *      body: The body of the response.
+ *      bodyLen: The number of bytes in the body.
+ */
+void send_response_headers(FILE* to, int status,
+        const char* statusExplanation, HttpHeader** extraHeaders,
+        const char* body, size_t bodyLen);
+
+/* Sends a response with no headers or body to the client.
+ *
+ * Params:
+ *      to: The file pointer to send the response to.
+ *      status: The HTTP status code.
+ *      statusExplanation: The text explaining the status code.
+ */
+void send_status(FILE* to, int status, const char* statusExplanation);
 
 /* Checks if the user is authorised. The user is authorised if their request
  * contains the Authorization header with the correct authstring or they are
  * attempting to access the public database.
  *
  * Params:
- *      headers: The HTTP headers from the request.
+ *      request: The HTTP request.
  *      db: The database they are trying to access.
  *      authstring: The correct authorisation string.
  *
  * Return:
  *      true if the user is authorised to access the specified database.
  */
-bool is_authorised(HttpHeader** headers, char* db, const char* authstring);
+bool is_authorised(const HttpRequest* request, const char* db,
+        const char* authstring);
 
 /* Sends the client a response if an unauthorised user attempts to access
  * privileged information and records it to the Stats struct.
@@ -246,6 +754,14 @@ bool is_authorised(HttpHeader** headers, char* db, const char* authstring);
  */
 void unauthorised_connection(FILE* to, Stats* stats);
 
+/* Atomically increments one of the operation counters in a Stats struct.
+ * This avoids every request contending on the statsLock.
+ *
+ * Params:
+ *      counter: A pointer to the counter to increment.
+ */
+void count_op(int* counter);
+
 /* Initialises and returns a pointer to a Stats struct that is used to record
  * server usage statistics to be reported later.
  */
@@ -259,8 +775,18 @@ Stats* stats_init(void);
  */
 void print_stats(Stats* stats);
 
+/* Print how much the values in both databases have been compressed by: the
+ * number of compressed values, their total length before compression divided
+ * by their total length after it, and the bytes saved.
+ *
+ * Params:
+ *      stats: A pointer to a Stats struct containing server usage stats.
+ */
+void print_compression_stats(Stats* stats);
+
 /* Sets up the signal handling for dbserver. In this case a handler for SIGHUP
- * that prints some server usage statistics to stderr is implemeted.
+ * that prints some server usage statistics to stderr is implemeted, and
+ * BGSAVE_SIGNAL starts a background save.
  *
  * Params:
  *      stats: A pointer to a Stats struct that contains usage info about the
@@ -268,7 +794,8 @@ void print_stats(Stats* stats);
  */
 void setup_sig_handling(Stats* stats);
 
-/* A thread used to handle SIGHUP and report usage stats.
+/* A thread used to handle SIGHUP and report usage stats, and to start a
+ * background save on BGSAVE_SIGNAL.
  *
  * Params:
  *      arg: Contains a pointer to the Stats struct that will be printed.
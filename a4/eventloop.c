@@ -0,0 +1,310 @@
+/* FILE: eventloop.c
+ *
+ * AUTHOR: Tariq Soliman
+ * STUDENT NO.: 45287316
+ *
+ * DESCRIPTION:
+ * Serves connections from a few epoll loop threads. See eventloop.h.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include "eventloop.h"
+
+#define MAX_EVENTS 64
+#define INIT_BUFFER_SIZE 4096
+#define MAX_PENDING_OUTPUT (1024 * 1024) // Unsent bytes before reading stops
+
+// A connection owned by a loop thread. Requests are read into in and their
+// responses are queued in out until they can be sent.
+typedef struct Connection {
+    int fd;
+    void* arg;
+    HttpParser parser;
+    char* in;
+    size_t inLen;
+    size_t inCap;
+    char* out;
+    size_t outLen;
+    size_t outSent;
+    uint32_t events;    // The events the connection is waiting for
+    bool closing;       // Close once out has been sent
+} Connection;
+
+// A loop thread and the epoll instance of its connections.
+typedef struct LoopThread {
+    EventLoop* loop;
+    int epollFd;
+} LoopThread;
+
+struct EventLoop {
+    LoopThread* threads;
+    int numThreads;
+    unsigned nextThread;
+    RequestHandler handleRequest;
+    CloseHandler handleClose;
+};
+
+/* Queue bytes to be sent on a connection.
+ *
+ * Params:
+ *      conn: The connection.
+ *      data: The bytes to send.
+ *      len: The number of bytes.
+ *
+ * Return:
+ *      false if the bytes could not be queued.
+ */
+static bool queue_output(Connection* conn, const char* data, size_t len) {
+    if (!len) {
+        return true;
+    }
+    if (conn->outSent == conn->outLen) {
+        conn->outSent = conn->outLen = 0;
+    }
+    char* grown = realloc(conn->out, conn->outLen + len);
+    if (!grown) {
+        return false;
+    }
+    conn->out = grown;
+    memcpy(conn->out + conn->outLen, data, len);
+    conn->outLen += len;
+    return true;
+}
+
+/* Handle every complete request in a connection's buffer, in order, queuing
+ * the responses. This stops early if the connection is to be closed or too
+ * much output is waiting to be sent.
+ *
+ * Params:
+ *      loop: The EventLoop the connection belongs to.
+ *      conn: The connection.
+ *
+ * Return:
+ *      The number of requests handled.
+ */
+static int handle_requests(EventLoop* loop, Connection* conn) {
+    int handled = 0;
+    size_t used = 0;
+    while (!conn->closing &&
+            conn->outLen - conn->outSent < MAX_PENDING_OUTPUT) {
+        HttpRequest request;
+        size_t reqLen;
+        ParseResult result = http_parse_request(&conn->parser,
+                conn->in + used, conn->inLen - used, &request, &reqLen);
+        if (result == PARSE_INVALID) {
+            conn->closing = true;
+            break;
+        }
+        if (result == PARSE_INCOMPLETE) {
+            break;
+        }
+
+        char* response = NULL;
+        size_t responseLen = 0;
+        FILE* to = open_memstream(&response, &responseLen);
+        if (!to || !loop->handleRequest(&request, to, conn->arg)) {
+            conn->closing = true;
+        }
+        if (to) {
+            fclose(to);
+        }
+        http_request_done(&conn->parser);
+        if (!queue_output(conn, response, responseLen)) {
+            conn->closing = true;
+        }
+        free(response);
+        used += reqLen;
+        handled++;
+    }
+    memmove(conn->in, conn->in + used, conn->inLen - used);
+    conn->inLen -= used;
+    return handled;
+}
+
+/* Read whatever the socket has (up to the room in the buffer, which is
+ * doubled when it is full) into a connection's buffer. The last byte of the
+ * buffer is kept free for the parser.
+ *
+ * Params:
+ *      conn: The connection to read from.
+ *
+ * Return:
+ *      false if the socket failed or was closed by the client.
+ */
+static bool read_input(Connection* conn) {
+    if (conn->inLen + 1 >= conn->inCap) {
+        size_t cap = conn->inCap ? conn->inCap * 2 : INIT_BUFFER_SIZE;
+        char* grown = realloc(conn->in, cap);
+        if (!grown) {
+            return false;
+        }
+        conn->in = grown;
+        conn->inCap = cap;
+    }
+    ssize_t got = read(conn->fd, conn->in + conn->inLen,
+            conn->inCap - conn->inLen - 1);
+    if (got < 0) {
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    }
+    conn->inLen += got;
+    return got > 0;
+}
+
+/* Send as much of a connection's queued output as the socket will take.
+ *
+ * Params:
+ *      conn: The connection to send to.
+ *
+ * Return:
+ *      false if the socket failed.
+ */
+static bool send_output(Connection* conn) {
+    while (conn->outSent < conn->outLen) {
+        ssize_t sent = send(conn->fd, conn->out + conn->outSent,
+                conn->outLen - conn->outSent, MSG_NOSIGNAL);
+        if (sent < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        }
+        conn->outSent += sent;
+    }
+    return true;
+}
+
+/* Close a connection and free it.
+ *
+ * Params:
+ *      thread: The loop thread that owns the connection.
+ *      conn: The connection to close.
+ */
+static void close_connection(LoopThread* thread, Connection* conn) {
+    epoll_ctl(thread->epollFd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    thread->loop->handleClose(conn->arg);
+    free(conn->in);
+    free(conn->out);
+    free(conn);
+}
+
+/* Deal with the events on a connection: read what has arrived, handle any
+ * complete requests and send the responses. While output is waiting to be
+ * sent the connection waits to be writable instead of readable.
+ *
+ * Params:
+ *      thread: The loop thread that owns the connection.
+ *      conn: The connection.
+ *      events: The events that happened.
+ *
+ * Return:
+ *      false if the connection should be closed.
+ */
+static bool serve_connection(LoopThread* thread, Connection* conn,
+        uint32_t events) {
+    if ((events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && !conn->closing &&
+            !read_input(conn)) {
+        // Whatever the client managed to send is still answered
+        conn->closing = true;
+    }
+    // Requests left in the buffer when the output backed up won't get
+    // another read event, so carry on with them whenever it all gets sent
+    do {
+        if (!send_output(conn)) {
+            return false;
+        }
+    } while (conn->outSent == conn->outLen &&
+            handle_requests(thread->loop, conn));
+
+    bool pending = conn->outSent < conn->outLen;
+    if (!pending && conn->closing) {
+        return false;
+    }
+    uint32_t wanted = pending ? EPOLLOUT : EPOLLIN;
+    if (wanted != conn->events) {
+        struct epoll_event event = {.events = wanted, .data.ptr = conn};
+        if (epoll_ctl(thread->epollFd, EPOLL_CTL_MOD, conn->fd, &event) < 0) {
+            return false;
+        }
+        conn->events = wanted;
+    }
+    return true;
+}
+
+/* A loop thread, which serves its connections as events happen on them.
+ *
+ * Params:
+ *      arg: A pointer to the LoopThread.
+ */
+static void* loop_thread(void* arg) {
+    LoopThread* thread = (LoopThread*)arg;
+    struct epoll_event events[MAX_EVENTS];
+    while (1) {
+        int numEvents = epoll_wait(thread->epollFd, events, MAX_EVENTS, -1);
+        for (int i = 0; i < numEvents; i++) {
+            Connection* conn = events[i].data.ptr;
+            if (!serve_connection(thread, conn, events[i].events)) {
+                close_connection(thread, conn);
+            }
+        }
+    }
+    return NULL;
+}
+
+EventLoop* eventloop_init(int numThreads, RequestHandler handleRequest,
+        CloseHandler handleClose) {
+    EventLoop* loop = malloc(sizeof(EventLoop));
+    LoopThread* threads = malloc(sizeof(LoopThread) * numThreads);
+    if (!loop || !threads) {
+        free(loop);
+        free(threads);
+        return NULL;
+    }
+    loop->threads = threads;
+    loop->numThreads = numThreads;
+    loop->nextThread = 0;
+    loop->handleRequest = handleRequest;
+    loop->handleClose = handleClose;
+
+    for (int i = 0; i < numThreads; i++) {
+        threads[i].loop = loop;
+        threads[i].epollFd = epoll_create1(EPOLL_CLOEXEC);
+        if (threads[i].epollFd < 0) {
+            return NULL;
+        }
+        pthread_t threadId;
+        if (pthread_create(&threadId, NULL, loop_thread, &threads[i])) {
+            return NULL;
+        }
+        pthread_detach(threadId);
+    }
+    return loop;
+}
+
+bool eventloop_add(EventLoop* loop, int fd, void* arg) {
+    Connection* conn = calloc(1, sizeof(Connection));
+    if (!conn) {
+        return false;
+    }
+    conn->fd = fd;
+    conn->arg = arg;
+    conn->events = EPOLLIN;
+    http_parser_init(&conn->parser);
+
+    int flags = fcntl(fd, F_GETFL);
+    unsigned next = __atomic_fetch_add(&loop->nextThread, 1,
+            __ATOMIC_RELAXED);
+    LoopThread* thread = &loop->threads[next % loop->numThreads];
+    struct epoll_event event = {.events = EPOLLIN, .data.ptr = conn};
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0 ||
+            epoll_ctl(thread->epollFd, EPOLL_CTL_ADD, fd, &event) < 0) {
+        free(conn);
+        return false;
+    }
+    return true;
+}
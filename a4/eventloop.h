@@ -0,0 +1,77 @@
+/* FILE: eventloop.h
+ *
+ * AUTHOR: Tariq Soliman
+ * STUDENT NO.: 45287316
+ *
+ * DESCRIPTION:
+ * Serves many connections from a few threads. Each loop thread owns an
+ * epoll instance and the non-blocking sockets added to it. Bytes read from
+ * a connection are kept in a buffer until it holds a whole request (its
+ * headers and as much body as its Content-Length gives), which is parsed in
+ * place and handled, with the response written to a stream in memory.
+ * Responses are sent as the socket has room for them, and a connection is
+ * only read from again once its responses have been sent, so a client that
+ * doesn't read can't make the server buffer without limit.
+ *
+ * Every complete request in the buffer is handled in order before any more
+ * is read, so pipelined requests are served without waiting for a round
+ * trip each. A connection costs its buffers rather than a thread, so the
+ * number of connections is limited by file descriptors instead.
+ *
+ * A request handler runs on its connection's loop thread, so a handler that
+ * blocks (e.g. waiting for the log to be synced) holds up the other
+ * connections of that thread.
+ */
+
+#ifndef EVENTLOOP_H
+#define EVENTLOOP_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "httpParser.h"
+
+/* A function that handles a single request, writing the response to to. The
+ * request's slices are only valid until the function returns. arg is the
+ * argument given when the connection was added. Returns false if the
+ * connection should be closed (once the response has been sent).
+ */
+typedef bool (*RequestHandler)(const HttpRequest* request, FILE* to,
+        void* arg);
+
+/* A function that is called once a connection has been closed, with the
+ * argument given when the connection was added.
+ */
+typedef void (*CloseHandler)(void* arg);
+
+/* A set of loop threads.*/
+typedef struct EventLoop EventLoop;
+
+/* Start the loop threads.
+ *
+ * Params:
+ *      numThreads: The number of loop threads.
+ *      handleRequest: The function to handle each request with.
+ *      handleClose: The function to call when a connection is closed.
+ *
+ * Return:
+ *      The EventLoop or NULL if it could not be started.
+ */
+EventLoop* eventloop_init(int numThreads, RequestHandler handleRequest,
+        CloseHandler handleClose);
+
+/* Hand a connected socket to one of the loop threads, which serves it until
+ * either end closes it. The socket is made non-blocking. The threads are
+ * given connections in turn.
+ *
+ * Params:
+ *      loop: The EventLoop to serve the connection.
+ *      fd: The socket.
+ *      arg: The argument to pass to the request and close handlers.
+ *
+ * Return:
+ *      true if the connection was added. If not, the caller still owns the
+ *      socket and arg.
+ */
+bool eventloop_add(EventLoop* loop, int fd, void* arg);
+
+#endif
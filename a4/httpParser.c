@@ -0,0 +1,283 @@
+/* FILE: httpParser.c
+ *
+ * AUTHOR: Tariq Soliman
+ * STUDENT NO.: 45287316
+ *
+ * DESCRIPTION:
+ * Parses HTTP requests in place in a connection's read buffer. See
+ * httpParser.h.
+ */
+
+#define _GNU_SOURCE     // For memmem()
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include "httpParser.h"
+
+#define HEADER_END "\r\n\r\n"
+#define HEADER_END_LEN 4
+#define LINE_END_LEN 2
+#define CONTENT_LENGTH_HEADER "Content-Length"
+#define MAX_LENGTH_DIGITS 19    // Any 19 digit number fits a uint64_t
+
+void http_parser_init(HttpParser* parser) {
+    parser->searched = 0;
+    parser->restoreAt = NULL;
+    parser->restore = '\0';
+}
+
+/* Find the blank line at the end of a request's headers, starting where the
+ * last search stopped.
+ *
+ * Params:
+ *      parser: The connection's parser.
+ *      buf: The bytes read.
+ *      len: The number of bytes read.
+ *
+ * Return:
+ *      The start of the "\r\n\r\n" that ends the headers or NULL if it
+ *      hasn't been read yet.
+ */
+static char* find_header_end(HttpParser* parser, char* buf, size_t len) {
+    size_t from = parser->searched <= len ? parser->searched : 0;
+    char* end = memmem(buf + from, len - from, HEADER_END, HEADER_END_LEN);
+    if (!end && len >= HEADER_END_LEN) {
+        // The end could start in the last few bytes searched
+        parser->searched = len - (HEADER_END_LEN - 1);
+    }
+    return end;
+}
+
+/* Take the next token from a line. Tokens are separated by spaces or tabs.
+ *
+ * Params:
+ *      pos: The position in the line, which is moved past the token.
+ *      end: The end of the line.
+ *
+ * Return:
+ *      The token, which is empty if the line has no more.
+ */
+static StrView next_token(char** pos, char* end) {
+    while (*pos < end && (**pos == ' ' || **pos == '\t')) {
+        (*pos)++;
+    }
+    StrView token = {.data = *pos, .len = 0};
+    while (*pos < end && **pos != ' ' && **pos != '\t') {
+        (*pos)++;
+        token.len++;
+    }
+    return token;
+}
+
+/* Parse a request line, e.g. "GET /public/key HTTP/1.1". Like sscanf()
+ * with "%s %s %s", anything after the third token is ignored.
+ *
+ * Params:
+ *      line: The start of the line.
+ *      end: The end of the line (not including "\r\n").
+ *      request: Where the method and address are saved.
+ *
+ * Return:
+ *      false if the line doesn't have a method, an address and a version.
+ */
+static bool parse_request_line(char* line, char* end, HttpRequest* request) {
+    request->method = next_token(&line, end);
+    request->address = next_token(&line, end);
+    StrView version = next_token(&line, end);
+    return request->method.len && request->address.len && version.len;
+}
+
+/* Parse a header line, e.g. "Content-Length: 10". Spaces and tabs around
+ * the value are not part of it.
+ *
+ * Params:
+ *      line: The start of the line.
+ *      end: The end of the line (not including "\r\n").
+ *      header: Where the header is saved.
+ *
+ * Return:
+ *      false if the line isn't a name and a value separated by a ':'.
+ */
+static bool parse_header(char* line, char* end, HeaderView* header) {
+    char* colon = memchr(line, ':', end - line);
+    if (!colon || colon == line) {
+        return false;
+    }
+    header->name.data = line;
+    header->name.len = colon - line;
+
+    char* value = colon + 1;
+    while (value < end && (*value == ' ' || *value == '\t')) {
+        value++;
+    }
+    while (end > value && (end[-1] == ' ' || end[-1] == '\t')) {
+        end--;
+    }
+    header->value.data = value;
+    header->value.len = end - value;
+    return true;
+}
+
+/* Get the length of a request's body from its Content-Length headers.
+ *
+ * Params:
+ *      request: The request, with its headers parsed.
+ *      bodyLen: Where the length is saved (0 if there is no such header).
+ *
+ * Return:
+ *      false if a Content-Length isn't a number or they don't all agree.
+ */
+static bool get_content_length(const HttpRequest* request, size_t* bodyLen) {
+    bool found = false;
+    *bodyLen = 0;
+    for (int i = 0; i < request->numHeaders; i++) {
+        const HeaderView* header = &request->headers[i];
+        if (header->name.len != strlen(CONTENT_LENGTH_HEADER) ||
+                strncasecmp(header->name.data, CONTENT_LENGTH_HEADER,
+                header->name.len)) {
+            continue;
+        }
+        if (!header->value.len || header->value.len > MAX_LENGTH_DIGITS) {
+            return false;
+        }
+        uint64_t length = 0;
+        for (size_t j = 0; j < header->value.len; j++) {
+            if (!isdigit((unsigned char)header->value.data[j])) {
+                return false;
+            }
+            length = length * 10 + (header->value.data[j] - '0');
+        }
+        if (length > SIZE_MAX || (found && length != *bodyLen)) {
+            return false;
+        }
+        *bodyLen = length;
+        found = true;
+    }
+    return true;
+}
+
+/* Parse the request line and headers of a request, without modifying them.
+ *
+ * Params:
+ *      head: The start of the request.
+ *      end: The start of the "\r\n\r\n" that ends the headers.
+ *      request: Where the request line and headers are saved.
+ *
+ * Return:
+ *      false if the request line or a header is badly formed, or there are
+ *      too many headers.
+ */
+static bool parse_head(char* head, char* end, HttpRequest* request) {
+    // Each line ends with "\n", usually after a '\r', and the last one ends
+    // at the start of the "\r\n\r\n"
+    char* headEnd = end + LINE_END_LEN;
+    request->numHeaders = 0;
+    bool isRequestLine = true;
+    for (char* line = head; line < headEnd;) {
+        char* newline = memchr(line, '\n', headEnd - line);
+        char* lineEnd = newline;
+        if (lineEnd > line && lineEnd[-1] == '\r') {
+            lineEnd--;
+        }
+        if (isRequestLine) {
+            if (!parse_request_line(line, lineEnd, request)) {
+                return false;
+            }
+            isRequestLine = false;
+        } else if (request->numHeaders == MAX_REQUEST_HEADERS ||
+                !parse_header(line, lineEnd,
+                &request->headers[request->numHeaders++])) {
+            return false;
+        }
+        line = newline + 1;
+    }
+    return true;
+}
+
+ParseResult http_parse_request(HttpParser* parser, char* buf, size_t len,
+        HttpRequest* request, size_t* reqLen) {
+    char* end = find_header_end(parser, buf, len);
+    if (!end) {
+        return len <= MAX_HEADER_SIZE ? PARSE_INCOMPLETE : PARSE_INVALID;
+    }
+    size_t headerLen = end - buf + HEADER_END_LEN;
+    size_t bodyLen;
+    // A '\0' in the headers would cut short the strings made from them
+    if (headerLen > MAX_HEADER_SIZE || memchr(buf, '\0', headerLen) ||
+            !parse_head(buf, end, request) ||
+            !get_content_length(request, &bodyLen) ||
+            bodyLen > SIZE_MAX - headerLen) {
+        return PARSE_INVALID;
+    }
+    if (len - headerLen < bodyLen) {
+        return PARSE_INCOMPLETE;
+    }
+
+    // The whole request is here, so the delimiters can be overwritten
+    view_terminate(request->method);
+    view_terminate(request->address);
+    for (int i = 0; i < request->numHeaders; i++) {
+        view_terminate(request->headers[i].name);
+        view_terminate(request->headers[i].value);
+    }
+    if (!http_split_db_key(request->address, &request->db, &request->key)) {
+        request->db.data = request->key.data = NULL;
+        request->db.len = request->key.len = 0;
+    }
+    request->body.data = buf + headerLen;
+    request->body.len = bodyLen;
+    *reqLen = headerLen + bodyLen;
+
+    parser->restoreAt = buf + *reqLen;
+    parser->restore = *parser->restoreAt;
+    *parser->restoreAt = '\0';
+    parser->searched = 0;
+    return PARSE_DONE;
+}
+
+void http_request_done(HttpParser* parser) {
+    if (parser->restoreAt) {
+        *parser->restoreAt = parser->restore;
+        parser->restoreAt = NULL;
+    }
+}
+
+const char* http_get_header(const HttpRequest* request, const char* name) {
+    for (int i = 0; i < request->numHeaders; i++) {
+        if (!strcasecmp(request->headers[i].name.data, name)) {
+            return request->headers[i].value.data;
+        }
+    }
+    return NULL;
+}
+
+bool http_split_db_key(StrView address, StrView* db, StrView* key) {
+    char* end = address.data + address.len;
+    char* dbStart = memchr(address.data, '/', address.len);
+    if (!dbStart) {
+        return false;
+    }
+    dbStart++;
+    char* keyStart = memchr(dbStart, '/', end - dbStart);
+    if (!keyStart) {
+        return false;
+    }
+    keyStart++;
+    char* keyEnd = memchr(keyStart, '/', end - keyStart);
+    db->data = dbStart;
+    db->len = keyStart - 1 - dbStart;
+    key->data = keyStart;
+    key->len = (keyEnd ? keyEnd : end) - keyStart;
+    return true;
+}
+
+bool view_equals(StrView view, const char* str) {
+    return view.data && view.len == strlen(str) &&
+            !memcmp(view.data, str, view.len);
+}
+
+char* view_terminate(StrView view) {
+    view.data[view.len] = '\0';
+    return view.data;
+}
@@ -0,0 +1,152 @@
+/* FILE: httpParser.h
+ *
+ * AUTHOR: Tariq Soliman
+ * STUDENT NO.: 45287316
+ *
+ * DESCRIPTION:
+ * Parses HTTP requests in place in a connection's read buffer. Nothing is
+ * copied or allocated: the method, address, database, key, headers and body
+ * of a request are slices of the buffer. Once a whole request has been read
+ * the delimiter after each of the method, address, header names and header
+ * values is overwritten with a '\0', so each of them is also a string. The
+ * byte after the body (the start of the next request, if any) is replaced
+ * with a '\0' too, and is put back by http_request_done().
+ *
+ * The parser is incremental: while a request's headers haven't all been
+ * read, it remembers how far it has searched for their end, so a request
+ * that arrives a few bytes at a time isn't searched from the start again.
+ */
+
+#ifndef HTTP_PARSER_H
+#define HTTP_PARSER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define MAX_REQUEST_HEADERS 64          // Most headers a request can have
+#define MAX_HEADER_SIZE (64 * 1024)     // Longest headers a request can have
+
+/* A slice of a buffer. A slice with NULL data is missing, while one with a
+ * length of 0 is empty.*/
+typedef struct StrView {
+    char* data;
+    size_t len;
+} StrView;
+
+/* A header of a request.*/
+typedef struct HeaderView {
+    StrView name;
+    StrView value;
+} HeaderView;
+
+/* A request parsed from a buffer. An address of the form /db/key[/...] has
+ * its database and key sliced out of it, otherwise db and key are missing.
+ * The key is not a string by itself, as it is followed by the rest of the
+ * address.*/
+typedef struct HttpRequest {
+    StrView method;
+    StrView address;
+    StrView db;
+    StrView key;
+    HeaderView headers[MAX_REQUEST_HEADERS];
+    int numHeaders;
+    StrView body;
+} HttpRequest;
+
+/* The state kept between calls to the parser for one connection.*/
+typedef struct HttpParser {
+    size_t searched;    // Bytes searched for the end of the headers so far
+    char* restoreAt;    // The byte replaced after the last request's body
+    char restore;
+} HttpParser;
+
+/* The outcome of parsing the start of a buffer.*/
+typedef enum ParseResult {
+    PARSE_DONE,         // A whole request was parsed
+    PARSE_INCOMPLETE,   // More of the request needs to be read
+    PARSE_INVALID       // The request is not valid HTTP
+} ParseResult;
+
+/* Initialise the parser for a new connection.
+ *
+ * Params:
+ *      parser: The parser to initialise.
+ */
+void http_parser_init(HttpParser* parser);
+
+/* Parse the request at the start of a buffer. The buffer is only modified
+ * if a whole request is parsed. Every call must be given the same request
+ * (with more bytes after it if more have been read) until it is parsed.
+ *
+ * Params:
+ *      parser: The connection's parser.
+ *      buf: The bytes read, which must have room for one more byte after
+ *      them.
+ *      len: The number of bytes read.
+ *      request: Where the parsed request is saved.
+ *      reqLen: Where the number of bytes in the request is saved.
+ *
+ * Return:
+ *      PARSE_DONE if a request was parsed, PARSE_INCOMPLETE if the rest of
+ *      it hasn't been read yet or PARSE_INVALID if it is badly formed (or has
+ *      headers that are too long or too many).
+ */
+ParseResult http_parse_request(HttpParser* parser, char* buf, size_t len,
+        HttpRequest* request, size_t* reqLen);
+
+/* Finish with the last request parsed, putting back the byte after it.
+ *
+ * Params:
+ *      parser: The connection's parser.
+ */
+void http_request_done(HttpParser* parser);
+
+/* Find the value of a header in a request. Header names are not case
+ * sensitive.
+ *
+ * Params:
+ *      request: The request.
+ *      name: The name of the header to find.
+ *
+ * Return:
+ *      The value of the first header with that name or NULL if there isn't
+ *      one.
+ */
+const char* http_get_header(const HttpRequest* request, const char* name);
+
+/* Slice the database and key out of an address of the form /db/key[/...].
+ * Anything before the first '/' is ignored.
+ *
+ * Params:
+ *      address: The address.
+ *      db: Where the database is saved.
+ *      key: Where the key is saved.
+ *
+ * Return:
+ *      false if the address doesn't have a database and key.
+ */
+bool http_split_db_key(StrView address, StrView* db, StrView* key);
+
+/* Check whether a slice holds exactly a string.
+ *
+ * Params:
+ *      view: The slice.
+ *      str: The string.
+ *
+ * Return:
+ *      true if the slice is present and equal to the string.
+ */
+bool view_equals(StrView view, const char* str);
+
+/* Make a slice a string by overwriting the byte after it with a '\0'.
+ *
+ * Params:
+ *      view: The slice, which must be followed by a byte that is no longer
+ *      needed.
+ *
+ * Return:
+ *      The string.
+ */
+char* view_terminate(StrView view);
+
+#endif
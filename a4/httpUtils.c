@@ -0,0 +1,176 @@
+/* FILE: httpUtils.c
+ *
+ * AUTHOR: Tariq Soliman
+ * STUDENT NO.: 45287316
+ *
+ * DESCRIPTION:
+ * Provides helper functions for working with HTTP requests that aren't
+ * covered by the csse2310a4 library, such as reading query strings.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include "httpUtils.h"
+
+#define HEX_DIGITS "0123456789ABCDEF"
+#define ANY_ETAG "*"
+#define WEAK_PREFIX "W/"
+
+char* split_query(char* address) {
+    char* query = strchr(address, '?');
+    if (!query) {
+        return address + strlen(address);
+    }
+    *query = '\0';
+    return query + 1;
+}
+
+char* get_query_param(const char* query, const char* name) {
+    size_t nameLen = strlen(name);
+    const char* param = query;
+
+    while (*param) {
+        size_t paramLen = strcspn(param, "&");
+        if (paramLen > nameLen && !strncmp(param, name, nameLen) &&
+                param[nameLen] == '=') {
+            size_t valueLen = paramLen - nameLen - 1;
+            char* value = malloc(valueLen + 1);
+            memcpy(value, param + nameLen + 1, valueLen);
+            value[valueLen] = '\0';
+            if (!url_decode(value, NULL)) {
+                free(value);
+                return NULL;
+            }
+            return value;
+        }
+
+        param += paramLen;
+        if (*param == '&') {
+            param++;
+        }
+    }
+    return NULL;
+}
+
+/* Get the value of a single hex digit.
+ *
+ * Params:
+ *      c: The hex digit.
+ *
+ * Return:
+ *      The value of the digit (0 to 15) or -1 if it isn't a hex digit.
+ */
+static int hex_value(char c) {
+    if (!isxdigit((unsigned char)c)) {
+        return -1;
+    }
+    return isdigit((unsigned char)c) ? c - '0' :
+            tolower((unsigned char)c) - 'a' + 10;
+}
+
+bool url_decode(char* str, size_t* len) {
+    char* out = str;
+    for (char* in = str; *in; in++) {
+        if (*in == '%') {
+            int high = hex_value(in[1]);
+            int low = high < 0 ? -1 : hex_value(in[2]);
+            if (low < 0) {
+                return false;
+            }
+            *out++ = (char)(high * 16 + low);
+            in += 2;
+        } else if (*in == '+') {
+            *out++ = ' ';
+        } else {
+            *out++ = *in;
+        }
+    }
+    *out = '\0';
+    if (len) {
+        *len = out - str;
+    }
+    return true;
+}
+
+char* url_encode(const char* data, size_t len) {
+    char* encoded = malloc(len * 3 + 1);
+    char* out = encoded;
+    const unsigned char* end = (const unsigned char*)data + len;
+    for (const unsigned char* in = (const unsigned char*)data; in < end;
+            in++) {
+        if (*in && (isalnum(*in) || strchr("-._~", *in))) {
+            *out++ = *in;
+        } else {
+            *out++ = '%';
+            *out++ = HEX_DIGITS[*in >> 4];
+            *out++ = HEX_DIGITS[*in & 0xF];
+        }
+    }
+    *out = '\0';
+    return encoded;
+}
+
+void format_etag(char* buf, uint64_t version) {
+    snprintf(buf, ETAG_SIZE, "\"%" PRIx64 "\"", version);
+}
+
+bool etag_matches(const char* list, uint64_t version) {
+    if (!version) {
+        return false;
+    }
+    char etag[ETAG_SIZE];
+    format_etag(etag, version);
+    size_t etagLen = strlen(etag);
+
+    const char* pos = list;
+    while (*pos) {
+        while (isspace((unsigned char)*pos) || *pos == ',') {
+            pos++;
+        }
+        size_t len = strcspn(pos, ", \t");
+        if (len == strlen(ANY_ETAG) && !strncmp(pos, ANY_ETAG, len)) {
+            return true;
+        }
+        const char* tag = pos;
+        if (!strncmp(tag, WEAK_PREFIX, strlen(WEAK_PREFIX))) {
+            tag += strlen(WEAK_PREFIX);
+        }
+        if (len - (tag - pos) == etagLen && !strncmp(tag, etag, etagLen)) {
+            return true;
+        }
+        pos += len;
+    }
+    return false;
+}
+
+bool accepts_encoding(const char* list, const char* coding) {
+    size_t codingLen = strlen(coding);
+    const char* pos = list;
+    while (*pos) {
+        while (isspace((unsigned char)*pos) || *pos == ',') {
+            pos++;
+        }
+        size_t len = strcspn(pos, ",");
+        size_t nameLen = strcspn(pos, ",; \t");
+        if (nameLen == codingLen && !strncasecmp(pos, coding, codingLen)) {
+            const char* param = pos + nameLen;
+            while ((param = strchr(param, ';')) && param < pos + len) {
+                param++;
+                while (isspace((unsigned char)*param)) {
+                    param++;
+                }
+                if (tolower((unsigned char)param[0]) == 'q' &&
+                        param[1] == '=') {
+                    return strtod(param + 2, NULL) > 0;
+                }
+            }
+            return true;
+        }
+        pos += len;
+    }
+    return false;
+}
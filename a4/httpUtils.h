@@ -0,0 +1,103 @@
+/* FILE: httpUtils.h
+ *
+ * AUTHOR: Tariq Soliman
+ * STUDENT NO.: 45287316
+ *
+ * DESCRIPTION:
+ * Provides helper functions for working with HTTP requests that aren't
+ * covered by the csse2310a4 library, such as reading query strings.
+ */
+
+#ifndef HTTP_UTILS_H
+#define HTTP_UTILS_H
+
+#define ETAG_SIZE 19        // Fits a quoted uint64_t in hex
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Splits the query string off the end of an address. The address is
+ * modified so it ends where the query string started.
+ *
+ * Params:
+ *      address: The address from the request, e.g. "/scan/public?limit=10".
+ *
+ * Return:
+ *      The query string (without the '?') or an empty string if there isn't
+ *      one.
+ */
+char* split_query(char* address);
+
+/* Find a parameter in a query string and decode its value. The query string
+ * is not modified.
+ *
+ * Params:
+ *      query: The query string, e.g. "prefix=a%20b&limit=10".
+ *      name: The name of the parameter to find.
+ *
+ * Return:
+ *      A newly allocated copy of the decoded value or NULL if the parameter
+ *      isn't in the query string or isn't validly encoded.
+ */
+char* get_query_param(const char* query, const char* name);
+
+/* Decodes a percent encoded string in place ('+' is decoded to a space). The
+ * decoded string may contain '\0's (encoded as %00).
+ *
+ * Params:
+ *      str: The string to decode.
+ *      len: Where the length of the decoded string is saved (may be NULL).
+ *
+ * Return:
+ *      true if the string was validly encoded.
+ */
+bool url_decode(char* str, size_t* len);
+
+/* Percent encodes data so that it only contains unreserved characters.
+ *
+ * Params:
+ *      data: The data to encode (which may contain '\0's).
+ *      len: The number of bytes of data.
+ *
+ * Return:
+ *      A newly allocated encoded string.
+ */
+char* url_encode(const char* data, size_t len);
+
+/* Format a version as a strong entity tag, e.g. "\"5f3a\"".
+ *
+ * Params:
+ *      buf: Where the tag is saved (at least ETAG_SIZE bytes).
+ *      version: The version to format.
+ */
+void format_etag(char* buf, uint64_t version);
+
+/* Check if an If-Match or If-None-Match header matches a version. The header
+ * is either "*", which matches any version, or a comma separated list of
+ * entity tags. A tag's "W/" prefix is ignored.
+ *
+ * Params:
+ *      list: The value of the header.
+ *      version: The current version or 0 if there isn't one (which nothing
+ *      matches).
+ *
+ * Return:
+ *      true if the header matches the version.
+ */
+bool etag_matches(const char* list, uint64_t version);
+
+/* Check if an Accept-Encoding header accepts a content coding. The header is
+ * a comma separated list of codings, each of which may have a quality
+ * ("q=") parameter. A quality of 0 means the coding is not acceptable.
+ *
+ * Params:
+ *      list: The value of the header.
+ *      coding: The name of the coding.
+ *
+ * Return:
+ *      true if the coding is listed and not refused.
+ */
+bool accepts_encoding(const char* list, const char* coding);
+
+#endif
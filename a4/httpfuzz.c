@@ -0,0 +1,368 @@
+/* FILE: httpfuzz.c
+ *
+ * AUTHOR: Tariq Soliman
+ * STUDENT NO.: 45287316
+ *
+ * DESCRIPTION:
+ * A fuzzer for the HTTP request parser. See httpfuzz.h.
+ */
+
+#include "httpfuzz.h"
+
+/* Requests with bodies and several headers, which the test sequence files
+ * don't send.*/
+static const char* builtInSeeds[] = {
+        "PUT /public/key HTTP/1.1\r\nContent-Length: 5\r\n\r\nvalue",
+        "DELETE /private/key HTTP/1.1\r\nAuthorization: secret\r\n\r\n",
+        "GET /public/key HTTP/1.1\r\nAccept-Encoding: lz4\r\n"
+                "X-Snapshot: 3\r\n\r\n",
+        "POST /admin/snapshot HTTP/1.1\r\nContent-Length: 0\r\n\r\n"
+                "GET /stats HTTP/1.1\r\n\r\n"};
+
+/* Bytes that mean something to the parser, which mutations favour.*/
+static const char interesting[] = "\r\n\r\n :\t/0123456789";
+
+/* Values given to the Content-Length headers that mutations add.*/
+static const char* lengths[] = {"0", "1", "5", "64", "4096", " 7 ", "-1",
+        "0x10", "99999999999999999999", "18446744073709551615", ""};
+
+int main(int argc, char* argv[]) {
+    int iterations = DEFAULT_ITERATIONS;
+    int seed = DEFAULT_SEED;
+    int first;
+    if (!parse_options(argc, argv, &iterations, &seed, &first)) {
+        fprintf(stderr, USAGE_MSG);
+        return USAGE_EXIT_CODE;
+    }
+
+    FuzzInput seeds[MAX_SEEDS];
+    int numSeeds = 0;
+    for (size_t i = 0; i < sizeof(builtInSeeds) / sizeof(char*); i++) {
+        seeds[numSeeds].data = strdup(builtInSeeds[i]);
+        seeds[numSeeds++].len = strlen(builtInSeeds[i]);
+    }
+    for (int i = first; i < argc; i++) {
+        if (!read_seeds(argv[i], seeds, &numSeeds)) {
+            fprintf(stderr, FILE_MSG, argv[i]);
+            return FILE_EXIT_CODE;
+        }
+    }
+
+    FuzzCounts counts = {0};
+    uint64_t state = (uint64_t)seed * 0x9E3779B97F4A7C15ULL;
+    char data[MAX_INPUT];
+    FuzzInput input = {.data = data};
+    // Every seed is checked as it is before any are mutated
+    for (long i = 0; i < (long)numSeeds + iterations; i++) {
+        const FuzzInput* from = &seeds[i < numSeeds ? i :
+                next_random(&state) % numSeeds];
+        input.len = from->len < MAX_INPUT ? from->len : MAX_INPUT;
+        memcpy(data, from->data, input.len);
+        int numMutations = i < numSeeds ? 0 :
+                1 + next_random(&state) % MAX_MUTATIONS;
+        for (int j = 0; j < numMutations; j++) {
+            mutate(&input, seeds, numSeeds, &state);
+        }
+
+        const char* failure = check_input(&input, &counts);
+        if (failure) {
+            if (counts.failures++ < MAX_REPORTED) {
+                report_failure(&input, failure);
+            }
+        }
+    }
+
+    printf("seeds:%d inputs:%lu done:%lu incomplete:%lu invalid:%lu "
+            "failures:%lu\n", numSeeds, counts.inputs, counts.done,
+            counts.incomplete, counts.invalid, counts.failures);
+    for (int i = 0; i < numSeeds; i++) {
+        free(seeds[i].data);
+    }
+    return counts.failures ? FAILED_EXIT_CODE : 0;
+}
+
+bool parse_options(int argc, char* argv[], int* iterations, int* seed,
+        int* first) {
+    int i = 1;
+    while (i < argc && !strncmp(argv[i], OPT_PREFIX, strlen(OPT_PREFIX))) {
+        if (i + 1 >= argc || !is_int(argv[i + 1])) {
+            return false;
+        }
+        errno = 0;
+        long value = strtol(argv[i + 1], NULL, 10);
+        if (!strcmp(argv[i], ITERATIONS_OPT) && !errno && value >= 0 &&
+                value <= MAX_ITERATIONS) {
+            *iterations = (int)value;
+        } else if (!strcmp(argv[i], SEED_OPT) && !errno && value >= 1 &&
+                value <= INT32_MAX) {
+            *seed = (int)value;
+        } else {
+            return false;
+        }
+        i += 2;
+    }
+    *first = i;
+    return i < argc;
+}
+
+size_t unescape(char* str) {
+    size_t len = 0;
+    for (char* c = str; *c; c++) {
+        if (*c == '\\' && c[1]) {
+            c++;
+            if (*c == 'r') {
+                str[len++] = '\r';
+            } else if (*c == 'n') {
+                str[len++] = '\n';
+            } else if (*c == 't') {
+                str[len++] = '\t';
+            } else if (*c == '\\') {
+                str[len++] = '\\';
+            } else {
+                str[len++] = '\\';
+                str[len++] = *c;
+            }
+        } else {
+            str[len++] = *c;
+        }
+    }
+    return len;
+}
+
+bool read_seeds(const char* filename, FuzzInput* seeds, int* numSeeds) {
+    FILE* file = fopen(filename, "r");
+    if (!file) {
+        return false;
+    }
+    char* line = NULL;
+    size_t size = 0;
+    ssize_t got;
+    while ((got = getline(&line, &size, file)) >= 0 &&
+            *numSeeds < MAX_SEEDS) {
+        if (got && line[got - 1] == '\n') {
+            line[got - 1] = '\0';
+        }
+        // Only messages that start with a method are requests
+        char* message = strstr(line, SEND_COMMAND);
+        if (!message) {
+            continue;
+        }
+        message += strlen(SEND_COMMAND);
+        char* method = message;
+        while (*method >= 'A' && *method <= 'Z') {
+            method++;
+        }
+        if (method == message || *method != ' ') {
+            continue;
+        }
+        size_t len = unescape(message);
+        FuzzInput* seed = &seeds[(*numSeeds)++];
+        seed->data = malloc(len + 1);
+        memcpy(seed->data, message, len);
+        seed->data[len] = '\n';
+        seed->len = len + 1;
+    }
+    free(line);
+    fclose(file);
+    return true;
+}
+
+uint64_t next_random(uint64_t* state) {
+    // xorshift64*
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+void splice_input(FuzzInput* input, size_t at, size_t oldLen,
+        const char* with, size_t newLen) {
+    if (input->len - oldLen + newLen > MAX_INPUT) {
+        newLen = MAX_INPUT - (input->len - oldLen);
+    }
+    memmove(input->data + at + newLen, input->data + at + oldLen,
+            input->len - at - oldLen);
+    memcpy(input->data + at, with, newLen);
+    input->len = input->len - oldLen + newLen;
+}
+
+void mutate(FuzzInput* input, const FuzzInput* seeds, int numSeeds,
+        uint64_t* state) {
+    size_t at = input->len ? next_random(state) % (input->len + 1) : 0;
+    // Half the bytes written are ones the parser looks for
+    char byte = next_random(state) % 2 ? (char)next_random(state) :
+            interesting[next_random(state) % (sizeof(interesting) - 1)];
+    int choice = next_random(state) % 6;
+
+    if (choice == 0 && at < input->len) {
+        input->data[at] = byte;
+    } else if (choice == 1) {
+        splice_input(input, at, 0, &byte, 1);
+    } else if (choice == 2 && at < input->len) {
+        size_t len = 1 + next_random(state) % 8;
+        splice_input(input, at, len < input->len - at ? len :
+                input->len - at, "", 0);
+    } else if (choice == 3) {
+        const FuzzInput* from = &seeds[next_random(state) % numSeeds];
+        size_t start = next_random(state) % from->len;
+        size_t len = 1 + next_random(state) % 32;
+        splice_input(input, at, 0, from->data + start,
+                len < from->len - start ? len : from->len - start);
+    } else if (choice == 4) {
+        // Add a Content-Length header after the request line
+        char header[64];
+        int len = snprintf(header, sizeof(header), "Content-Length: %s\r\n",
+                lengths[next_random(state) % (sizeof(lengths) /
+                sizeof(char*))]);
+        char* newline = memchr(input->data, '\n', input->len);
+        splice_input(input, newline ? newline - input->data + 1 : 0, 0,
+                header, len);
+    } else if (choice == 5 && input->len * 2 <= MAX_INPUT) {
+        // Pipeline the input after itself
+        splice_input(input, input->len, 0, input->data, input->len);
+    }
+}
+
+const char* check_request(const HttpRequest* request, const char* buf,
+        size_t reqLen) {
+    const StrView* views[] = {&request->method, &request->address,
+            &request->db, &request->key, &request->body};
+    for (size_t i = 0; i < sizeof(views) / sizeof(StrView*); i++) {
+        if (views[i]->data && (views[i]->data < buf ||
+                views[i]->data + views[i]->len > buf + reqLen)) {
+            return "slice outside the request";
+        }
+    }
+    if (request->body.data + request->body.len != buf + reqLen) {
+        return "body doesn't end the request";
+    }
+    if (strlen(request->method.data) != request->method.len ||
+            strlen(request->address.data) != request->address.len) {
+        return "request line not terminated";
+    }
+    for (int i = 0; i < request->numHeaders; i++) {
+        const HeaderView* header = &request->headers[i];
+        if (header->name.data < buf || header->value.data < buf ||
+                header->name.data + header->name.len > buf + reqLen ||
+                header->value.data + header->value.len > buf + reqLen) {
+            return "header outside the request";
+        }
+        if (strlen(header->name.data) != header->name.len ||
+                strlen(header->value.data) != header->value.len) {
+            return "header not terminated";
+        }
+    }
+    return NULL;
+}
+
+const char* check_input(const FuzzInput* input, FuzzCounts* counts) {
+    // Every request has at least a "\r\n\r\n", so this is plenty
+    ParseResult results[MAX_INPUT + 1];
+    size_t reqLens[MAX_INPUT + 1];
+    int numResults = 0;
+    const char* failure = NULL;
+    counts->inputs++;
+
+    // The parser may use the byte after the input, but nothing more
+    char* buf = malloc(input->len + 1);
+    memcpy(buf, input->data, input->len);
+    HttpParser parser;
+    http_parser_init(&parser);
+    size_t used = 0;
+    while (!failure) {
+        HttpRequest request;
+        size_t reqLen = 0;
+        ParseResult result = http_parse_request(&parser, buf + used,
+                input->len - used, &request, &reqLen);
+        results[numResults] = result;
+        reqLens[numResults++] = reqLen;
+        if (result == PARSE_INCOMPLETE) {
+            counts->incomplete++;
+            break;
+        }
+        if (result == PARSE_INVALID) {
+            counts->invalid++;
+            break;
+        }
+        counts->done++;
+        if (!reqLen || reqLen > input->len - used) {
+            failure = "request length outside the input";
+            break;
+        }
+        failure = check_request(&request, buf + used, reqLen);
+        if (!failure && buf[used + reqLen] != '\0') {
+            failure = "request not terminated";
+        }
+        http_request_done(&parser);
+        used += reqLen;
+        if (!failure && memcmp(buf + used, input->data + used,
+                input->len - used)) {
+            failure = "bytes after the request changed";
+        }
+    }
+    free(buf);
+    if (failure) {
+        return failure;
+    }
+
+    // Feed the same input a byte at a time
+    buf = malloc(input->len + 1);
+    http_parser_init(&parser);
+    used = 0;
+    int next = 0;
+    for (size_t len = 1; len <= input->len && next < numResults; len++) {
+        buf[len - 1] = input->data[len - 1];
+        while (next < numResults) {
+            HttpRequest request;
+            size_t reqLen = 0;
+            ParseResult result = http_parse_request(&parser, buf + used,
+                    len - used, &request, &reqLen);
+            if (result == PARSE_INCOMPLETE) {
+                break;
+            }
+            if (result != results[next] || (result == PARSE_DONE &&
+                    reqLen != reqLens[next])) {
+                failure = "parsed differently as it arrived";
+            } else if (result == PARSE_DONE) {
+                failure = check_request(&request, buf + used, reqLen);
+                http_request_done(&parser);
+                used += reqLen;
+            }
+            next++;
+            if (failure || result == PARSE_INVALID) {
+                next = numResults;
+            }
+        }
+    }
+    // Only the last result can be waiting for more of the input
+    if (!failure && next < numResults - 1) {
+        failure = "request missed as it arrived";
+    }
+    if (!failure && next == numResults - 1 &&
+            results[next] != PARSE_INCOMPLETE) {
+        failure = "request missed as it arrived";
+    }
+    free(buf);
+    return failure;
+}
+
+void report_failure(const FuzzInput* input, const char* failure) {
+    printf("FAILED (%s): \"", failure);
+    for (size_t i = 0; i < input->len; i++) {
+        unsigned char c = input->data[i];
+        if (c == '\r') {
+            printf("\\r");
+        } else if (c == '\n') {
+            printf("\\n");
+        } else if (c == '\\' || c == '"') {
+            printf("\\%c", c);
+        } else if (c < ' ' || c > '~') {
+            printf("\\x%02x", c);
+        } else {
+            putchar(c);
+        }
+    }
+    printf("\"\n");
+}
@@ -0,0 +1,180 @@
+/* FILE: httpfuzz.h
+ *
+ * AUTHOR: Tariq Soliman
+ * STUDENT NO.: 45287316
+ *
+ * DESCRIPTION:
+ * A fuzzer for the HTTP request parser. The requests sent by the test
+ * sequence files ("n send ..." lines whose message starts with a method) are
+ * used as seeds, along with a few built in requests with bodies, and each
+ * iteration feeds the parser a seed with random bytes flipped, inserted or
+ * removed, parts of other seeds spliced in or a Content-Length header added.
+ * Each input is copied to a buffer of exactly its size (plus the byte the
+ * parser may use) so the sanitizers catch any access outside it, and is
+ * parsed both whole and a byte at a time, with every pipelined request in it
+ * checked:
+ *
+ *  - every slice of a parsed request lies within the request and the body
+ *    ends exactly where the request does,
+ *  - the byte after a request is put back once it is done with,
+ *  - parsing the input as it arrives gives the same requests, with nothing
+ *    but PARSE_INCOMPLETE before each one.
+ *
+ * The counts of each result are printed and the exit status is non-zero if
+ * any check failed.
+ */
+
+#ifndef HTTPFUZZ_H
+#define HTTPFUZZ_H
+
+#define OPT_PREFIX "--"
+#define ITERATIONS_OPT "--iterations"
+#define SEED_OPT "--seed"
+#define USAGE_MSG "Usage: httpfuzz [--iterations n] [--seed n] " \
+        "sequencefile ...\n"
+#define USAGE_EXIT_CODE 1
+#define FILE_MSG "httpfuzz: unable to read \"%s\"\n"
+#define FILE_EXIT_CODE 2
+#define FAILED_EXIT_CODE 3
+#define SEND_COMMAND " send "
+#define DEFAULT_ITERATIONS 100000
+#define DEFAULT_SEED 1
+#define MAX_ITERATIONS 1000000000
+#define MAX_SEEDS 1024
+#define MAX_INPUT 4096
+#define MAX_MUTATIONS 4
+#define MAX_REPORTED 10     // Failures printed in full
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include "httpParser.h"
+#include "utilities.h"
+
+/* An input to the parser, which may contain '\0's.*/
+typedef struct FuzzInput {
+    char* data;
+    size_t len;
+} FuzzInput;
+
+/* A struct to store the counts of each result and failed check.*/
+typedef struct FuzzCounts {
+    unsigned long inputs;
+    unsigned long done;
+    unsigned long incomplete;
+    unsigned long invalid;
+    unsigned long failures;
+} FuzzCounts;
+
+/* Removes any "--option value" pairs from the commandline arguments and
+ * records them, leaving the index of the first file in first.
+ *
+ * Params:
+ *      argc: The number of commandline arguments.
+ *      argv: An array of the commandline arguments.
+ *      iterations: Where the number of iterations is saved.
+ *      seed: Where the seed of the random number generator is saved.
+ *      first: Where the index of the first file is saved.
+ *
+ * Return:
+ *      true if every option was recognised with a valid value and at least
+ *      one file was given.
+ */
+bool parse_options(int argc, char* argv[], int* iterations, int* seed,
+        int* first);
+
+/* Undo the escapes a test sequence file uses in a message (\r, \n, \t and
+ * \\), in place.
+ *
+ * Params:
+ *      str: The message.
+ *
+ * Return:
+ *      The length of the unescaped message.
+ */
+size_t unescape(char* str);
+
+/* Add the requests sent by a test sequence file to the seeds. The sequence
+ * runner adds a "\n" to each message, so that is added here too.
+ *
+ * Params:
+ *      filename: The file to read.
+ *      seeds: The seeds.
+ *      numSeeds: The number of seeds, which is updated.
+ *
+ * Return:
+ *      false if the file couldn't be read.
+ */
+bool read_seeds(const char* filename, FuzzInput* seeds, int* numSeeds);
+
+/* Get the next number from the xorshift random number generator.
+ *
+ * Params:
+ *      state: The state of the generator (must not be 0).
+ *
+ * Return:
+ *      A random 64 bit number.
+ */
+uint64_t next_random(uint64_t* state);
+
+/* Replace the bytes in part of an input.
+ *
+ * Params:
+ *      input: The input, with room for MAX_INPUT bytes.
+ *      at: Where the bytes to replace start.
+ *      oldLen: The number of bytes to replace.
+ *      with: The bytes to put in their place.
+ *      newLen: The number of bytes to put in their place.
+ */
+void splice_input(FuzzInput* input, size_t at, size_t oldLen,
+        const char* with, size_t newLen);
+
+/* Make a random change to an input.
+ *
+ * Params:
+ *      input: The input, with room for MAX_INPUT bytes.
+ *      seeds: The seeds, which are spliced into it.
+ *      numSeeds: The number of seeds.
+ *      state: The state of the random number generator.
+ */
+void mutate(FuzzInput* input, const FuzzInput* seeds, int numSeeds,
+        uint64_t* state);
+
+/* Check that the slices of a parsed request lie within it.
+ *
+ * Params:
+ *      request: The parsed request.
+ *      buf: The start of the request.
+ *      reqLen: The length of the request.
+ *
+ * Return:
+ *      A description of the first check that failed or NULL.
+ */
+const char* check_request(const HttpRequest* request, const char* buf,
+        size_t reqLen);
+
+/* Parse every request in an input, first all at once and then as it
+ * arrives a byte at a time, checking the results agree.
+ *
+ * Params:
+ *      input: The input.
+ *      counts: The counts of each result, which are updated.
+ *
+ * Return:
+ *      A description of the first check that failed or NULL.
+ */
+const char* check_input(const FuzzInput* input, FuzzCounts* counts);
+
+/* Print an input that failed a check, escaping any bytes that aren't
+ * printable.
+ *
+ * Params:
+ *      input: The input.
+ *      failure: The check that failed.
+ */
+void report_failure(const FuzzInput* input, const char* failure);
+
+#endif
@@ -0,0 +1,788 @@
+/* FILE: journal.c
+ *
+ * AUTHOR: Tariq Soliman
+ * STUDENT NO.: 45287316
+ *
+ * DESCRIPTION:
+ * Makes the databases persistent with an append-only log of every successful
+ * PUT and DELETE. The log is periodically compacted into a snapshot of the
+ * databases so it doesn't grow forever. On startup the snapshot is mapped
+ * into memory with mmap() and loaded straight into the databases before the
+ * log is replayed on top of it.
+ *
+ * Both files start with a magic string followed by a sequence of records.
+ * Each record is a RecordHeader followed by the key and (for a PUT) the
+ * value, each with a terminating '\0' so they can be used straight out of
+ * the mapped file. A key's expiry time is saved in an EXPIRE record after the
+ * PUT, with the time written out in decimal as its value.
+ *
+ * Every record sets a key to a state rather than changing it relative to its
+ * old one: increments and appends are logged as a PUT of the new value. A
+ * compaction's snapshot is taken while writes carry on after the log has
+ * been rotated, so a change can end up in both the snapshot and the new log
+ * and must give the same result if it is replayed twice.
+ *
+ * By default records are written to the log as soon as they are made and
+ * left for the OS to flush to disk. With group commit enabled, records are
+ * instead gathered in memory and a flusher thread writes each batch to the
+ * log with a single write() and fdatasync(). Clients wait for the batch
+ * holding their record to be committed before they are sent a response, so
+ * many clients share the cost of each sync. If a batch can't be buffered,
+ * written or synced the server exits: its changes are already visible to
+ * other clients, and after a failed fdatasync() there is no telling what
+ * made it to disk, so carrying on would acknowledge writes that could be
+ * lost.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <inttypes.h>
+#include "journal.h"
+
+#define LOG_MAGIC "DBLOG001"
+#define SNAPSHOT_MAGIC "DBSNAP01"
+#define MAGIC_LEN 8
+#define OP_PUT 'P'
+#define OP_DELETE 'D'
+#define OP_EXPIRE 'E'
+#define EXPIRY_BUFFER_SIZE 21   // Fits any uint64_t in decimal
+#define OLD_SUFFIX ".old"
+#define SNAPSHOT_SUFFIX ".snapshot"
+#define TMP_SUFFIX ".tmp"
+#define SNAPSHOT_BUFFER_SIZE (1024 * 1024)
+#define SNAPSHOT_CHUNK 256      // Pairs read from a database at a time
+#define INIT_BATCH_CAPACITY (64 * 1024)
+#define NSECS_PER_SEC 1000000000L
+#define NSECS_PER_USEC 1000L
+
+// The fixed size start of each record. The lengths don't include the '\0'.
+typedef struct RecordHeader {
+    uint8_t op;
+    uint8_t db;
+    uint16_t reserved;
+    uint32_t keyLen;
+    uint32_t valLen;
+} RecordHeader;
+
+// Records that are waiting to be written to the log together.
+typedef struct LogBatch {
+    char* data;
+    size_t len;
+    size_t capacity;
+    int numRecords;
+    struct timespec firstAdded;
+} LogBatch;
+
+struct Journal {
+    char* logPath;
+    char* oldPath;
+    char* snapshotPath;
+    char* tmpPath;
+    FILE* log;
+    unsigned long numLogged;    // Records logged since the last compaction
+    pthread_mutex_t logLock;
+    pthread_mutex_t compactLock;
+    Database** dbs;
+    int numDbs;
+    int interval;
+
+    // Group commit. The logLock protects everything but the flushLock, which
+    // is held while a batch is written so the log can't be swapped under it.
+    bool groupCommit;
+    int windowUsecs;
+    int maxBatch;
+    LogBatch pending;
+    uint64_t appendedSeq;       // Sequence number of the last record logged
+    uint64_t committedSeq;      // and of the last record synced to disk
+    pthread_mutex_t flushLock;
+    pthread_cond_t pendingCond;
+    pthread_cond_t commitCond;
+
+    // Group commit stats
+    unsigned long numBatches;
+    unsigned long numCommitted;
+    int largestBatch;
+    unsigned long totalLatencyUsecs;
+    unsigned long maxLatencyUsecs;
+};
+
+/* Allocate a new string made up of path followed by suffix.
+ *
+ * Params:
+ *      path: The start of the new string.
+ *      suffix: The end of the new string.
+ *
+ * Return:
+ *      The new string.
+ */
+static char* add_suffix(const char* path, const char* suffix) {
+    char* str = malloc(strlen(path) + strlen(suffix) + 1);
+    strcpy(str, path);
+    strcat(str, suffix);
+    return str;
+}
+
+/* Create the header for a record.
+ *
+ * Params:
+ *      op: OP_PUT, OP_EXPIRE or OP_DELETE.
+ *      dbId: The database the key belongs to.
+ *      key: The key that was changed.
+ *      value: The new value or expiry of the key (NULL for OP_DELETE).
+ *      valueLen: The length of the value.
+ *
+ * Return:
+ *      The header for the record.
+ */
+static RecordHeader make_header(int op, int dbId, const char* key,
+        const char* value, size_t valueLen) {
+    RecordHeader header = {.op = op, .db = dbId, .reserved = 0};
+    header.keyLen = strlen(key);
+    header.valLen = value ? valueLen : 0;
+    return header;
+}
+
+/* Add a single record to the end of a batch.
+ *
+ * Params:
+ *      batch: The batch to add to.
+ *      op: OP_PUT, OP_EXPIRE or OP_DELETE.
+ *      dbId: The database the key belongs to.
+ *      key: The key that was changed.
+ *      value: The new value or expiry of the key (NULL for OP_DELETE).
+ *      valueLen: The length of the value.
+ *
+ * Return:
+ *      true if there was enough memory to add the record.
+ */
+static bool batch_add_record(LogBatch* batch, int op, int dbId,
+        const char* key, const char* value, size_t valueLen) {
+    RecordHeader header = make_header(op, dbId, key, value, valueLen);
+    size_t recordLen = sizeof(RecordHeader) + header.keyLen + 1 +
+            (value ? header.valLen + 1 : 0);
+
+    if (batch->len + recordLen > batch->capacity) {
+        size_t capacity = batch->capacity ? batch->capacity :
+                INIT_BATCH_CAPACITY;
+        while (batch->len + recordLen > capacity) {
+            capacity *= 2;
+        }
+        char* data = realloc(batch->data, capacity);
+        if (!data) {
+            return false;
+        }
+        batch->data = data;
+        batch->capacity = capacity;
+    }
+
+    char* pos = batch->data + batch->len;
+    memcpy(pos, &header, sizeof(RecordHeader));
+    pos += sizeof(RecordHeader);
+    memcpy(pos, key, header.keyLen + 1);
+    if (value) {
+        memcpy(pos + header.keyLen + 1, value, header.valLen);
+        pos[header.keyLen + 1 + header.valLen] = '\0';
+    }
+    batch->len += recordLen;
+
+    if (!batch->numRecords++) {
+        clock_gettime(CLOCK_MONOTONIC, &batch->firstAdded);
+    }
+    return true;
+}
+
+/* Write a single record to a file.
+ *
+ * Params:
+ *      file: The file to write to.
+ *      op: OP_PUT, OP_EXPIRE or OP_DELETE.
+ *      dbId: The database the key belongs to.
+ *      key: The key that was changed.
+ *      value: The new value or expiry of the key (NULL for OP_DELETE).
+ *      valueLen: The length of the value.
+ *
+ * Return:
+ *      true if the whole record was written.
+ */
+static bool write_record(FILE* file, int op, int dbId, const char* key,
+        const char* value, size_t valueLen) {
+    RecordHeader header = make_header(op, dbId, key, value, valueLen);
+
+    if (fwrite(&header, sizeof(RecordHeader), 1, file) != 1 ||
+            fwrite(key, 1, header.keyLen + 1, file) != header.keyLen + 1) {
+        return false;
+    }
+    if (value && (fwrite(value, 1, header.valLen, file) != header.valLen ||
+            fputc('\0', file) == EOF)) {
+        return false;
+    }
+    return true;
+}
+
+/* Apply the records in a log or snapshot file to the databases. The file is
+ * mapped into memory so keys and values are added straight from the file.
+ * Reading stops at the first incomplete or corrupt record, which can be left
+ * at the end of a log if the server was killed while writing it.
+ *
+ * Params:
+ *      journal: The journal whose databases should be updated.
+ *      path: The file to load.
+ *      magic: The magic string the file should start with.
+ *
+ * Return:
+ *      true if the file was loaded or doesn't exist.
+ */
+static bool load_file(Journal* journal, const char* path, const char* magic) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return errno == ENOENT;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return false;
+    }
+    if (st.st_size < MAGIC_LEN) {
+        // Nothing was ever written to the file
+        close(fd);
+        return st.st_size == 0;
+    }
+
+    char* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+    if (memcmp(data, magic, MAGIC_LEN)) {
+        munmap(data, st.st_size);
+        return false;
+    }
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    size_t pos = MAGIC_LEN;
+    size_t size = st.st_size;
+    RecordHeader header;
+    while (size - pos >= sizeof(RecordHeader)) {
+        memcpy(&header, data + pos, sizeof(RecordHeader));
+        size_t recordLen = sizeof(RecordHeader) + header.keyLen + 1;
+        bool hasValue = header.op != OP_DELETE;
+        if (hasValue) {
+            recordLen += header.valLen + 1;
+        }
+        if (recordLen > size - pos || header.db >= journal->numDbs) {
+            break;
+        }
+
+        const char* key = data + pos + sizeof(RecordHeader);
+        const char* value = key + header.keyLen + 1;
+        if (key[header.keyLen] != '\0' ||
+                (hasValue && value[header.valLen] != '\0')) {
+            break;
+        }
+
+        // No clients are connected yet so the shards don't need locking
+        Shard* shard = database_get_shard(journal->dbs[header.db], key);
+        if (header.op == OP_PUT) {
+            stringstore_add_len(shard->store, key, value, header.valLen);
+        } else if (header.op == OP_EXPIRE) {
+            stringstore_set_expiry(shard->store, key,
+                    strtoull(value, NULL, 10));
+        } else if (header.op == OP_DELETE) {
+            stringstore_delete(shard->store, key);
+        } else {
+            break;
+        }
+        pos += recordLen;
+    }
+
+    munmap(data, st.st_size);
+    return true;
+}
+
+/* Write a key/value pair to a snapshot as a PUT record, followed by an
+ * EXPIRE record if the key expires.
+ *
+ * Params:
+ *      file: The snapshot file to write to.
+ *      dbId: The database the key belongs to.
+ *      key: The key to write.
+ *      value: The value of the key (as returned by the StringStore).
+ *      expiresAt: When the key expires or 0 if it never does.
+ *
+ * Return:
+ *      true if the records were written.
+ */
+static bool write_pair(FILE* file, int dbId, const char* key,
+        const char* value, uint64_t expiresAt) {
+    if (!write_record(file, OP_PUT, dbId, key, value,
+            stringstore_value_len(value))) {
+        return false;
+    }
+    if (!expiresAt) {
+        return true;
+    }
+    char expiry[EXPIRY_BUFFER_SIZE];
+    snprintf(expiry, sizeof(expiry), "%" PRIu64, expiresAt);
+    return write_record(file, OP_EXPIRE, dbId, key, expiry, strlen(expiry));
+}
+
+/* Open a temporary file to write a snapshot to and write its magic string.
+ *
+ * Params:
+ *      tmpPath: The path of the temporary file.
+ *
+ * Return:
+ *      The open file or NULL if it couldn't be created.
+ */
+static FILE* open_snapshot(const char* tmpPath) {
+    FILE* file = fopen(tmpPath, "w");
+    if (!file) {
+        return NULL;
+    }
+    setvbuf(file, NULL, _IOFBF, SNAPSHOT_BUFFER_SIZE);
+    if (fwrite(SNAPSHOT_MAGIC, 1, MAGIC_LEN, file) != MAGIC_LEN) {
+        fclose(file);
+        unlink(tmpPath);
+        return NULL;
+    }
+    return file;
+}
+
+/* Close a snapshot opened with open_snapshot() and, once it is safely on
+ * disk, move it to its final path. If anything failed the temporary file is
+ * removed instead.
+ *
+ * Params:
+ *      file: The snapshot file.
+ *      ok: Whether the snapshot was written successfully.
+ *      tmpPath: The path of the temporary file.
+ *      path: The path to move the snapshot to.
+ *
+ * Return:
+ *      true if the snapshot was saved.
+ */
+static bool close_snapshot(FILE* file, bool ok, const char* tmpPath,
+        const char* path) {
+    ok = !fflush(file) && !fsync(fileno(file)) && ok;
+    ok = !fclose(file) && ok;
+    if (!ok || rename(tmpPath, path) < 0) {
+        unlink(tmpPath);
+        return false;
+    }
+    return true;
+}
+
+/* Save every key/value pair in the databases to a new snapshot. The snapshot
+ * is written to a temporary file which then replaces the previous snapshot
+ * once it is safely on disk. Each database's pairs are read from a snapshot
+ * of it a chunk at a time, so writes to the database carry on while the file
+ * is written.
+ *
+ * Params:
+ *      journal: The journal whose databases should be saved.
+ *
+ * Return:
+ *      true if the snapshot was saved.
+ */
+static bool write_snapshot(Journal* journal) {
+    FILE* file = open_snapshot(journal->tmpPath);
+    if (!file) {
+        return false;
+    }
+
+    bool ok = true;
+    SnapshotItem items[SNAPSHOT_CHUNK];
+    for (int dbId = 0; dbId < journal->numDbs && ok; dbId++) {
+        Database* db = journal->dbs[dbId];
+        ok = database_begin_snapshot(db);
+        int count;
+        while (ok && (count = database_read_snapshot(db, items,
+                SNAPSHOT_CHUNK)) > 0) {
+            for (int i = 0; i < count; i++) {
+                ok = ok && write_pair(file, dbId, items[i].key,
+                        items[i].value, items[i].expiresAt);
+                free(items[i].key);
+                stringstore_release(items[i].value);
+            }
+        }
+        ok = ok && count == 0;
+        database_end_snapshot(db);
+    }
+    return close_snapshot(file, ok, journal->tmpPath, journal->snapshotPath);
+}
+
+/* Start a new, empty log file. The journal's logLock must be held.
+ *
+ * Params:
+ *      journal: The journal to start a new log for.
+ *
+ * Return:
+ *      true if the new log was opened.
+ */
+static bool start_log(Journal* journal) {
+    journal->log = fopen(journal->logPath, "w");
+    if (!journal->log) {
+        return false;
+    }
+    fwrite(LOG_MAGIC, 1, MAGIC_LEN, journal->log);
+    fflush(journal->log);
+    journal->numLogged = 0;
+    return true;
+}
+
+Journal* journal_open(const char* path, Database** dbs, int numDbs) {
+    Journal* journal = malloc(sizeof(Journal));
+    journal->logPath = strdup(path);
+    journal->oldPath = add_suffix(path, OLD_SUFFIX);
+    journal->snapshotPath = add_suffix(path, SNAPSHOT_SUFFIX);
+    journal->tmpPath = add_suffix(path, TMP_SUFFIX);
+    journal->log = NULL;
+    journal->dbs = dbs;
+    journal->numDbs = numDbs;
+    journal->interval = 0;
+    pthread_mutex_init(&journal->logLock, NULL);
+    pthread_mutex_init(&journal->compactLock, NULL);
+
+    journal->groupCommit = false;
+    memset(&journal->pending, 0, sizeof(LogBatch));
+    journal->appendedSeq = 0;
+    journal->committedSeq = 0;
+    journal->numBatches = 0;
+    journal->numCommitted = 0;
+    journal->largestBatch = 0;
+    journal->totalLatencyUsecs = 0;
+    journal->maxLatencyUsecs = 0;
+    pthread_mutex_init(&journal->flushLock, NULL);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&journal->pendingCond, &attr);
+    pthread_cond_init(&journal->commitCond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    // If a compaction was interrupted the old log holds changes made before
+    // the ones in the current log, which aren't in the snapshot yet
+    if (!load_file(journal, journal->snapshotPath, SNAPSHOT_MAGIC) ||
+            !load_file(journal, journal->oldPath, LOG_MAGIC) ||
+            !load_file(journal, journal->logPath, LOG_MAGIC)) {
+        return NULL;
+    }
+
+    // Everything is in memory now so save it and start again with an empty
+    // log. The old logs are only removed once the snapshot is safe.
+    if (!write_snapshot(journal)) {
+        return NULL;
+    }
+    unlink(journal->oldPath);
+    if (!start_log(journal)) {
+        return NULL;
+    }
+    return journal;
+}
+
+/* Append a record to the log, or to the pending batch with group commit.
+ * The change has already been made, so if the record can't be added the
+ * server exits rather than acknowledging a change that would be lost.
+ *
+ * Params:
+ *      journal: The journal to append to.
+ *      op: OP_PUT, OP_EXPIRE or OP_DELETE.
+ *      dbId: The database the key belongs to.
+ *      key: The key that was changed.
+ *      value: The new value or expiry of the key (NULL for OP_DELETE).
+ *      valueLen: The length of the value.
+ *
+ * Return:
+ *      The ticket to pass to journal_wait_commit().
+ */
+static uint64_t log_record(Journal* journal, int op, int dbId,
+        const char* key, const char* value, size_t valueLen) {
+    uint64_t ticket = 0;
+    pthread_mutex_lock(&journal->logLock);
+    if (journal->groupCommit) {
+        if (batch_add_record(&journal->pending, op, dbId, key, value,
+                valueLen)) {
+            ticket = ++journal->appendedSeq;
+            pthread_cond_signal(&journal->pendingCond);
+        } else {
+            perror("Error adding to log batch");
+            exit(EXIT_FAILURE);
+        }
+    } else if (!journal->log ||
+            !write_record(journal->log, op, dbId, key, value, valueLen) ||
+            fflush(journal->log)) {
+        // A torn record would stop replay there and lose everything after it
+        perror("Error writing to log");
+        exit(EXIT_FAILURE);
+    }
+    journal->numLogged++;
+    pthread_mutex_unlock(&journal->logLock);
+    return ticket;
+}
+
+uint64_t journal_log_put(Journal* journal, int dbId, const char* key,
+        const char* value, size_t valueLen) {
+    return log_record(journal, OP_PUT, dbId, key, value, valueLen);
+}
+
+uint64_t journal_log_expire(Journal* journal, int dbId, const char* key,
+        uint64_t expiresAt) {
+    char expiry[EXPIRY_BUFFER_SIZE];
+    snprintf(expiry, sizeof(expiry), "%" PRIu64, expiresAt);
+    return log_record(journal, OP_EXPIRE, dbId, key, expiry, strlen(expiry));
+}
+
+uint64_t journal_log_delete(Journal* journal, int dbId, const char* key) {
+    return log_record(journal, OP_DELETE, dbId, key, NULL, 0);
+}
+
+void journal_wait_commit(Journal* journal, uint64_t ticket) {
+    if (!journal->groupCommit) {
+        return;
+    }
+
+    pthread_mutex_lock(&journal->logLock);
+    while (journal->committedSeq < ticket) {
+        pthread_cond_wait(&journal->commitCond, &journal->logLock);
+    }
+    pthread_mutex_unlock(&journal->logLock);
+}
+
+void journal_start_group_commit(Journal* journal, int windowUsecs,
+        int maxBatch) {
+    pthread_mutex_lock(&journal->logLock);
+    journal->windowUsecs = windowUsecs;
+    journal->maxBatch = maxBatch;
+    journal->groupCommit = true;
+    pthread_mutex_unlock(&journal->logLock);
+
+    pthread_t threadId;
+    pthread_create(&threadId, NULL, flush_thread, journal);
+    pthread_detach(threadId);
+}
+
+/* Write a whole buffer to a file descriptor.
+ *
+ * Params:
+ *      fd: The file descriptor to write to.
+ *      data: The data to write.
+ *      len: The number of bytes to write.
+ *
+ * Return:
+ *      true if everything was written.
+ */
+static bool write_all(int fd, const char* data, size_t len) {
+    while (len) {
+        ssize_t written = write(fd, data, len);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        len -= written;
+    }
+    return true;
+}
+
+/* Record the stats for a batch that has just been committed. The journal's
+ * logLock must be held.
+ *
+ * Params:
+ *      journal: The journal the batch was written to.
+ *      batch: The batch that was committed.
+ */
+static void record_commit(Journal* journal, LogBatch* batch) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    unsigned long latency = (now.tv_sec - batch->firstAdded.tv_sec) *
+            (NSECS_PER_SEC / NSECS_PER_USEC) +
+            (now.tv_nsec - batch->firstAdded.tv_nsec) / NSECS_PER_USEC;
+
+    journal->numBatches++;
+    journal->numCommitted += batch->numRecords;
+    journal->totalLatencyUsecs += latency;
+    if (batch->numRecords > journal->largestBatch) {
+        journal->largestBatch = batch->numRecords;
+    }
+    if (latency > journal->maxLatencyUsecs) {
+        journal->maxLatencyUsecs = latency;
+    }
+}
+
+void* flush_thread(void* arg) {
+    Journal* journal = (Journal*)arg;
+    LogBatch batch;
+    memset(&batch, 0, sizeof(LogBatch));
+
+    while (1) {
+        pthread_mutex_lock(&journal->logLock);
+        while (!journal->pending.numRecords) {
+            pthread_cond_wait(&journal->pendingCond, &journal->logLock);
+        }
+        pthread_mutex_unlock(&journal->logLock);
+
+        // Give other clients until the end of the window to join the batch
+        pthread_mutex_lock(&journal->flushLock);
+        pthread_mutex_lock(&journal->logLock);
+        struct timespec deadline = journal->pending.firstAdded;
+        deadline.tv_nsec += journal->windowUsecs * NSECS_PER_USEC;
+        deadline.tv_sec += deadline.tv_nsec / NSECS_PER_SEC;
+        deadline.tv_nsec %= NSECS_PER_SEC;
+        while (journal->pending.numRecords < journal->maxBatch &&
+                pthread_cond_timedwait(&journal->pendingCond,
+                &journal->logLock, &deadline) != ETIMEDOUT) {
+            // Keep waiting
+        }
+
+        // Swap buffers so clients can keep adding records while this batch
+        // is written
+        LogBatch full = journal->pending;
+        journal->pending = batch;
+        batch = full;
+        uint64_t lastSeq = journal->appendedSeq;
+        int fd = journal->log ? fileno(journal->log) : -1;
+        pthread_mutex_unlock(&journal->logLock);
+
+        if (!write_all(fd, batch.data, batch.len) || fdatasync(fd)) {
+            perror("Error committing log batch");
+            exit(EXIT_FAILURE);
+        }
+
+        pthread_mutex_lock(&journal->logLock);
+        journal->committedSeq = lastSeq;
+        record_commit(journal, &batch);
+        pthread_cond_broadcast(&journal->commitCond);
+        pthread_mutex_unlock(&journal->logLock);
+        pthread_mutex_unlock(&journal->flushLock);
+
+        batch.len = 0;
+        batch.numRecords = 0;
+    }
+}
+
+bool parse_sync_mode(const char* name, bool* groupCommit) {
+    if (!strcmp(name, SYNC_ASYNC_NAME)) {
+        *groupCommit = false;
+    } else if (!strcmp(name, SYNC_GROUP_NAME)) {
+        *groupCommit = true;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+void journal_print_stats(Journal* journal, FILE* out) {
+    pthread_mutex_lock(&journal->logLock);
+    if (journal->groupCommit) {
+        unsigned long batches = journal->numBatches;
+        fprintf(out, "Log batches:%lu\n", batches);
+        fprintf(out, "Log records committed:%lu\n", journal->numCommitted);
+        fprintf(out, "Log average batch size:%.1f\n", batches ?
+                (double)journal->numCommitted / batches : 0.0);
+        fprintf(out, "Log largest batch:%d\n", journal->largestBatch);
+        fprintf(out, "Log average commit latency (us):%lu\n", batches ?
+                journal->totalLatencyUsecs / batches : 0);
+        fprintf(out, "Log max commit latency (us):%lu\n",
+                journal->maxLatencyUsecs);
+    }
+    pthread_mutex_unlock(&journal->logLock);
+}
+
+bool journal_dump(const char* path, Database** dbs, int numDbs) {
+    char* tmpPath = add_suffix(path, TMP_SUFFIX);
+    FILE* file = open_snapshot(tmpPath);
+    if (!file) {
+        free(tmpPath);
+        return false;
+    }
+
+    bool ok = true;
+    for (int dbId = 0; dbId < numDbs && ok; dbId++) {
+        for (int i = 0; i < database_num_shards(dbs[dbId]) && ok; i++) {
+            StringStore* store = database_shard_at(dbs[dbId], i)->store;
+            const char* key;
+            const char* value;
+            size_t cursor = 0;
+            int more = 1;
+            while (ok && (more = stringstore_iterate(store, &cursor, &key,
+                    &value)) > 0) {
+                ok = write_pair(file, dbId, key, value,
+                        stringstore_get_expiry(store, key));
+            }
+            ok = ok && !more;
+        }
+    }
+    ok = close_snapshot(file, ok, tmpPath, path);
+    free(tmpPath);
+    return ok;
+}
+
+bool journal_compact(Journal* journal) {
+    pthread_mutex_lock(&journal->compactLock);
+
+    // Start a new log so that anything changed from now on is in the new
+    // log. The snapshot is taken after this so it contains everything in the
+    // old log and replaying the new log on top of it gives the latest data.
+    // If the last compaction failed the old log is still needed, so keep
+    // appending to the current log until a snapshot has been saved.
+    // Any records waiting to be committed will go to the new log.
+    bool ok = true;
+    if (access(journal->oldPath, F_OK) < 0) {
+        pthread_mutex_lock(&journal->flushLock);
+        pthread_mutex_lock(&journal->logLock);
+        fclose(journal->log);
+        ok = rename(journal->logPath, journal->oldPath) == 0;
+        if (ok && !start_log(journal)) {
+            rename(journal->oldPath, journal->logPath);
+            ok = false;
+        }
+        if (!ok) {
+            journal->log = fopen(journal->logPath, "a");
+        }
+        pthread_mutex_unlock(&journal->logLock);
+        pthread_mutex_unlock(&journal->flushLock);
+    }
+
+    if (ok && write_snapshot(journal)) {
+        unlink(journal->oldPath);
+    } else {
+        ok = false;
+        perror("Error compacting log");
+    }
+
+    pthread_mutex_unlock(&journal->compactLock);
+    return ok;
+}
+
+void journal_start_compactor(Journal* journal, int interval) {
+    journal->interval = interval;
+    pthread_t threadId;
+    pthread_create(&threadId, NULL, compact_thread, journal);
+    pthread_detach(threadId);
+}
+
+void* compact_thread(void* arg) {
+    Journal* journal = (Journal*)arg;
+
+    while (1) {
+        sleep(journal->interval);
+
+        pthread_mutex_lock(&journal->logLock);
+        unsigned long numLogged = journal->numLogged;
+        pthread_mutex_unlock(&journal->logLock);
+
+        if (numLogged) {
+            journal_compact(journal);
+        }
+    }
+}
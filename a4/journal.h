@@ -0,0 +1,207 @@
+/* FILE: journal.h
+ *
+ * AUTHOR: Tariq Soliman
+ * STUDENT NO.: 45287316
+ *
+ * DESCRIPTION:
+ * Makes the databases persistent with an append-only log of every successful
+ * change. The log is periodically compacted into a snapshot of the
+ * databases so it doesn't grow forever. On startup the snapshot is mapped
+ * into memory with mmap() and loaded straight into the databases before the
+ * log is replayed on top of it. If a change can't be logged the server
+ * exits, as it would otherwise be acknowledged and then lost on restart.
+ *
+ * Files used (for a log at "path"):
+ *      path            The log of changes since the last compaction.
+ *      path.old        The previous log while a compaction is in progress.
+ *      path.snapshot   The databases as of the last compaction.
+ *      path.tmp        A snapshot that is still being written.
+ */
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#define DEFAULT_COMPACT_INTERVAL 300
+#define MAX_COMPACT_INTERVAL 86400
+#define SYNC_ASYNC_NAME "async"
+#define SYNC_GROUP_NAME "group"
+#define DEFAULT_SYNC_WINDOW 1000
+#define MAX_SYNC_WINDOW 1000000
+#define DEFAULT_SYNC_BATCH 256
+#define MAX_SYNC_BATCH 65536
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "database.h"
+
+/* The log and snapshot files for a set of databases.*/
+typedef struct Journal Journal;
+
+/* Open the journal at the given path and load any saved data into the
+ * databases (which should be empty). The loaded data is then compacted into
+ * a new snapshot and an empty log is started. This must be called before any
+ * clients can access the databases.
+ *
+ * Params:
+ *      path: The path of the log file.
+ *      dbs: The databases to save. A database's position in this array is
+ *      used to identify it in the saved files so must not change.
+ *      numDbs: The number of databases.
+ *
+ * Return:
+ *      The opened journal or NULL if the saved data could not be loaded or
+ *      the log could not be opened.
+ */
+Journal* journal_open(const char* path, Database** dbs, int numDbs);
+
+/* Append a successful PUT to the log. The key's shard must still be locked
+ * for writing so that changes to a key are logged in the order they were
+ * made.
+ *
+ * Params:
+ *      journal: The journal to append to.
+ *      dbId: The position of the database in the array given to
+ *      journal_open().
+ *      key: The key that was PUT.
+ *      value: The new value of the key (which may contain '\0's).
+ *      valueLen: The length of the value.
+ *
+ * Return:
+ *      A ticket that can be passed to journal_wait_commit() once the shard
+ *      has been unlocked.
+ */
+uint64_t journal_log_put(Journal* journal, int dbId, const char* key,
+        const char* value, size_t valueLen);
+
+/* Append the expiry time of a key that was just PUT to the log. The key's
+ * shard must still be locked for writing.
+ *
+ * Params:
+ *      journal: The journal to append to.
+ *      dbId: The position of the database in the array given to
+ *      journal_open().
+ *      key: The key that expires.
+ *      expiresAt: The time the key expires in milliseconds since the Unix
+ *      epoch.
+ *
+ * Return:
+ *      A ticket that can be passed to journal_wait_commit() once the shard
+ *      has been unlocked. Waiting for it also waits for the PUT.
+ */
+uint64_t journal_log_expire(Journal* journal, int dbId, const char* key,
+        uint64_t expiresAt);
+
+/* Append a successful DELETE to the log. The key's shard must still be
+ * locked for writing.
+ *
+ * Params:
+ *      journal: The journal to append to.
+ *      dbId: The position of the database in the array given to
+ *      journal_open().
+ *      key: The key that was deleted.
+ *
+ * Return:
+ *      A ticket that can be passed to journal_wait_commit() once the shard
+ *      has been unlocked.
+ */
+uint64_t journal_log_delete(Journal* journal, int dbId, const char* key);
+
+/* Wait until a logged record has been synced to disk. This returns straight
+ * away unless group commit is enabled. If the record's batch can't be
+ * written or synced the server exits rather than returning.
+ *
+ * Params:
+ *      journal: The journal the record was logged in.
+ *      ticket: The ticket returned when the record was logged.
+ */
+void journal_wait_commit(Journal* journal, uint64_t ticket);
+
+/* Switch the journal to group commit. From now on logged records are
+ * gathered into batches that a flusher thread writes and syncs to disk
+ * together.
+ *
+ * Params:
+ *      journal: The journal to enable group commit for.
+ *      windowUsecs: How long to wait after the first record in a batch for
+ *      other records to join it.
+ *      maxBatch: The most records in a batch. A full batch is written without
+ *      waiting for the rest of the window.
+ */
+void journal_start_group_commit(Journal* journal, int windowUsecs,
+        int maxBatch);
+
+/* A thread that writes batches of records to the log and syncs them.
+ *
+ * Params:
+ *      arg: A pointer to the Journal to write to.
+ */
+void* flush_thread(void* arg);
+
+/* Get the sync mode with the given name.
+ *
+ * Params:
+ *      name: The name of the mode (SYNC_ASYNC_NAME or SYNC_GROUP_NAME).
+ *      groupCommit: Set to true if the mode uses group commit.
+ *
+ * Return:
+ *      true if the name was recognised.
+ */
+bool parse_sync_mode(const char* name, bool* groupCommit);
+
+/* Print the group commit stats for a journal (nothing is printed if group
+ * commit isn't enabled).
+ *
+ * Params:
+ *      journal: The journal to print the stats of.
+ *      out: Where to print the stats.
+ */
+void journal_print_stats(Journal* journal, FILE* out);
+
+/* Save every key/value pair in the databases to a file in the same format as
+ * a snapshot, so the file can later be used as a journal's snapshot. The
+ * file is written to path.tmp first and moved to path once it is on disk.
+ * The databases are not locked, so nothing else may change them while this
+ * runs (e.g. it is called in a child process after fork()).
+ *
+ * Params:
+ *      path: The file to save to.
+ *      dbs: The databases to save, in the same order as given to
+ *      journal_open().
+ *      numDbs: The number of databases.
+ *
+ * Return:
+ *      true if the file was saved.
+ */
+bool journal_dump(const char* path, Database** dbs, int numDbs);
+
+/* Compact the log into a new snapshot. Clients may keep using the databases
+ * while this happens, each shard is only locked briefly while a chunk of its
+ * keys is read.
+ *
+ * Params:
+ *      journal: The journal to compact.
+ *
+ * Return:
+ *      true if the new snapshot was saved.
+ */
+bool journal_compact(Journal* journal);
+
+/* Start a thread that compacts the journal every interval seconds if
+ * anything has been logged since the last compaction.
+ *
+ * Params:
+ *      journal: The journal to compact.
+ *      interval: The number of seconds between compactions.
+ */
+void journal_start_compactor(Journal* journal, int interval);
+
+/* A thread that periodically compacts a journal.
+ *
+ * Params:
+ *      arg: A pointer to the Journal to compact.
+ */
+void* compact_thread(void* arg);
+
+#endif
@@ -0,0 +1,218 @@
+/* FILE: lzblock.c
+ *
+ * AUTHOR: Tariq Soliman
+ * STUDENT NO.: 45287316
+ *
+ * DESCRIPTION:
+ * Compresses and decompresses LZ4 blocks. See lzblock.h.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "lzblock.h"
+
+#define MIN_MATCH 4
+#define LAST_LITERALS 5         // A block always ends with this many literals
+#define MATCH_LIMIT 12          // The last match starts at least this far back
+#define MAX_OFFSET 65535
+#define HASH_BITS 12
+#define HASH_MULTIPLIER 2654435761U
+#define SKIP_SHIFT 6            // Search less often the longer since a match
+#define LENGTH_MASK 15          // The largest length that fits in a token
+#define LENGTH_EXTENSION 255    // An extra length byte that is followed by more
+#define TOKEN_SHIFT 4
+#define BITS_PER_BYTE 8
+
+/* Read 4 bytes from anywhere in memory.
+ *
+ * Params:
+ *      p: Where to read.
+ *
+ * Return:
+ *      The bytes as a single word.
+ */
+static uint32_t read32(const char* p) {
+    uint32_t word;
+    memcpy(&word, p, sizeof(word));
+    return word;
+}
+
+/* Hash 4 bytes to a slot in the match table.
+ *
+ * Params:
+ *      word: The bytes to hash.
+ *
+ * Return:
+ *      The slot.
+ */
+static uint32_t hash4(uint32_t word) {
+    return (word * HASH_MULTIPLIER) >> (32 - HASH_BITS);
+}
+
+/* Write one sequence: a token, the literals and, unless it is the last
+ * sequence, the match.
+ *
+ * Params:
+ *      op: Where to write the sequence.
+ *      opEnd: The end of the output.
+ *      literals: The literal bytes.
+ *      litLen: The number of literal bytes.
+ *      offset: How far back the match starts, or 0 for the last sequence.
+ *      matchLen: The length of the match less MIN_MATCH.
+ *
+ * Return:
+ *      The end of the sequence or NULL if it didn't fit.
+ */
+static char* write_sequence(char* op, char* opEnd, const char* literals,
+        size_t litLen, size_t offset, size_t matchLen) {
+    // Each extra length byte holds 255 of the length, so this is an upper
+    // bound on the size of the sequence
+    size_t needed = 1 + litLen / LENGTH_EXTENSION + 1 + litLen + 2 +
+            matchLen / LENGTH_EXTENSION + 1;
+    if ((size_t)(opEnd - op) < needed) {
+        return NULL;
+    }
+
+    unsigned char* token = (unsigned char*)op++;
+    *token = (litLen < LENGTH_MASK ? litLen : LENGTH_MASK) << TOKEN_SHIFT;
+    if (litLen >= LENGTH_MASK) {
+        size_t rest = litLen - LENGTH_MASK;
+        for (; rest >= LENGTH_EXTENSION; rest -= LENGTH_EXTENSION) {
+            *op++ = (char)LENGTH_EXTENSION;
+        }
+        *op++ = (char)rest;
+    }
+    memcpy(op, literals, litLen);
+    op += litLen;
+    if (!offset) {
+        return op;
+    }
+
+    *op++ = (char)(offset & 0xFF);
+    *op++ = (char)(offset >> BITS_PER_BYTE);
+    *token |= matchLen < LENGTH_MASK ? matchLen : LENGTH_MASK;
+    if (matchLen >= LENGTH_MASK) {
+        size_t rest = matchLen - LENGTH_MASK;
+        for (; rest >= LENGTH_EXTENSION; rest -= LENGTH_EXTENSION) {
+            *op++ = (char)LENGTH_EXTENSION;
+        }
+        *op++ = (char)rest;
+    }
+    return op;
+}
+
+size_t lz_compress(const char* src, size_t srcLen, char* dst,
+        size_t dstCap) {
+    const char* ip = src;
+    const char* anchor = src;       // The start of the pending literals
+    const char* end = src + srcLen;
+    char* op = dst;
+    char* opEnd = dst + dstCap;
+    uint32_t table[1 << HASH_BITS] = {0};
+
+    if (srcLen > MATCH_LIMIT) {
+        const char* matchLimit = end - MATCH_LIMIT;
+        const char* extendLimit = end - LAST_LITERALS;
+        while (ip < matchLimit) {
+            uint32_t word = read32(ip);
+            uint32_t slot = hash4(word);
+            const char* ref = src + table[slot];
+            table[slot] = ip - src;
+            if (ref >= ip || ip - ref > MAX_OFFSET || read32(ref) != word) {
+                ip += 1 + ((ip - anchor) >> SKIP_SHIFT);
+                continue;
+            }
+
+            const char* matchEnd = ip + MIN_MATCH;
+            ref += MIN_MATCH;
+            while (matchEnd < extendLimit && *matchEnd == *ref) {
+                matchEnd++;
+                ref++;
+            }
+            op = write_sequence(op, opEnd, anchor, ip - anchor,
+                    matchEnd - ref, matchEnd - ip - MIN_MATCH);
+            if (!op) {
+                return 0;
+            }
+            ip = anchor = matchEnd;
+        }
+    }
+
+    op = write_sequence(op, opEnd, anchor, end - anchor, 0, 0);
+    return op ? (size_t)(op - dst) : 0;
+}
+
+/* Read the extra bytes of a length that didn't fit in a token.
+ *
+ * Params:
+ *      ip: The position in the block, which is moved past the bytes.
+ *      end: The end of the block.
+ *      length: The length to add to.
+ *
+ * Return:
+ *      Whether the block held the whole length.
+ */
+static bool read_length(const unsigned char** ip, const unsigned char* end,
+        size_t* length) {
+    unsigned char byte;
+    do {
+        if (*ip >= end) {
+            return false;
+        }
+        byte = *(*ip)++;
+        *length += byte;
+    } while (byte == LENGTH_EXTENSION);
+    return true;
+}
+
+bool lz_decompress(const char* src, size_t srcLen, char* dst,
+        size_t dstLen) {
+    const unsigned char* ip = (const unsigned char*)src;
+    const unsigned char* end = ip + srcLen;
+    char* op = dst;
+    char* opEnd = dst + dstLen;
+
+    while (ip < end) {
+        unsigned char token = *ip++;
+        size_t litLen = token >> TOKEN_SHIFT;
+        if (litLen == LENGTH_MASK && !read_length(&ip, end, &litLen)) {
+            return false;
+        }
+        if (litLen > (size_t)(end - ip) || litLen > (size_t)(opEnd - op)) {
+            return false;
+        }
+        memcpy(op, ip, litLen);
+        op += litLen;
+        ip += litLen;
+        if (ip == end) {
+            break;
+        }
+
+        if (end - ip < 2) {
+            return false;
+        }
+        size_t offset = ip[0] | (size_t)ip[1] << BITS_PER_BYTE;
+        ip += 2;
+        size_t matchLen = token & LENGTH_MASK;
+        if (matchLen == LENGTH_MASK && !read_length(&ip, end, &matchLen)) {
+            return false;
+        }
+        matchLen += MIN_MATCH;
+        if (!offset || offset > (size_t)(op - dst) ||
+                matchLen > (size_t)(opEnd - op)) {
+            return false;
+        }
+
+        // A match can overlap the bytes it writes, repeating a short pattern
+        const char* match = op - offset;
+        if (offset >= matchLen) {
+            memcpy(op, match, matchLen);
+        } else {
+            for (size_t i = 0; i < matchLen; i++) {
+                op[i] = match[i];
+            }
+        }
+        op += matchLen;
+    }
+    return op == opEnd;
+}
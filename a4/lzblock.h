@@ -0,0 +1,51 @@
+/* FILE: lzblock.h
+ *
+ * AUTHOR: Tariq Soliman
+ * STUDENT NO.: 45287316
+ *
+ * DESCRIPTION:
+ * A small, fast compressor for the LZ4 block format. Data is coded as a run
+ * of sequences, each some literal bytes followed by a copy of at least 4
+ * bytes from up to 64KB earlier in the output. Matches are found greedily
+ * with a hash table of recent 4 byte strings, which trades some ratio for
+ * speed, and the output can be read by any LZ4 block decoder.
+ *
+ * A block does not record its own length when decoded, so this must be kept
+ * alongside it.
+ */
+
+#ifndef LZBLOCK_H
+#define LZBLOCK_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/* Compress some data into an LZ4 block.
+ *
+ * Params:
+ *      src: The data to compress.
+ *      srcLen: The length of the data.
+ *      dst: Where to write the block.
+ *      dstCap: The size of dst. Giving less than srcLen room makes this
+ *      give up as soon as the block can't save enough to be worth it.
+ *
+ * Return:
+ *      The length of the block or 0 if it didn't fit in dst.
+ */
+size_t lz_compress(const char* src, size_t srcLen, char* dst, size_t dstCap);
+
+/* Decompress an LZ4 block. Every offset and length in the block is checked,
+ * so corrupt data can't make this read or write out of bounds.
+ *
+ * Params:
+ *      src: The block.
+ *      srcLen: The length of the block.
+ *      dst: Where to write the data.
+ *      dstLen: The length of the data the block decodes to.
+ *
+ * Return:
+ *      Whether the block was valid and decoded to exactly dstLen bytes.
+ */
+bool lz_decompress(const char* src, size_t srcLen, char* dst, size_t dstLen);
+
+#endif
@@ -0,0 +1,172 @@
+/* FILE: pipeline.c
+ *
+ * AUTHOR: Tariq Soliman
+ * STUDENT NO.: 45287316
+ *
+ * DESCRIPTION:
+ * Serves a blocking connection, batching the responses to pipelined
+ * requests. See pipeline.h.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "pipeline.h"
+
+#define INIT_BUFFER_SIZE 4096
+#define MAX_BATCH_RESPONSES 1024        // Responses per call (IOV_MAX)
+#define MAX_BATCH_BYTES (1024 * 1024)   // Response bytes held before sending
+
+// Responses waiting to be sent. The unsent part of each is in parts, which
+// moves along as it is sent, so where each was allocated is kept as well.
+typedef struct Batch {
+    char* responses[MAX_BATCH_RESPONSES];
+    struct iovec parts[MAX_BATCH_RESPONSES];
+    int numResponses;
+    size_t len;
+} Batch;
+
+/* Send every response in a batch, then free them.
+ *
+ * Params:
+ *      fd: The socket to send to.
+ *      batch: The responses.
+ *
+ * Return:
+ *      false if the socket failed.
+ */
+static bool send_batch(int fd, Batch* batch) {
+    struct iovec* next = batch->parts;
+    int numLeft = batch->numResponses;
+    bool sent = true;
+    while (numLeft && sent) {
+        struct msghdr msg = {.msg_iov = next, .msg_iovlen = numLeft};
+        ssize_t got = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (got < 0) {
+            sent = errno == EINTR;
+            continue;
+        }
+        // Skip the responses sent in full and move into a partly sent one
+        while (numLeft && (size_t)got >= next->iov_len) {
+            got -= next->iov_len;
+            next++;
+            numLeft--;
+        }
+        if (numLeft) {
+            next->iov_base = (char*)next->iov_base + got;
+            next->iov_len -= got;
+        }
+    }
+
+    for (int i = 0; i < batch->numResponses; i++) {
+        free(batch->responses[i]);
+    }
+    batch->numResponses = 0;
+    batch->len = 0;
+    return sent;
+}
+
+/* Handle a single request, adding its response to a batch. The batch is
+ * sent first if it is full.
+ *
+ * Params:
+ *      fd: The socket the request came from.
+ *      request: The parsed request.
+ *      handleRequest: The function to handle the request with.
+ *      arg: The argument to pass to the request handler.
+ *      batch: The responses waiting to be sent.
+ *
+ * Return:
+ *      false if the connection should be closed once the batch is sent.
+ */
+static bool handle_request(int fd, const HttpRequest* request,
+        RequestHandler handleRequest, void* arg, Batch* batch) {
+    if ((batch->numResponses == MAX_BATCH_RESPONSES ||
+            batch->len >= MAX_BATCH_BYTES) && !send_batch(fd, batch)) {
+        return false;
+    }
+    char* response = NULL;
+    size_t responseLen = 0;
+    FILE* to = open_memstream(&response, &responseLen);
+    bool handled = to && handleRequest(request, to, arg);
+    if (to) {
+        fclose(to);
+    }
+    if (!response) {
+        return false;
+    }
+    batch->responses[batch->numResponses] = response;
+    batch->parts[batch->numResponses].iov_base = response;
+    batch->parts[batch->numResponses].iov_len = responseLen;
+    batch->numResponses++;
+    batch->len += responseLen;
+    return handled;
+}
+
+void pipeline_serve(int fd, RequestHandler handleRequest, void* arg) {
+    char* in = NULL;
+    size_t inLen = 0;
+    size_t inCap = 0;
+    HttpParser parser;
+    http_parser_init(&parser);
+    Batch batch = {.numResponses = 0, .len = 0};
+    bool open = true;
+    // Responses are already sent together, so holding back a batch until
+    // the previous one is acknowledged would only delay it
+    int noDelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+    while (open) {
+        // The last byte of the buffer is kept free for the parser
+        if (inLen + 1 >= inCap) {
+            size_t cap = inCap ? inCap * 2 : INIT_BUFFER_SIZE;
+            char* grown = realloc(in, cap);
+            if (!grown) {
+                break;
+            }
+            in = grown;
+            inCap = cap;
+        }
+        // Only block for more requests once every response has been sent
+        ssize_t got = recv(fd, in + inLen, inCap - inLen - 1,
+                batch.numResponses ? MSG_DONTWAIT : 0);
+        if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            open = send_batch(fd, &batch);
+            continue;
+        }
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            break;
+        }
+        inLen += got;
+
+        size_t used = 0;
+        while (open) {
+            HttpRequest request;
+            size_t reqLen;
+            ParseResult result = http_parse_request(&parser, in + used,
+                    inLen - used, &request, &reqLen);
+            if (result == PARSE_INVALID) {
+                open = false;
+                break;
+            }
+            if (result == PARSE_INCOMPLETE) {
+                break;
+            }
+            open = handle_request(fd, &request, handleRequest, arg, &batch);
+            http_request_done(&parser);
+            used += reqLen;
+        }
+        memmove(in, in + used, inLen - used);
+        inLen -= used;
+    }
+    // Whatever the client managed to send is still answered
+    send_batch(fd, &batch);
+    free(in);
+}
@@ -0,0 +1,31 @@
+/* FILE: pipeline.h
+ *
+ * AUTHOR: Tariq Soliman
+ * STUDENT NO.: 45287316
+ *
+ * DESCRIPTION:
+ * Serves a blocking connection on the calling thread, handling pipelined
+ * requests in batches. Bytes read from the socket are kept in a buffer and
+ * every complete request in it is handled in order, each response being
+ * written to a stream in memory. The responses are only sent once no more
+ * of the client's requests are waiting to be read, all together with a
+ * single call, so a client that pipelines its requests doesn't cost a system
+ * call for each response.
+ */
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "eventloop.h"
+
+/* Serve a connected socket until the client closes it, a request can't be
+ * handled or the socket fails. The socket is not closed.
+ *
+ * Params:
+ *      fd: The socket.
+ *      handleRequest: The function to handle each request with.
+ *      arg: The argument to pass to the request handler.
+ */
+void pipeline_serve(int fd, RequestHandler handleRequest, void* arg);
+
+#endif
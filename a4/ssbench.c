@@ -0,0 +1,359 @@
+/* FILE: ssbench.c
+ *
+ * AUTHOR: Tariq Soliman
+ * STUDENT NO.: 45287316
+ *
+ * DESCRIPTION:
+ * A microbenchmark for libstringstore.so. See ssbench.h.
+ */
+
+#include "ssbench.h"
+
+/* The percentiles reported for each run, in thousandths.*/
+const int percentiles[NUM_PERCENTILES] = {500, 900, 990, 999, 1000};
+
+/* The names of the reported percentiles.*/
+const char* percentileNames[NUM_PERCENTILES] = {
+        "p50", "p90", "p99", "p999", "max"};
+
+struct BenchOpts {
+    int numKeys;
+    int keySize;
+    int valueSize;
+    KeyDist dist;
+    double theta;
+    int reads;
+    int deletes;
+    int maxThreads;
+    int numOps;
+    int seed;
+    bool json;
+};
+
+struct BenchRun {
+    StringStore* store;
+    pthread_rwlock_t lock;
+    pthread_barrier_t start;
+    char** keys;
+    const char* value;
+    BenchOpts* opts;
+    double zetaN;       // Constants of the Zipfian generator
+    double alpha;
+    double eta;
+};
+
+struct WorkerArgs {
+    BenchRun* run;
+    int numOps;
+    uint64_t rngState;
+    uint64_t* latencies;
+};
+
+struct RunResult {
+    int numThreads;
+    int numOps;
+    double loadSecs;
+    double runSecs;
+    uint64_t latencies[NUM_PERCENTILES];
+    long peakRssKb;
+};
+
+int main(int argc, char* argv[]) {
+    BenchOpts opts = {.numKeys = DEFAULT_KEYS, .keySize = DEFAULT_KEY_SIZE,
+            .valueSize = DEFAULT_VALUE_SIZE, .dist = DIST_UNIFORM,
+            .theta = DEFAULT_THETA, .reads = DEFAULT_READS,
+            .deletes = DEFAULT_DELETES, .maxThreads = DEFAULT_THREADS,
+            .numOps = DEFAULT_OPS, .seed = DEFAULT_SEED, .json = false};
+    if (!parse_options(argc, argv, &opts)) {
+        fprintf(stderr, USAGE_MSG);
+        return USAGE_EXIT_CODE;
+    }
+
+    char** keys = malloc(sizeof(char*) * opts.numKeys);
+    char* value = malloc(opts.valueSize + 1);
+    if (!keys || !value) {
+        fprintf(stderr, ALLOC_MSG);
+        return ALLOC_EXIT_CODE;
+    }
+    for (int i = 0; i < opts.numKeys; i++) {
+        keys[i] = malloc(opts.keySize + 1);
+        if (!keys[i]) {
+            fprintf(stderr, ALLOC_MSG);
+            return ALLOC_EXIT_CODE;
+        }
+        make_key(keys[i], i, opts.keySize);
+    }
+    memset(value, 'v', opts.valueSize);
+    value[opts.valueSize] = '\0';
+
+    // Double the threads each run, finishing with the maximum
+    for (int numThreads = 1; ; numThreads *= 2) {
+        if (numThreads > opts.maxThreads) {
+            numThreads = opts.maxThreads;
+        }
+        RunResult result;
+        if (!run_bench(&opts, keys, value, numThreads, &result)) {
+            fprintf(stderr, ALLOC_MSG);
+            return ALLOC_EXIT_CODE;
+        }
+        print_result(&opts, &result);
+        if (numThreads == opts.maxThreads) {
+            break;
+        }
+    }
+
+    for (int i = 0; i < opts.numKeys; i++) {
+        free(keys[i]);
+    }
+    free(keys);
+    free(value);
+    return 0;
+}
+
+bool parse_options(int argc, char* argv[], BenchOpts* opts) {
+    for (int i = 1; i < argc; i++) {
+        // Every option takes a value
+        if (strncmp(argv[i], OPT_PREFIX, strlen(OPT_PREFIX)) ||
+                i + 1 >= argc) {
+            return false;
+        }
+        char* opt = argv[i];
+        char* value = argv[++i];
+
+        bool valid = true;
+        if (!strcmp(opt, KEYS_OPT)) {
+            valid = parse_int_opt(value, 1, MAX_KEYS, &opts->numKeys);
+        } else if (!strcmp(opt, KEY_SIZE_OPT)) {
+            valid = parse_int_opt(value, MIN_KEY_SIZE, MAX_SIZE,
+                    &opts->keySize);
+        } else if (!strcmp(opt, VALUE_SIZE_OPT)) {
+            valid = parse_int_opt(value, 0, MAX_SIZE, &opts->valueSize);
+        } else if (!strcmp(opt, DIST_OPT)) {
+            valid = !strcmp(value, DIST_UNIFORM_NAME) ||
+                    !strcmp(value, DIST_ZIPF_NAME);
+            opts->dist = strcmp(value, DIST_ZIPF_NAME) ?
+                    DIST_UNIFORM : DIST_ZIPF;
+        } else if (!strcmp(opt, THETA_OPT)) {
+            // The generator needs 0 < theta < 1
+            char* end;
+            errno = 0;
+            opts->theta = strtod(value, &end);
+            valid = *value && !*end && !errno &&
+                    opts->theta > 0 && opts->theta < 1;
+        } else if (!strcmp(opt, READS_OPT)) {
+            valid = parse_int_opt(value, 0, MAX_PERCENT, &opts->reads);
+        } else if (!strcmp(opt, DELETES_OPT)) {
+            valid = parse_int_opt(value, 0, MAX_PERCENT, &opts->deletes);
+        } else if (!strcmp(opt, THREADS_OPT)) {
+            valid = parse_int_opt(value, 1, MAX_THREADS, &opts->maxThreads);
+        } else if (!strcmp(opt, OPS_OPT)) {
+            valid = parse_int_opt(value, 1, MAX_OPS, &opts->numOps);
+        } else if (!strcmp(opt, SEED_OPT)) {
+            valid = parse_int_opt(value, 1, INT32_MAX, &opts->seed);
+        } else if (!strcmp(opt, FORMAT_OPT)) {
+            valid = !strcmp(value, FORMAT_TEXT_NAME) ||
+                    !strcmp(value, FORMAT_JSON_NAME);
+            opts->json = !strcmp(value, FORMAT_JSON_NAME);
+        } else {
+            valid = false;
+        }
+        if (!valid) {
+            return false;
+        }
+    }
+    return opts->reads + opts->deletes <= MAX_PERCENT;
+}
+
+bool parse_int_opt(char* arg, int min, int max, int* value) {
+    if (!is_int(arg)) {
+        return false;
+    }
+
+    errno = 0;
+    long num = strtol(arg, NULL, 10);
+    if (errno == ERANGE || num < min || num > max) {
+        return false;
+    }
+    *value = (int)num;
+    return true;
+}
+
+void make_key(char* buf, int index, int keySize) {
+    sprintf(buf, "k%0*d", keySize - 1, index);
+}
+
+double zeta(int n, double theta) {
+    double sum = 0;
+    for (int i = 1; i <= n; i++) {
+        sum += 1 / pow(i, theta);
+    }
+    return sum;
+}
+
+uint64_t next_random(uint64_t* state) {
+    // xorshift64*
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+int choose_key(BenchRun* run, uint64_t* state) {
+    int n = run->opts->numKeys;
+    if (run->opts->dist == DIST_UNIFORM) {
+        return next_random(state) % n;
+    }
+
+    double u = (double)(next_random(state) >> 11) / (1ULL << 53);
+    double uz = u * run->zetaN;
+    if (uz < 1) {
+        return 0;
+    }
+    if (uz < 1 + pow(0.5, run->opts->theta)) {
+        return n > 1 ? 1 : 0;
+    }
+    int index = (int)(n * pow(run->eta * u - run->eta + 1, run->alpha));
+    return index < n ? index : n - 1;
+}
+
+uint64_t now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * NSECS_PER_SEC + now.tv_nsec;
+}
+
+void* worker_thread(void* arg) {
+    WorkerArgs* args = (WorkerArgs*)arg;
+    BenchRun* run = args->run;
+    int reads = run->opts->reads;
+    int deletes = run->opts->deletes;
+
+    pthread_barrier_wait(&run->start);
+    for (int i = 0; i < args->numOps; i++) {
+        int op = next_random(&args->rngState) % MAX_PERCENT;
+        const char* key = run->keys[choose_key(run, &args->rngState)];
+
+        uint64_t start = now_ns();
+        if (op < reads) {
+            pthread_rwlock_rdlock(&run->lock);
+            stringstore_retrieve(run->store, key);
+        } else if (op < reads + deletes) {
+            pthread_rwlock_wrlock(&run->lock);
+            stringstore_delete(run->store, key);
+        } else {
+            pthread_rwlock_wrlock(&run->lock);
+            stringstore_add(run->store, key, run->value);
+        }
+        pthread_rwlock_unlock(&run->lock);
+        args->latencies[i] = now_ns() - start;
+    }
+    return NULL;
+}
+
+bool run_bench(BenchOpts* opts, char** keys, const char* value,
+        int numThreads, RunResult* result) {
+    BenchRun run = {.keys = keys, .value = value, .opts = opts};
+    run.store = stringstore_init();
+    uint64_t* latencies = malloc(sizeof(uint64_t) * opts->numOps);
+    WorkerArgs* workers = malloc(sizeof(WorkerArgs) * numThreads);
+    pthread_t* threadIds = malloc(sizeof(pthread_t) * numThreads);
+    if (!run.store || !latencies || !workers || !threadIds) {
+        return false;
+    }
+    if (opts->dist == DIST_ZIPF) {
+        run.zetaN = zeta(opts->numKeys, opts->theta);
+        run.alpha = 1 / (1 - opts->theta);
+        run.eta = (1 - pow(2.0 / opts->numKeys, 1 - opts->theta)) /
+                (1 - zeta(2, opts->theta) / run.zetaN);
+    }
+
+    uint64_t loadStart = now_ns();
+    for (int i = 0; i < opts->numKeys; i++) {
+        if (!stringstore_add(run.store, keys[i], value)) {
+            return false;
+        }
+    }
+    result->loadSecs = (double)(now_ns() - loadStart) / NSECS_PER_SEC;
+
+    pthread_rwlock_init(&run.lock, NULL);
+    pthread_barrier_init(&run.start, NULL, numThreads + 1);
+    int opsGiven = 0;
+    for (int i = 0; i < numThreads; i++) {
+        workers[i].run = &run;
+        workers[i].numOps = opts->numOps / numThreads +
+                (i < opts->numOps % numThreads);
+        workers[i].rngState = (uint64_t)opts->seed * (i + 1) *
+                0x9E3779B97F4A7C15ULL;
+        workers[i].latencies = latencies + opsGiven;
+        opsGiven += workers[i].numOps;
+        pthread_create(&threadIds[i], NULL, worker_thread, &workers[i]);
+    }
+    pthread_barrier_wait(&run.start);
+    uint64_t runStart = now_ns();
+    for (int i = 0; i < numThreads; i++) {
+        pthread_join(threadIds[i], NULL);
+    }
+    result->runSecs = (double)(now_ns() - runStart) / NSECS_PER_SEC;
+
+    qsort(latencies, opts->numOps, sizeof(uint64_t), compare_latency);
+    for (int i = 0; i < NUM_PERCENTILES; i++) {
+        long index = (long)opts->numOps * percentiles[i] / 1000;
+        result->latencies[i] = latencies[index < opts->numOps ? index :
+                opts->numOps - 1];
+    }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    result->peakRssKb = usage.ru_maxrss;
+    result->numThreads = numThreads;
+    result->numOps = opts->numOps;
+
+    pthread_barrier_destroy(&run.start);
+    pthread_rwlock_destroy(&run.lock);
+    stringstore_free(run.store);
+    free(latencies);
+    free(workers);
+    free(threadIds);
+    return true;
+}
+
+int compare_latency(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+void print_result(BenchOpts* opts, RunResult* result) {
+    double opsPerSec = result->numOps / result->runSecs;
+    const char* dist = opts->dist == DIST_ZIPF ? DIST_ZIPF_NAME :
+            DIST_UNIFORM_NAME;
+    if (!opts->json) {
+        printf("threads:%d keys:%d dist:%s reads:%d%% deletes:%d%% "
+                "ops:%d\n", result->numThreads, opts->numKeys, dist,
+                opts->reads, opts->deletes, result->numOps);
+        printf("  load:%.3fs run:%.3fs ops/sec:%.0f peak RSS:%ldKB\n",
+                result->loadSecs, result->runSecs, opsPerSec,
+                result->peakRssKb);
+        printf("  latency (ns)");
+        for (int i = 0; i < NUM_PERCENTILES; i++) {
+            printf(" %s:%" PRIu64, percentileNames[i],
+                    result->latencies[i]);
+        }
+        printf("\n");
+        return;
+    }
+
+    printf("{\"threads\":%d,\"keys\":%d,\"key_size\":%d,\"value_size\":%d,"
+            "\"dist\":\"%s\",\"theta\":%g,\"reads\":%d,\"deletes\":%d,"
+            "\"ops\":%d,\"load_secs\":%.6f,\"run_secs\":%.6f,"
+            "\"ops_per_sec\":%.0f", result->numThreads, opts->numKeys,
+            opts->keySize, opts->valueSize, dist, opts->theta, opts->reads,
+            opts->deletes, result->numOps, result->loadSecs,
+            result->runSecs, opsPerSec);
+    for (int i = 0; i < NUM_PERCENTILES; i++) {
+        printf(",\"%s_ns\":%" PRIu64, percentileNames[i],
+                result->latencies[i]);
+    }
+    printf(",\"peak_rss_kb\":%ld}\n", result->peakRssKb);
+}
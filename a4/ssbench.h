@@ -0,0 +1,212 @@
+/* FILE: ssbench.h
+ *
+ * AUTHOR: Tariq Soliman
+ * STUDENT NO.: 45287316
+ *
+ * DESCRIPTION:
+ * A microbenchmark for libstringstore.so. A store is filled with a set of
+ * keys and then a mix of stringstore_retrieve(), stringstore_add() and
+ * stringstore_delete() calls are made on it from 1, 2, 4, ... up to the
+ * requested number of threads, which share the store behind a rwlock. Each
+ * run reports its throughput, per operation latency percentiles and the peak
+ * RSS of the process, either as text or as one JSON object per line.
+ */
+
+#ifndef SSBENCH_H
+#define SSBENCH_H
+
+#define OPT_PREFIX "--"
+#define KEYS_OPT "--keys"
+#define KEY_SIZE_OPT "--key-size"
+#define VALUE_SIZE_OPT "--value-size"
+#define DIST_OPT "--dist"
+#define DIST_UNIFORM_NAME "uniform"
+#define DIST_ZIPF_NAME "zipf"
+#define THETA_OPT "--theta"
+#define READS_OPT "--reads"
+#define DELETES_OPT "--deletes"
+#define THREADS_OPT "--threads"
+#define OPS_OPT "--ops"
+#define SEED_OPT "--seed"
+#define FORMAT_OPT "--format"
+#define FORMAT_TEXT_NAME "text"
+#define FORMAT_JSON_NAME "json"
+#define USAGE_MSG "Usage: ssbench [--keys n] [--key-size bytes] " \
+        "[--value-size bytes] [--dist uniform|zipf] [--theta t] " \
+        "[--reads percent] [--deletes percent] [--threads n] [--ops n] " \
+        "[--seed n] [--format text|json]\n"
+#define USAGE_EXIT_CODE 1
+#define ALLOC_MSG "ssbench: unable to set up the benchmark\n"
+#define ALLOC_EXIT_CODE 2
+#define DEFAULT_KEYS 100000
+#define DEFAULT_KEY_SIZE 16
+#define DEFAULT_VALUE_SIZE 64
+#define DEFAULT_THETA 0.99      // The skew used by YCSB
+#define DEFAULT_READS 90
+#define DEFAULT_DELETES 0
+#define DEFAULT_THREADS 1
+#define DEFAULT_OPS 1000000
+#define DEFAULT_SEED 1
+#define MAX_KEYS 100000000
+#define MIN_KEY_SIZE 12         // Fits "k" and the index of any key
+#define MAX_SIZE 1048576
+#define MAX_THREADS 256
+#define MAX_OPS 1000000000
+#define MAX_PERCENT 100
+#define NSECS_PER_SEC 1000000000
+#define NUM_PERCENTILES 5
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <stringstore.h>
+#include "utilities.h"
+
+/* The distribution keys are chosen from.*/
+typedef enum KeyDist {
+    DIST_UNIFORM,
+    DIST_ZIPF
+} KeyDist;
+
+/* A struct to store the settings given on the commandline.*/
+typedef struct BenchOpts BenchOpts;
+
+/* A struct to store the state shared by the threads of a run.*/
+typedef struct BenchRun BenchRun;
+
+/* A struct to store the arguments and results of a single thread.*/
+typedef struct WorkerArgs WorkerArgs;
+
+/* A struct to store the summary of a run.*/
+typedef struct RunResult RunResult;
+
+/* Removes any "--option value" pairs from the commandline arguments and
+ * records them in opts. Options that are not given keep their default value.
+ *
+ * Params:
+ *      argc: The number of commandline arguments.
+ *      argv: An array of the commandline arguments.
+ *      opts: The BenchOpts struct to save the options to.
+ *
+ * Return:
+ *      true if every argument was a recognised option with a valid value.
+ */
+bool parse_options(int argc, char* argv[], BenchOpts* opts);
+
+/* Parses the value of an integer option and checks it is within range.
+ *
+ * Params:
+ *      arg: The value given for the option.
+ *      min: The minimum valid value.
+ *      max: The maximum valid value.
+ *      value: Where the parsed value is saved to.
+ *
+ * Return:
+ *      true if the value is an integer in the range [min, max].
+ */
+bool parse_int_opt(char* arg, int min, int max, int* value);
+
+/* Make the key with a given index. Every key is exactly keySize bytes long.
+ *
+ * Params:
+ *      buf: Where the key is saved (at least keySize + 1 bytes).
+ *      index: The index of the key.
+ *      keySize: The length of the key.
+ */
+void make_key(char* buf, int index, int keySize);
+
+/* Compute the generalised harmonic number sum(1 / i^theta) for i in [1, n],
+ * which the Zipfian generator needs.
+ *
+ * Params:
+ *      n: The number of keys.
+ *      theta: The skew of the distribution.
+ *
+ * Return:
+ *      The harmonic number.
+ */
+double zeta(int n, double theta);
+
+/* Get the next number from a thread's xorshift random number generator.
+ *
+ * Params:
+ *      state: The state of the generator (must not be 0).
+ *
+ * Return:
+ *      A random 64 bit number.
+ */
+uint64_t next_random(uint64_t* state);
+
+/* Choose the index of the next key to use following the distribution of the
+ * run. Zipfian indexes use the method of Gray et al. ("Quickly Generating
+ * Billion-Record Synthetic Databases"), so key 0 is the most popular.
+ *
+ * Params:
+ *      run: The run of interest.
+ *      state: The state of the thread's random number generator.
+ *
+ * Return:
+ *      The index of a key.
+ */
+int choose_key(BenchRun* run, uint64_t* state);
+
+/* Get the current time in nanoseconds from the monotonic clock.
+ *
+ * Return:
+ *      The current time.
+ */
+uint64_t now_ns(void);
+
+/* A thread that makes a share of a run's operations, recording how long each
+ * took.
+ *
+ * Params:
+ *      arg: A pointer to the WorkerArgs of the thread.
+ */
+void* worker_thread(void* arg);
+
+/* Fill a new store with every key and then run the benchmark on it with a
+ * number of threads.
+ *
+ * Params:
+ *      opts: The settings of the benchmark.
+ *      keys: The keys to use.
+ *      value: The value to store under each key.
+ *      numThreads: The number of threads to run.
+ *      result: Where the summary of the run is saved.
+ *
+ * Return:
+ *      true on success or false if the run could not be set up.
+ */
+bool run_bench(BenchOpts* opts, char** keys, const char* value,
+        int numThreads, RunResult* result);
+
+/* Used with qsort() to sort latencies into ascending order.
+ *
+ * Params:
+ *      a: A pointer to the first latency.
+ *      b: A pointer to the second latency.
+ *
+ * Return:
+ *      A negative, zero or positive number as a is less than, equal to or
+ *      greater than b.
+ */
+int compare_latency(const void* a, const void* b);
+
+/* Print the summary of a run to stdout in the requested format.
+ *
+ * Params:
+ *      opts: The settings of the benchmark.
+ *      result: The summary of the run.
+ */
+void print_result(BenchOpts* opts, RunResult* result);
+
+#endif
@@ -6,117 +6,2733 @@
  * DESCRIPTION:
  * Provides an API for a simple database that can  add/remove/edit key:value
  * pairs upon request.
+ *
+ * The key:value pairs are kept in an open addressing hash table with linear
+ * probing. The table size is always a power of two so a slot can be found
+ * with a mask rather than a modulo, and each entry caches the hash of its key
+ * so that probing and growing the table rarely need to call strcmp() or
+ * rehash a key. Deleted entries are removed by shifting later entries in the
+ * same probe sequence backwards, so no tombstones are ever left behind.
+ *
+ * Growing the table is incremental. A new table twice the size is allocated
+ * and the old one is kept alongside it; new keys only go into the new table
+ * and each write moves the next MIGRATE_SLOTS slots of the old table across,
+ * so no single operation pays for rehashing every key. Until the old table is
+ * empty, lookups check the new table and then the old one, and the table
+ * doesn't grow again.
+ *
+ * A store can take a snapshot of its contents that is read a chunk at a time
+ * while writes carry on. Starting a snapshot bumps the store's epoch, so
+ * every existing entry is stamped with an older epoch and is "pending". The
+ * snapshot walks the tables it started with, stamping and saving each
+ * pending entry it finds. Before a write changes, removes or moves a pending
+ * entry, the entry's current key, value reference and expiry are copied onto
+ * a list of saved entries for the snapshot to hand out instead. Values are
+ * reference counted so saving one is cheap, and entries added after the
+ * snapshot started are stamped with its epoch and never seen by it.
+ *
+ * Values carry their length so they can hold any bytes, including '\0's, and
+ * never need to be scanned to find where they end. They also carry a version
+ * that changes whenever the value of the key does, so clients can tell if a
+ * key has changed without comparing values.
+ *
+ * Versions are taken from a commit clock shared by every store in the
+ * process, which also gives the time of each read view. A view sees the
+ * newest version of each key from before it was opened. When a key is
+ * replaced or removed while a view that could see it is open, the old
+ * value is kept (by reference) in the store's history, a separate hash
+ * table of old versions, so reads at a view check the live entry and then
+ * the history. Writers never wait for views; they only check the time of
+ * the oldest open view, and stringstore_prune_versions() frees old versions
+ * once every view is newer than them.
+ *
+ * Values are reference counted. The store holds one reference to each value
+ * and stringstore_retrieve_ref() hands out another, so a value that is
+ * replaced or deleted is only freed once every reader has released it.
+ *
+ * A store can also be read without being locked. Writers then make a
+ * sequence count odd while they change the store and even again once they
+ * are done. An unlocked reader looks the key up, takes a reference to its
+ * value and checks the count didn't move, trying again if it did, so readers
+ * take no lock and only contend with each other over a value's reference
+ * count. Memory a reader may still be looking at can't be reused at once:
+ * retired tables, values and large keys wait until every reader that was
+ * reading when they were retired has finished. Each reading thread has its
+ * own slot, on its own cache line, saying which reader epoch it started in,
+ * so waiting only needs the epoch to be advanced and the slots checked.
+ * Small keys go straight back to their size class, as arenas are never
+ * unmapped and a reader only compares against them.
+ *
+ * Keys and values are carved out of per-store slab arenas with power of two
+ * size classes rather than being allocated individually with malloc(), so a
+ * freed slot is reused by the next allocation of the same class instead of
+ * fragmenting the heap. Overwriting a key reuses its value's slot in place
+ * when the new value fits, and freeing the store releases whole arenas.
+ * Anything bigger than the largest size class falls back to malloc().
+ *
+ * A store can optionally keep an ordered index of its keys in a skiplist
+ * alongside the hash table, which lets stringstore_scan() find keys by
+ * prefix in order. Skiplist nodes point at the keys in the hash table rather
+ * than holding copies of them.
+ *
+ * A store can also be given a budget for the bytes used by its keys and
+ * values. Once it is over budget, keys are evicted using the CLOCK
+ * approximation of LRU: a hand sweeps around the hash table, giving any entry
+ * that has been used since the hand last passed it a second chance and
+ * evicting the first one that hasn't. Each eviction only advances the hand as
+ * far as the next victim, so the table is never scanned as a whole.
+ *
+ * Keys can be given an expiry time. Each such key has a timer in a
+ * hierarchical timer wheel: WHEEL_LEVELS wheels of WHEEL_SLOTS slots where
+ * each slot of a level spans a whole rotation of the level below. A timer is
+ * placed on the lowest level that can reach its expiry and is moved down a
+ * level ("cascaded") as that time approaches, so stringstore_expire() only
+ * ever looks at timers that are due or about to be. Expired keys are also
+ * hidden from lookups straight away, even before their timer fires.
+ *
+ * Values at least as long as a store's compression threshold are stored as
+ * LZ4 blocks when that saves at least 1/MIN_SAVING_DENOM of their size. They
+ * are only decompressed when read: a reference taken to a compressed value
+ * is to a private decompressed copy that is freed when it is released, and
+ * a read that doesn't take a reference gets a decompressed copy that is
+ * cached alongside the value until it is changed or freed. Appending to a
+ * compressed value stores the result uncompressed, so a key that keeps
+ * growing isn't compressed again and again.
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include "stringstoreExt.h"
+#include "lzblock.h"
+
+#define INIT_BUFFERSIZE 32  // Must be a power of two
+#define MAX_LOAD_NUM 3      // Grow once numKeys > table size * 3 / 4
+#define MAX_LOAD_DENOM 4
+#define MIGRATE_SLOTS 16    // Old slots moved per write while growing
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+#define MIN_CLASS_SHIFT 4   // The smallest size class is 16 bytes
+#define NUM_SIZE_CLASSES 9  // and the largest is 16 << 8 = 4096 bytes
+#define NO_SIZE_CLASS -1    // Used for allocations made with malloc()
+#define ARENA_SIZE (64 * 1024)
+#define SKIP_MAX_LEVEL 32
+#define SKIP_LEVEL_MASK 3   // Each level has about 1/4 of the nodes below it
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS 4      // Reaches 64^4 ticks (about 19 days) ahead
+#define WHEEL_TICK_MS 100
+#define MSECS_PER_SEC 1000
+#define NSECS_PER_MSEC 1000000
+#define USECS_PER_SEC 1000000
+#define NSECS_PER_USEC 1000
+#define INTEGER_BUFFER_SIZE 21  // Fits any int64_t in decimal
+#define HISTORY_INIT_BUCKETS 64
+#define HISTORY_MAX_LOAD 2  // Old versions per bucket before it grows
+#define INIT_VIEWS 8
+#define NO_VIEW UINT64_MAX
+#define MIN_COMPRESS_LEN 64 // Never compress anything shorter (e.g. numbers)
+#define MIN_SAVING_DENOM 8  // Compression must save at least 1/8 of a value
+#define CACHE_LINE 64
+#define READ_TRIES 16       // Unlocked lookups tried before giving up
+#define RECLAIM_BATCH 64    // Retired values kept before trying to free them
+
+// A reference counted value. The len bytes of the value are stored in data,
+// which can hold up to capacity bytes, and are followed by a '\0' so the
+// value can also be used as a string. version changes whenever the contents
+// do. next is only used once the value is released, except that a compressed
+// value keeps its cached decompressed copy (if any) there. A compressed value
+// has a plainLen of the length of its data once decompressed, and a value
+// with no store is a decompressed copy that belongs to a reader.
+typedef struct Value {
+    StringStore* store;
+    struct Value* next;
+    uint64_t version;
+    int refCount;
+    uint32_t capacity;
+    uint32_t len;
+    uint32_t plainLen;
+    char data[];
+} Value;
+
+// An unused slot in a size class.
+typedef struct FreeSlot {
+    struct FreeSlot* next;
+} FreeSlot;
+
+// A block of memory that slots for a single size class are carved from.
+typedef struct Arena {
+    struct Arena* next;
+    char mem[];
+} Arena;
+
+// The slots of a single size. New slots are taken from the free list first
+// and otherwise from the unused part of the most recent arena.
+typedef struct SizeClass {
+    FreeSlot* freeList;
+    char* bump;
+    char* bumpEnd;
+} SizeClass;
+
+// A node in the ordered index. next[i] is the next node on level i.
+typedef struct SkipNode {
+    const char* key;
+    int height;
+    struct SkipNode* next[];
+} SkipNode;
+
+// The expiry time of a key, linked into a slot of the timer wheel. pprev
+// points at whichever pointer points at this timer so it can be unlinked.
+typedef struct Timer {
+    struct Timer* next;
+    struct Timer** pprev;
+    const char* key;
+    uint64_t expiresAt;
+} Timer;
+
+// A slot in the hash table. A slot is empty iff key is NULL. referenced is
+// set whenever the entry is used and cleared as the CLOCK hand passes it.
+// timer is NULL unless the key expires. epoch is the store's epoch when the
+// entry was added or last saved by a snapshot.
+typedef struct Entry {
+    char* key;
+    Value* val;
+    uint64_t hash;
+    Timer* timer;
+    bool referenced;
+    uint32_t epoch;
+} Entry;
+
+// An open addressing hash table with a power of two number of slots. Each
+// table the store allocates gets a new id.
+typedef struct Table {
+    Entry* entries;
+    size_t size;
+    uint64_t id;
+} Table;
+
+// The contents of an entry as of the start of a snapshot, saved before the
+// entry was changed. key is a copy and val holds a reference.
+typedef struct SavedEntry {
+    struct SavedEntry* next;
+    char* key;
+    Value* val;
+    uint64_t expiresAt;
+} SavedEntry;
+
+// The state of a snapshot that is being read.
+typedef struct Snapshot {
+    bool active;
+    bool failed;        // An entry could not be saved
+    uint32_t epoch;
+    SavedEntry* saved;
+    uint64_t tables[2]; // The ids of the tables to walk (0 for none)
+    int table;          // The table being walked
+    size_t cursor;      // The next slot of that table
+} Snapshot;
+
+// A version of a key that has been replaced or removed, kept for read views
+// that started before then. It was current from val->version until to.
+typedef struct OldVersion {
+    struct OldVersion* next;
+    char* key;
+    uint64_t hash;
+    Value* val;
+    uint64_t to;
+} OldVersion;
+
+// The old versions of a store's keys, chained in a hash table by key.
+typedef struct History {
+    OldVersion** buckets;
+    size_t numBuckets;
+    size_t count;
+    uint64_t horizon;   // Views older than this may be missing versions
+} History;
+
+// A thread that reads stores without locking them. epoch is the reader
+// epoch its current lookup started in, or 0 if it isn't looking anything up.
+// Slots are never freed, only reused once their thread exits, and each is
+// padded to a cache line so readers never share one.
+typedef struct Reader {
+    uint64_t epoch;
+    struct Reader* next;
+    bool inUse;
+    char pad[CACHE_LINE - sizeof(uint64_t) - sizeof(void*) - sizeof(bool)];
+} Reader;
+
+// Memory other than a value that is waiting for unlocked readers to finish
+// with it before it is freed. epoch is the reader epoch it was retired in.
+typedef struct RetiredMem {
+    struct RetiredMem* next;
+    void* mem;
+    uint64_t epoch;
+} RetiredMem;
+
+// A read view that is open.
+typedef struct ReadView {
+    uint64_t time;
+    uint64_t expiresAt; // When the view closes itself or 0 for never
+} ReadView;
+
+// The clock that versions and read views are taken from. It is shared by
+// every store in the process so a view means the same time in all of them.
+static uint64_t commitClock;
+
+// The read views that are open, and the time of the oldest (NO_VIEW if there
+// are none), which writers read without taking the lock.
+static pthread_mutex_t viewLock = PTHREAD_MUTEX_INITIALIZER;
+static ReadView* views;
+static size_t numViews;
+static size_t viewCapacity;
+static uint64_t oldestView = NO_VIEW;
+
+// The slots of threads that have read stores without locking them, and the
+// current reader epoch. The list only ever grows, at its head.
+static pthread_mutex_t readerLock = PTHREAD_MUTEX_INITIALIZER;
+static Reader* readers;
+static pthread_once_t readerOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t readerKey;
+static uint64_t readEpoch = 1;
+
+// A struct for the key:value database
+struct StringStore {
+    Table table;
+    Table old;          // The table being migrated from, or empty if none
+    size_t migrateIndex; // The next slot of the old table to migrate
+    size_t numKeys;     // Keys in both tables
+    uint64_t nextTableId;
+    uint64_t writeVersion; // The version of the change being made
+    SizeClass classes[NUM_SIZE_CLASSES];
+    Arena* arenas;
+    Value* released;    // Values released while the store was not locked
+    SkipNode* index;    // Head of the ordered index or NULL if not enabled
+    int indexLevel;     // Number of levels in use in the index
+    uint64_t rngState;
+    size_t usedBytes;   // Bytes used by keys and values
+    size_t maxBytes;    // Budget for usedBytes or 0 if there is no limit
+    size_t clockHand;   // The next slot to consider evicting (slots of the
+                        // old table follow those of the new one)
+    uint64_t evictions;
+    Timer** wheel;      // WHEEL_LEVELS * WHEEL_SLOTS slots, allocated lazily
+    uint64_t wheelTick; // The next tick to process
+    size_t numTimers;
+    Timer* spareTimer;  // Reserved by stringstore_reserve_expiry() or NULL
+    Snapshot snap;
+    History history;
+    size_t compressMin; // Shortest value to compress or 0 to never compress
+    size_t numCompressed; // Values stored compressed
+    size_t plainBytes;  // Their length before compression
+    size_t packedBytes; // and after
+    bool unlockedReads; // Keys may be looked up without the store locked
+    uint32_t seq;       // Odd while the store is being changed
+    Value* retired;     // Values waiting for unlocked readers, newest first
+    size_t numRetired;
+    RetiredMem* retiredMem; // Other memory waiting the same way
+};
+
+/* Hash a key using 64 bit FNV-1a.
+ *
+ * Params:
+ *      key: The string to hash.
+ *
+ * Return:
+ *      The hash of the key.
+ */
+static uint64_t hash_key(const char* key) {
+    uint64_t hash = FNV_OFFSET;
+    for (const unsigned char* c = (const unsigned char*)key; *c; c++) {
+        hash ^= *c;
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+/* Get the size class that an allocation of the given size belongs to.
+ *
+ * Params:
+ *      size: The number of bytes needed.
+ *
+ * Return:
+ *      The index of the smallest size class that fits size bytes, or
+ *      NO_SIZE_CLASS if it is too large for any size class.
+ */
+static int size_class(size_t size) {
+    int cls = 0;
+    while ((size_t)1 << (cls + MIN_CLASS_SHIFT) < size) {
+        if (++cls == NUM_SIZE_CLASSES) {
+            return NO_SIZE_CLASS;
+        }
+    }
+    return cls;
+}
+
+/* Get the number of bytes that slab_alloc() really uses for an allocation.
+ *
+ * Params:
+ *      size: The number of bytes needed.
+ *
+ * Return:
+ *      The size of the slot the allocation is given.
+ */
+static size_t slot_size(size_t size) {
+    int cls = size_class(size);
+    return cls == NO_SIZE_CLASS ? size : (size_t)1 << (cls + MIN_CLASS_SHIFT);
+}
+
+/* Allocate memory from the store's slab arenas. The store must be locked for
+ * writing.
+ *
+ * Params:
+ *      store: The store to allocate from.
+ *      size: The number of bytes needed.
+ *
+ * Return:
+ *      A pointer to at least size bytes or NULL if allocation failed.
+ */
+static void* slab_alloc(StringStore* store, size_t size) {
+    int cls = size_class(size);
+    if (cls == NO_SIZE_CLASS) {
+        return malloc(size);
+    }
+
+    SizeClass* sizeClass = &store->classes[cls];
+    if (sizeClass->freeList) {
+        FreeSlot* slot = sizeClass->freeList;
+        sizeClass->freeList = slot->next;
+        return slot;
+    }
+
+    if (sizeClass->bump == sizeClass->bumpEnd) {
+        Arena* arena = malloc(sizeof(Arena) + ARENA_SIZE);
+        if (!arena) {
+            return NULL;
+        }
+        arena->next = store->arenas;
+        store->arenas = arena;
+        sizeClass->bump = arena->mem;
+        sizeClass->bumpEnd = arena->mem + ARENA_SIZE;
+    }
+
+    void* slot = sizeClass->bump;
+    sizeClass->bump += (size_t)1 << (cls + MIN_CLASS_SHIFT);
+    return slot;
+}
+
+/* Return memory from slab_alloc() to the store. The store must be locked for
+ * writing.
+ *
+ * Params:
+ *      store: The store the memory was allocated from.
+ *      ptr: The memory to free.
+ *      size: The size that was passed to slab_alloc().
+ */
+static void slab_free(StringStore* store, void* ptr, size_t size) {
+    int cls = size_class(size);
+    if (cls == NO_SIZE_CLASS) {
+        free(ptr);
+        return;
+    }
+
+    FreeSlot* slot = ptr;
+    slot->next = store->classes[cls].freeList;
+    store->classes[cls].freeList = slot;
+}
+
+/* Get the reader epoch to retire memory in, once it can no longer be found
+ * by a new lookup. Any unlocked reader that could still find it started in
+ * this epoch or an earlier one.
+ *
+ * Return:
+ *      The current reader epoch.
+ */
+static uint64_t retire_epoch(void) {
+    // Order the changes that made the memory unreachable before the read,
+    // pairing with the fence a reader makes after publishing its epoch
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return __atomic_load_n(&readEpoch, __ATOMIC_RELAXED);
+}
+
+/* Start a new reader epoch and find the oldest epoch that an unlocked reader
+ * is still reading in. Memory retired in an earlier epoch can be freed.
+ *
+ * Return:
+ *      The oldest epoch being read in, or the new epoch if nothing is being
+ *      read.
+ */
+static uint64_t oldest_read_epoch(void) {
+    uint64_t oldest = __atomic_add_fetch(&readEpoch, 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for (Reader* reader = __atomic_load_n(&readers, __ATOMIC_ACQUIRE); reader;
+            reader = reader->next) {
+        uint64_t epoch = __atomic_load_n(&reader->epoch, __ATOMIC_ACQUIRE);
+        if (epoch && epoch < oldest) {
+            oldest = epoch;
+        }
+    }
+    return oldest;
+}
+
+/* Free memory allocated with malloc() that unlocked readers may still be
+ * looking at, once they have finished with it. If the memory can't be put
+ * on the retired list, this waits for the readers instead (which only takes
+ * as long as a lookup).
+ *
+ * Params:
+ *      store: The store the memory belonged to.
+ *      mem: The memory to free.
+ */
+static void mem_free(StringStore* store, void* mem) {
+    if (!store->unlockedReads) {
+        free(mem);
+        return;
+    }
+    uint64_t epoch = retire_epoch();
+    RetiredMem* retired = malloc(sizeof(RetiredMem));
+    if (!retired) {
+        while (oldest_read_epoch() <= epoch) {
+            sched_yield();
+        }
+        free(mem);
+        return;
+    }
+    retired->mem = mem;
+    retired->epoch = epoch;
+    retired->next = store->retiredMem;
+    store->retiredMem = retired;
+}
+
+/* Return a value that nothing holds a reference to any more to its size
+ * class, once no unlocked reader can be looking at it. A retired value's
+ * next links the retired list and its version holds the epoch it was
+ * retired in, as nothing can read either any more.
+ *
+ * Params:
+ *      store: The store the value was allocated from.
+ *      val: The value to free, with its decompressed copy already dropped.
+ */
+static void value_free(StringStore* store, Value* val) {
+    if (!store->unlockedReads) {
+        slab_free(store, val, sizeof(Value) + val->capacity);
+        return;
+    }
+    val->version = retire_epoch();
+    val->next = store->retired;
+    store->retired = val;
+    store->numRetired++;
+}
+
+/* Free any retired memory that no unlocked reader can still be looking at.
+ * The epochs on each retired list only decrease from its head, so
+ * everything after the first entry that can be freed can be too. This only
+ * looks at the readers once enough values have been retired or if other
+ * memory (e.g. an old table) is waiting.
+ *
+ * Params:
+ *      store: The store to free retired memory for.
+ */
+static void reclaim_retired(StringStore* store) {
+    if (store->numRetired < RECLAIM_BATCH && !store->retiredMem) {
+        return;
+    }
+    uint64_t oldest = oldest_read_epoch();
+
+    Value** link = &store->retired;
+    while (*link && (*link)->version >= oldest) {
+        link = &(*link)->next;
+    }
+    Value* val = *link;
+    *link = NULL;
+    while (val) {
+        Value* next = val->next;
+        slab_free(store, val, sizeof(Value) + val->capacity);
+        store->numRetired--;
+        val = next;
+    }
+
+    RetiredMem** memLink = &store->retiredMem;
+    while (*memLink && (*memLink)->epoch >= oldest) {
+        memLink = &(*memLink)->next;
+    }
+    RetiredMem* retired = *memLink;
+    *memLink = NULL;
+    while (retired) {
+        RetiredMem* next = retired->next;
+        free(retired->mem);
+        free(retired);
+        retired = next;
+    }
+}
+
+/* Copy a key into the store's slab arenas.
+ *
+ * Params:
+ *      store: The store to allocate the key from.
+ *      key: The key to copy.
+ *
+ * Return:
+ *      The copy of the key or NULL if it could not be allocated.
+ */
+static char* key_new(StringStore* store, const char* key) {
+    size_t size = strlen(key) + 1;
+    char* copy = slab_alloc(store, size);
+    if (copy) {
+        memcpy(copy, key, size);
+    }
+    return copy;
+}
+
+/* Return a key allocated with key_new() to the store's slab arenas.
+ *
+ * Params:
+ *      store: The store the key was allocated from.
+ *      key: The key to free.
+ */
+static void key_free(StringStore* store, char* key) {
+    size_t size = strlen(key) + 1;
+    if (size_class(size) == NO_SIZE_CLASS) {
+        // This came from malloc() so an unlocked reader comparing against it
+        // could find it unmapped
+        mem_free(store, key);
+    } else {
+        slab_free(store, key, size);
+    }
+}
+
+/* Create a new value holding a copy of the given data. The new value has a
+ * single reference which belongs to the caller.
+ *
+ * Params:
+ *      store: The store to allocate the value from.
+ *      data: The data to copy into the value.
+ *      len: The number of bytes of data.
+ *      plainLen: The length of the data once decompressed if it is an LZ4
+ *      block, or 0 if it isn't compressed.
+ *
+ * Return:
+ *      The new value or NULL if it could not be allocated.
+ */
+static Value* value_new(StringStore* store, const char* data, size_t len,
+        size_t plainLen) {
+    size_t size = sizeof(Value) + len + 1;
+    Value* val = slab_alloc(store, size);
+    if (!val) {
+        return NULL;
+    }
+
+    // Record the whole slot as usable so it can be reused in place later
+    size = slot_size(size);
+    val->store = store;
+    val->next = NULL;
+    val->version = store->writeVersion;
+    val->refCount = 1;
+    val->capacity = size - sizeof(Value);
+    val->len = (uint32_t)len;
+    val->plainLen = (uint32_t)plainLen;
+    memcpy(val->data, data, len);
+    val->data[len] = '\0';
+    return val;
+}
+
+/* Compress a value if the store compresses values of its length and doing so
+ * saves enough to be worth it.
+ *
+ * Params:
+ *      store: The store the value is for.
+ *      value: The value.
+ *      len: The length of the value.
+ *      packed: Where a buffer holding the compressed value is saved, which
+ *      must be freed. NULL is saved if the value isn't compressed.
+ *
+ * Return:
+ *      The length of the compressed value or 0 if it wasn't compressed.
+ */
+static size_t compress_value(StringStore* store, const char* value,
+        size_t len, char** packed) {
+    *packed = NULL;
+    if (!store->compressMin || len < store->compressMin ||
+            len >= UINT32_MAX) {
+        return 0;
+    }
+    size_t maxLen = len - len / MIN_SAVING_DENOM;
+    *packed = malloc(maxLen);
+    if (!*packed) {
+        return 0;
+    }
+    size_t packedLen = lz_compress(value, len, *packed, maxLen);
+    if (!packedLen) {
+        free(*packed);
+        *packed = NULL;
+    }
+    return packedLen;
+}
+
+/* Decompress a value into a copy that belongs to the caller rather than a
+ * store. The copy has a single reference and is freed with free().
+ *
+ * Params:
+ *      val: The compressed value.
+ *
+ * Return:
+ *      The copy or NULL if it could not be allocated or the value was
+ *      corrupt.
+ */
+static Value* value_decompress(const Value* val) {
+    Value* copy = malloc(sizeof(Value) + val->plainLen + 1);
+    if (!copy) {
+        return NULL;
+    }
+    if (!lz_decompress(val->data, val->len, copy->data, val->plainLen)) {
+        free(copy);
+        return NULL;
+    }
+    copy->store = NULL;
+    copy->next = NULL;
+    copy->version = val->version;
+    copy->refCount = 1;
+    copy->capacity = val->plainLen + 1;
+    copy->len = val->plainLen;
+    copy->plainLen = 0;
+    copy->data[copy->len] = '\0';
+    return copy;
+}
+
+/* Get the data of a value for a reader that doesn't take a reference to it.
+ * A compressed value is decompressed the first time it is read this way and
+ * the copy is cached until the value is changed or freed. This is safe with
+ * the store only locked for reading.
+ *
+ * Params:
+ *      val: The value to read.
+ *
+ * Return:
+ *      The data or NULL if a compressed value could not be decompressed.
+ */
+static const char* value_plain(Value* val) {
+    if (!val->plainLen) {
+        return val->data;
+    }
+    Value* cached = __atomic_load_n(&val->next, __ATOMIC_ACQUIRE);
+    if (cached) {
+        return cached->data;
+    }
+    Value* copy = value_decompress(val);
+    if (!copy) {
+        return NULL;
+    }
+    // Another reader may have got there first
+    if (!__atomic_compare_exchange_n(&val->next, &cached, copy, false,
+            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        free(copy);
+        return cached->data;
+    }
+    return copy->data;
+}
+
+/* Take a reference to a value's data for a reader. The reference to a
+ * compressed value is to a decompressed copy of its own, so only values that
+ * are being read take up their full size. This is safe with the store only
+ * locked for reading.
+ *
+ * Params:
+ *      val: The value to read.
+ *
+ * Return:
+ *      The data, to be released with stringstore_release(), or NULL if a
+ *      compressed value could not be decompressed.
+ */
+static const char* value_pin(Value* val) {
+    if (!val->plainLen) {
+        __atomic_add_fetch(&val->refCount, 1, __ATOMIC_RELAXED);
+        return val->data;
+    }
+    Value* copy = value_decompress(val);
+    return copy ? copy->data : NULL;
+}
+
+/* Free the decompressed copy of a value cached by value_plain(), if it has
+ * one. Nothing may be reading the value without a reference to it.
+ *
+ * Params:
+ *      val: The value.
+ */
+static void value_drop_plain(Value* val) {
+    if (val->plainLen) {
+        free(val->next);
+    }
+    val->next = NULL;
+}
+
+/* Add or remove a value from the store's compression statistics.
+ *
+ * Params:
+ *      store: The store of interest.
+ *      val: A value that was just stored in an entry or taken out of one.
+ *      stored: Whether the value was stored rather than taken out.
+ */
+static void count_compression(StringStore* store, Value* val, bool stored) {
+    if (!val->plainLen) {
+        return;
+    }
+    if (stored) {
+        store->numCompressed++;
+        store->plainBytes += val->plainLen;
+        store->packedBytes += val->len;
+    } else {
+        store->numCompressed--;
+        store->plainBytes -= val->plainLen;
+        store->packedBytes -= val->len;
+    }
+}
+
+/* Create a copy of a value with room for at least extra more bytes after it.
+ * The room is at least doubled so that appending to a value again and again
+ * only copies it O(log n) times. A compressed value is decompressed into the
+ * copy.
+ *
+ * Params:
+ *      store: The store to allocate the value from.
+ *      old: The value to copy.
+ *      extra: The number of bytes that will be appended.
+ *
+ * Return:
+ *      The new value (with a single reference) or NULL if it could not be
+ *      allocated.
+ */
+static Value* value_grow(StringStore* store, Value* old, size_t extra) {
+    size_t len = old->plainLen ? old->plainLen : old->len;
+    size_t capacity = len + extra + 1;
+    if (capacity < (size_t)old->capacity * 2) {
+        capacity = (size_t)old->capacity * 2;
+    }
+    if (capacity > UINT32_MAX - sizeof(Value)) {
+        capacity = UINT32_MAX - sizeof(Value);
+    }
+    Value* val = slab_alloc(store, sizeof(Value) + capacity);
+    if (!val) {
+        return NULL;
+    }
+
+    if (old->plainLen && !lz_decompress(old->data, old->len, val->data,
+            len)) {
+        slab_free(store, val, sizeof(Value) + capacity);
+        return NULL;
+    }
+    if (!old->plainLen) {
+        memcpy(val->data, old->data, len);
+    }
+    val->data[len] = '\0';
+    val->store = store;
+    val->next = NULL;
+    val->version = store->writeVersion;
+    val->refCount = 1;
+    val->capacity = slot_size(sizeof(Value) + capacity) - sizeof(Value);
+    val->len = (uint32_t)len;
+    val->plainLen = 0;
+    return val;
+}
+
+/* Drop a reference to a value, freeing it if it was the last one. The store
+ * must be locked for writing.
+ *
+ * Params:
+ *      store: The store the value was allocated from.
+ *      val: The value to release (may be NULL).
+ */
+static void value_put(StringStore* store, Value* val) {
+    if (val && !__atomic_sub_fetch(&val->refCount, 1, __ATOMIC_ACQ_REL)) {
+        value_drop_plain(val);
+        value_free(store, val);
+    }
+}
+
+/* Free any values released while the store was unlocked. The store must be
+ * locked for writing.
+ *
+ * Params:
+ *      store: The store to reclaim values for.
+ */
+static void reclaim_released(StringStore* store) {
+    if (!__atomic_load_n(&store->released, __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    Value* val = __atomic_exchange_n(&store->released, NULL,
+            __ATOMIC_ACQUIRE);
+    while (val) {
+        Value* next = val->next;
+        value_free(store, val);
+        val = next;
+    }
+}
+
+/* Get the size of a skiplist node.
+ *
+ * Params:
+ *      height: The number of levels the node is on.
+ *
+ * Return:
+ *      The number of bytes needed for the node.
+ */
+static size_t skip_node_size(int height) {
+    return sizeof(SkipNode) + sizeof(SkipNode*) * height;
+}
+
+/* Pick the height for a new skiplist node using the store's xorshift random
+ * number generator.
+ *
+ * Params:
+ *      store: The store the node will be added to.
+ *
+ * Return:
+ *      The height of the new node (1 to SKIP_MAX_LEVEL).
+ */
+static int random_level(StringStore* store) {
+    uint64_t x = store->rngState;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    store->rngState = x;
+
+    int level = 1;
+    while (level < SKIP_MAX_LEVEL && !(x & SKIP_LEVEL_MASK)) {
+        level++;
+        x >>= 2;
+    }
+    return level;
+}
+
+/* Find the last node on each level of the index whose key is less than the
+ * given key.
+ *
+ * Params:
+ *      store: The store whose index to search.
+ *      key: The key to search for.
+ *      update: Where the last node on each level is saved.
+ *
+ * Return:
+ *      The first node whose key is not less than the given key, or NULL.
+ */
+static SkipNode* index_search(StringStore* store, const char* key,
+        SkipNode** update) {
+    SkipNode* node = store->index;
+    for (int level = store->indexLevel - 1; level >= 0; level--) {
+        while (node->next[level] && strcmp(node->next[level]->key, key) < 0) {
+            node = node->next[level];
+        }
+        update[level] = node;
+    }
+    return node->next[0];
+}
+
+/* Add a key to the index. The key must not already be in the index.
+ *
+ * Params:
+ *      store: The store whose index to add to.
+ *      key: The key to add (which must stay allocated while it is indexed).
+ *
+ * Return:
+ *      1 on success or 0 if a node could not be allocated.
+ */
+static int index_insert(StringStore* store, const char* key) {
+    SkipNode* update[SKIP_MAX_LEVEL];
+    index_search(store, key, update);
+
+    int height = random_level(store);
+    SkipNode* node = slab_alloc(store, skip_node_size(height));
+    if (!node) {
+        return 0;
+    }
+    for (int level = store->indexLevel; level < height; level++) {
+        update[level] = store->index;
+    }
+    if (height > store->indexLevel) {
+        store->indexLevel = height;
+    }
+
+    node->key = key;
+    node->height = height;
+    for (int level = 0; level < height; level++) {
+        node->next[level] = update[level]->next[level];
+        update[level]->next[level] = node;
+    }
+    return 1;
+}
+
+/* Remove a key from the index if it is there.
+ *
+ * Params:
+ *      store: The store whose index to remove from.
+ *      key: The key to remove.
+ */
+static void index_remove(StringStore* store, const char* key) {
+    SkipNode* update[SKIP_MAX_LEVEL];
+    SkipNode* node = index_search(store, key, update);
+    if (!node || strcmp(node->key, key)) {
+        return;
+    }
+
+    for (int level = 0; level < node->height; level++) {
+        update[level]->next[level] = node->next[level];
+    }
+    while (store->indexLevel > 1 &&
+            !store->index->next[store->indexLevel - 1]) {
+        store->indexLevel--;
+    }
+    slab_free(store, node, skip_node_size(node->height));
+}
+
+/* Find the slot for a key in a table. This is either the slot containing
+ * the key or the empty slot where the key would be inserted.
+ *
+ * Params:
+ *      table: The table to search.
+ *      key: The key to look for.
+ *      hash: The hash of the key.
+ *
+ * Return:
+ *      The index of the slot.
+ */
+static size_t find_slot(Table* table, const char* key, uint64_t hash) {
+    size_t mask = table->size - 1;
+    size_t i = hash & mask;
+    while (table->entries[i].key) {
+        if (table->entries[i].hash == hash &&
+                !strcmp(table->entries[i].key, key)) {
+            break;
+        }
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+/* Find the entry for a key in the store, looking in the old table as well
+ * while the store is growing.
+ *
+ * Params:
+ *      store: The StringStore to search.
+ *      key: The key to look for.
+ *      hash: The hash of the key.
+ *
+ * Return:
+ *      The entry containing the key or NULL if the key isn't in the store.
+ */
+static Entry* find_entry(StringStore* store, const char* key, uint64_t hash) {
+    Entry* entry = &store->table.entries[find_slot(&store->table, key, hash)];
+    if (!entry->key && store->old.entries) {
+        entry = &store->old.entries[find_slot(&store->old, key, hash)];
+    }
+    return entry->key ? entry : NULL;
+}
+
+/* Save an entry for the snapshot being read, if the snapshot hasn't already
+ * got it. This must be called before the entry is changed, removed or moved.
+ * If the entry can't be saved, reading the snapshot fails.
+ *
+ * Params:
+ *      store: The store the entry is in.
+ *      entry: The entry that is about to change.
+ */
+static void snapshot_save(StringStore* store, Entry* entry) {
+    if (!store->snap.active || entry->epoch == store->snap.epoch) {
+        return;
+    }
+    entry->epoch = store->snap.epoch;
+
+    SavedEntry* saved = malloc(sizeof(SavedEntry));
+    char* key = strdup(entry->key);
+    if (!saved || !key) {
+        free(saved);
+        free(key);
+        store->snap.failed = true;
+        return;
+    }
+    saved->key = key;
+    saved->val = entry->val;
+    __atomic_add_fetch(&saved->val->refCount, 1, __ATOMIC_RELAXED);
+    saved->expiresAt = entry->timer ? entry->timer->expiresAt : 0;
+    saved->next = store->snap.saved;
+    store->snap.saved = saved;
+}
+
+/* Empty a slot of a table. Any later entries in the same probe sequence that
+ * could be placed in the hole are shifted back, so lookups never stop early
+ * at an empty slot.
+ *
+ * Params:
+ *      store: The store the table belongs to.
+ *      table: The table to remove the entry from.
+ *      i: The slot to empty.
+ */
+static void unlink_slot(StringStore* store, Table* table, size_t i) {
+    size_t mask = table->size - 1;
+    size_t j = i;
+    while (1) {
+        j = (j + 1) & mask;
+        Entry* entry = &table->entries[j];
+        if (!entry->key) {
+            break;
+        }
+        size_t home = entry->hash & mask;
+        // Only move the entry if its home slot is not cyclically in (i, j]
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            // A snapshot walking the table could miss the entry once moved
+            snapshot_save(store, entry);
+            table->entries[i] = *entry;
+            i = j;
+        }
+    }
+    table->entries[i].key = NULL;
+    table->entries[i].val = NULL;
+    table->entries[i].timer = NULL;
+}
+
+/* Move up to maxSlots slots of the old table into the new one, freeing the
+ * old table once it is empty. Slots are migrated in order; a slot is only
+ * passed once it is empty, since moving its entry out may shift a later
+ * entry back into it. Every slot before migrateIndex is therefore empty,
+ * which keeps the old table a valid table for lookups throughout.
+ *
+ * Params:
+ *      store: The store that is growing.
+ *      maxSlots: The most slots to look at.
+ */
+static void migrate(StringStore* store, size_t maxSlots) {
+    size_t mask = store->table.size - 1;
+    while (store->old.entries && maxSlots--) {
+        Entry* entry = &store->old.entries[store->migrateIndex];
+        if (entry->key) {
+            size_t i = entry->hash & mask;
+            while (store->table.entries[i].key) {
+                i = (i + 1) & mask;
+            }
+            snapshot_save(store, entry);
+            store->table.entries[i] = *entry;
+            unlink_slot(store, &store->old, store->migrateIndex);
+        } else if (++store->migrateIndex == store->old.size) {
+            mem_free(store, store->old.entries);
+            store->old.entries = NULL;
+            store->old.size = 0;
+        }
+    }
+}
+
+/* Start growing the hash table. The entries are moved across to the new
+ * table a few at a time by later calls to migrate(). If the store is still
+ * growing from last time, growing again waits until later writes have
+ * emptied the old table, so no one write moves every entry across; until
+ * then the table is allowed past its usual load.
+ *
+ * Params:
+ *      store: The StringStore to grow.
+ *      newSize: The new number of slots (a power of two bigger than the
+ *      current number).
+ *
+ * Return:
+ *      1 if the table was grown or can still take another key while it
+ *      waits, or 0 if it is full or the new table could not be allocated
+ *      (in which case the store is left unchanged).
+ */
+static int grow(StringStore* store, size_t newSize) {
+    if (store->old.entries) {
+        // The table is at least twice the old one's size, so the old one
+        // normally empties long before this is needed
+        return store->numKeys + 1 < store->table.size;
+    }
+    Entry* newEntries = calloc(newSize, sizeof(Entry));
+    if (!newEntries) {
+        return 0;
+    }
+
+    store->old = store->table;
+    store->table.entries = newEntries;
+    store->table.size = newSize;
+    store->table.id = store->nextTableId++;
+    store->migrateIndex = 0;
+    return 1;
+}
+
+/* Get the current time in milliseconds since the Unix epoch.
+ *
+ * Return:
+ *      The current time.
+ */
+static uint64_t current_time_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (uint64_t)now.tv_sec * MSECS_PER_SEC +
+            now.tv_nsec / NSECS_PER_MSEC;
+}
+
+/* Link a timer into the wheel on the lowest level that reaches its expiry.
+ * Timers beyond the top level are parked in its furthest slot and placed
+ * again when that slot is cascaded.
+ *
+ * Params:
+ *      store: The store whose wheel to add to.
+ *      timer: The timer to add.
+ */
+static void timer_place(StringStore* store, Timer* timer) {
+    // Round up so a timer never fires before its expiry
+    uint64_t tick = (timer->expiresAt + WHEEL_TICK_MS - 1) / WHEEL_TICK_MS;
+    if (tick < store->wheelTick) {
+        tick = store->wheelTick;
+    }
+    uint64_t delta = tick - store->wheelTick;
+    uint64_t reach = (uint64_t)1 << (WHEEL_BITS * WHEEL_LEVELS);
+    if (delta >= reach) {
+        tick = store->wheelTick + reach - 1;
+        delta = reach - 1;
+    }
+
+    int level = 0;
+    while (delta >= (uint64_t)1 << (WHEEL_BITS * (level + 1))) {
+        level++;
+    }
+    Timer** slot = &store->wheel[level * WHEEL_SLOTS +
+            ((tick >> (WHEEL_BITS * level)) & WHEEL_MASK)];
+    timer->next = *slot;
+    if (timer->next) {
+        timer->next->pprev = &timer->next;
+    }
+    timer->pprev = slot;
+    *slot = timer;
+}
+
+/* Unlink a timer from its slot in the wheel.
+ *
+ * Params:
+ *      timer: The timer to unlink.
+ */
+static void timer_unlink(Timer* timer) {
+    *timer->pprev = timer->next;
+    if (timer->next) {
+        timer->next->pprev = timer->pprev;
+    }
+}
+
+/* Remove an entry's expiry, if it has one.
+ *
+ * Params:
+ *      store: The store the entry is in.
+ *      entry: The entry whose timer should be cancelled.
+ */
+static void timer_cancel(StringStore* store, Entry* entry) {
+    if (!entry->timer) {
+        return;
+    }
+    timer_unlink(entry->timer);
+    slab_free(store, entry->timer, sizeof(Timer));
+    entry->timer = NULL;
+    store->numTimers--;
+}
+
+/* Check whether an entry has expired but not been removed yet.
+ *
+ * Params:
+ *      entry: The entry to check.
+ *
+ * Return:
+ *      true if the entry's expiry time has passed.
+ */
+static bool is_expired(Entry* entry) {
+    return entry->timer && entry->timer->expiresAt <= current_time_ms();
+}
+
+/* Get the number of bytes an entry's key and value count against the store's
+ * budget.
+ *
+ * Params:
+ *      entry: The entry of interest.
+ *
+ * Return:
+ *      The size of the slots used by the key and value.
+ */
+static size_t entry_charge(Entry* entry) {
+    return slot_size(strlen(entry->key) + 1) +
+            sizeof(Value) + entry->val->capacity;
+}
+
+/* Get a slot of the store by its position. The slots of the new table come
+ * first, followed by those of the old table while the store is growing.
+ *
+ * Params:
+ *      store: The store of interest.
+ *      pos: The position of the slot (less than the number of slots in both
+ *      tables).
+ *
+ * Return:
+ *      The slot at that position.
+ */
+static Entry* entry_at(StringStore* store, size_t pos) {
+    if (pos < store->table.size) {
+        return &store->table.entries[pos];
+    }
+    return &store->old.entries[pos - store->table.size];
+}
+
+/* Take the version for a change to the store from the commit clock. Every
+ * public function that changes a value or removes a key calls this first,
+ * while the store is locked for writing.
+ *
+ * Params:
+ *      store: The store that is about to change.
+ */
+static void begin_write(StringStore* store) {
+    store->writeVersion = __atomic_fetch_add(&commitClock, 1,
+            __ATOMIC_SEQ_CST);
+}
+
+/* Find the old version of a key that a read view sees.
+ *
+ * Params:
+ *      store: The store the key was in.
+ *      key: The key to look for.
+ *      hash: The hash of the key.
+ *      view: The time of the view.
+ *
+ * Return:
+ *      The value the key had at that time or NULL if there isn't one saved.
+ */
+static Value* history_find(StringStore* store, const char* key, uint64_t hash,
+        uint64_t view) {
+    History* history = &store->history;
+    if (!history->count) {
+        return NULL;
+    }
+    OldVersion* old = history->buckets[hash & (history->numBuckets - 1)];
+    for (; old; old = old->next) {
+        if (old->hash == hash && old->val->version < view &&
+                view <= old->to && !strcmp(old->key, key)) {
+            return old->val;
+        }
+    }
+    return NULL;
+}
+
+/* Double the number of buckets of the history (or allocate the first ones).
+ *
+ * Params:
+ *      history: The history to grow.
+ *
+ * Return:
+ *      true on success or false if the buckets could not be allocated.
+ */
+static bool history_grow(History* history) {
+    size_t numBuckets = history->numBuckets ? history->numBuckets * 2 :
+            HISTORY_INIT_BUCKETS;
+    OldVersion** buckets = calloc(numBuckets, sizeof(OldVersion*));
+    if (!buckets) {
+        return false;
+    }
+    for (size_t i = 0; i < history->numBuckets; i++) {
+        while (history->buckets[i]) {
+            OldVersion* old = history->buckets[i];
+            history->buckets[i] = old->next;
+            old->next = buckets[old->hash & (numBuckets - 1)];
+            buckets[old->hash & (numBuckets - 1)] = old;
+        }
+    }
+    free(history->buckets);
+    history->buckets = buckets;
+    history->numBuckets = numBuckets;
+    return true;
+}
+
+/* Keep the current version of an entry for any read view that could still
+ * see it. This must be called before the entry's value is changed or the
+ * entry is removed, after begin_write(). If the version can't be kept, views
+ * from before this change can no longer read the store.
+ *
+ * Params:
+ *      store: The store the entry is in.
+ *      entry: The entry that is about to change.
+ */
+static void history_save(StringStore* store, Entry* entry) {
+    History* history = &store->history;
+    uint64_t version = store->writeVersion;
+    // Expiry is judged when a view reads a key so an expired value is
+    // already hidden from every view
+    if (is_expired(entry)) {
+        return;
+    }
+    if (__atomic_load_n(&oldestView, __ATOMIC_SEQ_CST) > version) {
+        // Every view that is open or opens later starts after this change
+        if (history->horizon <= version) {
+            history->horizon = version + 1;
+        }
+        return;
+    }
+
+    if (history->count >= history->numBuckets * HISTORY_MAX_LOAD) {
+        // Carry on with longer chains if the buckets can't grow
+        history_grow(history);
+    }
+    OldVersion* old = malloc(sizeof(OldVersion));
+    char* key = strdup(entry->key);
+    if (!old || !key || !history->numBuckets) {
+        free(old);
+        free(key);
+        history->horizon = version + 1;
+        return;
+    }
+    old->key = key;
+    old->hash = entry->hash;
+    old->val = entry->val;
+    __atomic_add_fetch(&old->val->refCount, 1, __ATOMIC_RELAXED);
+    old->to = version;
+    OldVersion** bucket = &history->buckets[entry->hash &
+            (history->numBuckets - 1)];
+    old->next = *bucket;
+    *bucket = old;
+    history->count++;
+}
+
+/* Recalculate the time of the oldest open read view. viewLock must be held.*/
+static void update_oldest_view(void) {
+    uint64_t oldest = NO_VIEW;
+    for (size_t i = 0; i < numViews; i++) {
+        if (views[i].time < oldest) {
+            oldest = views[i].time;
+        }
+    }
+    __atomic_store_n(&oldestView, oldest, __ATOMIC_SEQ_CST);
+}
+
+/* Close any read views whose time is up.*/
+static void expire_views(void) {
+    if (__atomic_load_n(&oldestView, __ATOMIC_SEQ_CST) == NO_VIEW) {
+        return;
+    }
+    uint64_t now = current_time_ms();
+    pthread_mutex_lock(&viewLock);
+    for (size_t i = 0; i < numViews; i++) {
+        if (views[i].expiresAt && views[i].expiresAt <= now) {
+            views[i--] = views[--numViews];
+        }
+    }
+    update_oldest_view();
+    pthread_mutex_unlock(&viewLock);
+}
+
+/* Remove an entry's key and value from the store. begin_write() must have
+ * been called.
+ *
+ * Params:
+ *      store: The store to remove the key from.
+ *      entry: The entry of the key to remove, in either table.
+ */
+static void remove_entry(StringStore* store, Entry* entry) {
+    snapshot_save(store, entry);
+    history_save(store, entry);
+    store->usedBytes -= entry_charge(entry);
+    count_compression(store, entry->val, false);
+    timer_cancel(store, entry);
+    if (store->index) {
+        index_remove(store, entry->key);
+    }
+    key_free(store, entry->key);
+    value_put(store, entry->val);
+    store->numKeys--;
+
+    Table* table = &store->table;
+    if (entry < table->entries || entry >= table->entries + table->size) {
+        table = &store->old;
+    }
+    unlink_slot(store, table, entry - table->entries);
+}
+
+/* Record that an entry has been used so the CLOCK hand passes over it. This
+ * may be called while the store is only locked for reading so the flag is
+ * only written when it needs to change.
+ *
+ * Params:
+ *      entry: The entry that was used.
+ */
+static void mark_referenced(Entry* entry) {
+    if (!__atomic_load_n(&entry->referenced, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&entry->referenced, true, __ATOMIC_RELAXED);
+    }
+}
+
+/* Evict keys until the store is within its budget. The store must be locked
+ * for writing.
+ *
+ * Params:
+ *      store: The store to evict keys from.
+ *      keep: A key that must not be evicted (e.g. one that was just added),
+ *      or NULL.
+ */
+static void evict_to_fit(StringStore* store, const char* keep) {
+    size_t minKeys = keep ? 1 : 0;
+    while (store->usedBytes > store->maxBytes && store->numKeys > minKeys) {
+        if (store->clockHand >= store->table.size + store->old.size) {
+            store->clockHand = 0;
+        }
+        Entry* entry = entry_at(store, store->clockHand);
+        if (!entry->key || entry->key == keep) {
+            store->clockHand++;
+        } else if (entry->referenced) {
+            entry->referenced = false;
+            store->clockHand++;
+        } else {
+            // The hand stays put since a later entry may shift into the hole
+            remove_entry(store, entry);
+            store->evictions++;
+        }
+    }
+}
+
+// Creates a new StringStore instance and returns a pointer to it.
+StringStore* stringstore_init(void) {
+    StringStore* store = malloc(sizeof(StringStore));
+    if (!store) {
+        return NULL;
+    }
+    store->numKeys = 0;
+    store->old.entries = NULL;
+    store->old.size = 0;
+    store->migrateIndex = 0;
+    memset(store->classes, 0, sizeof(store->classes));
+    store->arenas = NULL;
+    store->released = NULL;
+    store->index = NULL;
+    store->indexLevel = 1;
+    store->rngState = (uintptr_t)store | 1;
+    store->usedBytes = 0;
+    store->maxBytes = 0;
+    store->clockHand = 0;
+    store->evictions = 0;
+    store->wheel = NULL;
+    store->wheelTick = 0;
+    store->numTimers = 0;
+    store->spareTimer = NULL;
+    store->table.size = INIT_BUFFERSIZE;
+    store->table.id = 1;
+    store->nextTableId = 2;
+    store->writeVersion = 0;
+    store->compressMin = 0;
+    store->numCompressed = 0;
+    store->plainBytes = 0;
+    store->packedBytes = 0;
+    store->unlockedReads = false;
+    store->seq = 0;
+    store->retired = NULL;
+    store->numRetired = 0;
+    store->retiredMem = NULL;
+    memset(&store->history, 0, sizeof(History));
+    // Start the clock from the time so versions from before a restart
+    // aren't reused
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    uint64_t unset = 0;
+    __atomic_compare_exchange_n(&commitClock, &unset,
+            (uint64_t)now.tv_sec * USECS_PER_SEC +
+            now.tv_nsec / NSECS_PER_USEC, false, __ATOMIC_SEQ_CST,
+            __ATOMIC_SEQ_CST);
+    memset(&store->snap, 0, sizeof(Snapshot));
+    store->table.entries = calloc(store->table.size, sizeof(Entry));
+    if (!store->table.entries) {
+        free(store);
+        return NULL;
+    }
+    return store;
+}
+
+// Free all memort associated with the given StringStore and return NYLL
+StringStore* stringstore_free(StringStore* store) {
+    stringstore_snapshot_end(store);
+    // Only keys and vals too big for a size class need to be freed one by
+    // one, everything else goes with the arenas
+    for (size_t i = 0; i < store->table.size + store->old.size; i++) {
+        Entry* entry = entry_at(store, i);
+        if (entry->key) {
+            key_free(store, entry->key);
+            value_put(store, entry->val);
+        }
+    }
+    for (size_t i = 0; i < store->history.numBuckets; i++) {
+        while (store->history.buckets[i]) {
+            OldVersion* old = store->history.buckets[i];
+            store->history.buckets[i] = old->next;
+            free(old->key);
+            value_put(store, old->val);
+            free(old);
+        }
+    }
+    free(store->history.buckets);
+    // Nothing can be reading the store any more
+    while (store->retired) {
+        Value* next = store->retired->next;
+        slab_free(store, store->retired, sizeof(Value) +
+                store->retired->capacity);
+        store->retired = next;
+    }
+    while (store->retiredMem) {
+        RetiredMem* next = store->retiredMem->next;
+        free(store->retiredMem->mem);
+        free(store->retiredMem);
+        store->retiredMem = next;
+    }
+    while (store->arenas) {
+        Arena* next = store->arenas->next;
+        free(store->arenas);
+        store->arenas = next;
+    }
+    free(store->table.entries);
+    free(store->old.entries);
+    free(store->wheel);
+    free(store);
+    return NULL;
+}
+
+/* Replace the value of an existing entry, leaving its expiry alone. The old
+ * value's slot is reused if nobody else holds a reference to it and the new
+ * value fits (without wasting more than half of it). The caller should then
+ * evict keys if the store is over budget.
+ *
+ * Params:
+ *      store: The store the entry is in.
+ *      entry: The entry to update, which must already have been saved for
+ *      any snapshot and read view.
+ *      value: The new value.
+ *      len: The length of the new value.
+ *      plainLen: The length of the new value once decompressed, or 0 if it
+ *      isn't compressed.
+ *
+ * Return:
+ *      1 on success or 0 if the new value could not be allocated.
+ */
+static int replace_value(StringStore* store, Entry* entry, const char* value,
+        size_t len, size_t plainLen) {
+    // Readers only keep references taken while the store isn't changing (an
+    // unlocked reader drops one it took meanwhile without reading the value)
+    // so a count of one can't change under us
+    entry->referenced = true;
+    Value* val = entry->val;
+    if (__atomic_load_n(&val->refCount, __ATOMIC_ACQUIRE) == 1 &&
+            len < val->capacity &&
+            len >= val->capacity / 2) {
+        count_compression(store, val, false);
+        value_drop_plain(val);
+        memcpy(val->data, value, len);
+        val->data[len] = '\0';
+        val->len = (uint32_t)len;
+        val->plainLen = (uint32_t)plainLen;
+        val->version = store->writeVersion;
+        count_compression(store, val, true);
+        return 1;
+    }
+
+    Value* val2Add = value_new(store, value, len, plainLen);
+    if (!val2Add) {
+        return 0;
+    }
+    store->usedBytes += val2Add->capacity;
+    store->usedBytes -= val->capacity;
+    count_compression(store, val, false);
+    value_put(store, val);
+    entry->val = val2Add;
+    count_compression(store, val2Add, true);
+    return 1;
+}
+
+/* Check that a key/value pair of the given sizes could ever be stored.
+ *
+ * Params:
+ *      store: The store of interest.
+ *      key: The key.
+ *      len: The length of the value.
+ *
+ * Return:
+ *      true if the pair isn't too long and would fit in the store's budget
+ *      with everything else evicted.
+ */
+static bool can_fit(StringStore* store, const char* key, size_t len) {
+    if (len >= UINT32_MAX - sizeof(Value)) {
+        return false;
+    }
+    return !store->maxBytes || slot_size(strlen(key) + 1) +
+            slot_size(sizeof(Value) + len + 1) <= store->maxBytes;
+}
+
+/* Store a key/value pair once the value has been compressed (or not).
+ *
+ * Params:
+ *      store: The store to add to.
+ *      key: The key to add.
+ *      hash: The hash of the key.
+ *      value: The value to store.
+ *      len: The length of the value to store.
+ *      plainLen: The length of the value once decompressed, or 0 if it isn't
+ *      compressed.
+ *
+ * Return:
+ *      1 on success or 0 on failure.
+ */
+static int store_entry(StringStore* store, const char* key, uint64_t hash,
+        const char* value, size_t len, size_t plainLen) {
+    begin_write(store);
+    if (!can_fit(store, key, len)) {
+        return 0;
+    }
+    migrate(store, MIGRATE_SLOTS);
+    Entry* entry = find_entry(store, key, hash);
+    if (entry) {
+        snapshot_save(store, entry);
+        history_save(store, entry);
+        if (!replace_value(store, entry, value, len, plainLen)) {
+            return 0;
+        }
+        // Adding a key clears its expiry
+        timer_cancel(store, entry);
+        if (store->maxBytes) {
+            evict_to_fit(store, entry->key);
+        }
+        return 1;
+    }
+
+    Value* val2Add = value_new(store, value, len, plainLen);
+    if (!val2Add) {
+        return 0;
+    }
+
+    // Check if need to increase the buffer
+    if ((store->numKeys + 1) * MAX_LOAD_DENOM >
+            store->table.size * MAX_LOAD_NUM &&
+            !grow(store, store->table.size * 2)) {
+        value_put(store, val2Add);
+        return 0;
+    }
+    // New keys only ever go into the new table
+    entry = &store->table.entries[find_slot(&store->table, key, hash)];
+
+    char* key2Add = key_new(store, key);
+    if (!key2Add) {
+        value_put(store, val2Add);
+        return 0;
+    }
+    if (store->index && !index_insert(store, key2Add)) {
+        key_free(store, key2Add);
+        value_put(store, val2Add);
+        return 0;
+    }
+
+    entry->key = key2Add;
+    entry->val = val2Add;
+    entry->hash = hash;
+    entry->timer = NULL;
+    entry->referenced = true;
+    entry->epoch = store->snap.epoch;
+    store->numKeys++;
+    store->usedBytes += entry_charge(entry);
+    count_compression(store, val2Add, true);
+    if (store->maxBytes) {
+        evict_to_fit(store, key2Add);
+    }
+    return 1;
+}
+
+/* Add a key/value pair to the store like stringstore_add_len() once the key
+ * has been hashed, compressing the value if it is worth it.
+ *
+ * Params:
+ *      store: The store to add to.
+ *      key: The key to add.
+ *      hash: The hash of the key.
+ *      value: The value of the key.
+ *      len: The length of the value.
+ *
+ * Return:
+ *      1 on success or 0 on failure.
+ */
+static int add_entry(StringStore* store, const char* key, uint64_t hash,
+        const char* value, size_t len) {
+    char* packed;
+    size_t packedLen = compress_value(store, value, len, &packed);
+    int added = packed ?
+            store_entry(store, key, hash, packed, packedLen, len) :
+            store_entry(store, key, hash, value, len, 0);
+    free(packed);
+    return added;
+}
+
+/* Add the given 'key'/'value' pair to the StringStore 'store'. The 'key' and
+ * 'value' strings are copied into the store before being added to the
+ * database. If the key already exists and nobody holds a reference to its
+ * value, the new value is copied over the old one when it fits.
+ * Returns 1 on success, 0 on failure (e.g. iif allocation fails).
+ *
+ * Params:
+ *      store: The StringStore pointer to add the key/val pair to.
+ *      key: The key in the key/val pair.
+ *      val: The val in the key/val pair.
+ */
+int stringstore_add(StringStore* store, const char* key, const char* value) {
+    reclaim_released(store);
+    return add_entry(store, key, hash_key(key), value, strlen(value));
+}
+
+int stringstore_add_len(StringStore* store, const char* key,
+        const char* value, size_t len) {
+    reclaim_released(store);
+    return add_entry(store, key, hash_key(key), value, len);
+}
+
+int stringstore_add_many(StringStore* store, int count, const char** keys,
+        const char** values, const size_t* lens, int* results) {
+    reclaim_released(store);
+    uint64_t* hashes = malloc(sizeof(uint64_t) * count);
+    if (!hashes) {
+        return 0;
+    }
+
+    // Grow the table once up front for every key that isn't already there,
+    // rather than doubling it again and again part way through the batch
+    size_t numNew = 0;
+    for (int i = 0; i < count; i++) {
+        hashes[i] = hash_key(keys[i]);
+        if (!find_entry(store, keys[i], hashes[i])) {
+            numNew++;
+        }
+    }
+    size_t newSize = store->table.size;
+    while ((store->numKeys + numNew) * MAX_LOAD_DENOM >
+            newSize * MAX_LOAD_NUM) {
+        newSize *= 2;
+    }
+    if (newSize > store->table.size) {
+        grow(store, newSize);   // add_entry() still grows if this fails
+    }
+
+    int added = 0;
+    for (int i = 0; i < count; i++) {
+        size_t len = lens ? lens[i] : strlen(values[i]);
+        results[i] = add_entry(store, keys[i], hashes[i], values[i], len);
+        added += results[i];
+    }
+    free(hashes);
+    return added;
+}
+
+/* Find a key that is about to be updated from its current value. A key that
+ * has expired is removed first, so the update starts from scratch.
+ *
+ * Params:
+ *      store: The store to search.
+ *      key: The key to look for.
+ *      hash: The hash of the key.
+ *
+ * Return:
+ *      The entry of the key (already saved for any snapshot or read view)
+ *      or NULL if the key doesn't exist.
+ */
+static Entry* find_live_entry(StringStore* store, const char* key,
+        uint64_t hash) {
+    Entry* entry = find_entry(store, key, hash);
+    if (entry && is_expired(entry)) {
+        remove_entry(store, entry);
+        return NULL;
+    }
+    if (entry) {
+        snapshot_save(store, entry);
+        history_save(store, entry);
+    }
+    return entry;
+}
+
+/* Parse a value as a decimal integer. Only an optional '-' followed by
+ * digits is accepted, with nothing before or after.
+ *
+ * Params:
+ *      data: The value to parse.
+ *      len: The length of the value.
+ *      value: Where the integer is saved.
+ *
+ * Return:
+ *      true if the value is an integer that fits in an int64_t.
+ */
+static bool parse_integer(const char* data, size_t len, int64_t* value) {
+    if (!len || len >= INTEGER_BUFFER_SIZE) {
+        return false;
+    }
+    size_t i = data[0] == '-' ? 1 : 0;
+    if (i == len) {
+        return false;
+    }
+    for (; i < len; i++) {
+        if (data[i] < '0' || data[i] > '9') {
+            return false;
+        }
+    }
+    errno = 0;
+    *value = strtoll(data, NULL, 10);
+    return errno != ERANGE;
+}
+
+int stringstore_increment(StringStore* store, const char* key,
+        int64_t delta, int64_t* result) {
+    reclaim_released(store);
+    begin_write(store);
+    migrate(store, MIGRATE_SLOTS);
+    uint64_t hash = hash_key(key);
+    Entry* entry = find_live_entry(store, key, hash);
+
+    // A missing key counts as 0. Numbers are too short to be compressed.
+    int64_t current = 0;
+    if (entry && (entry->val->plainLen || !parse_integer(entry->val->data,
+            entry->val->len, &current))) {
+        return -1;
+    }
+    if (__builtin_add_overflow(current, delta, result)) {
+        return -1;
+    }
+    char number[INTEGER_BUFFER_SIZE];
+    int len = snprintf(number, sizeof(number), "%" PRId64, *result);
+    if (!entry) {
+        return add_entry(store, key, hash, number, len);
+    }
+
+    // Unlike adding the key, incrementing it keeps its expiry
+    if (!replace_value(store, entry, number, len, 0)) {
+        return 0;
+    }
+    if (store->maxBytes) {
+        evict_to_fit(store, entry->key);
+    }
+    return 1;
+}
+
+int stringstore_append(StringStore* store, const char* key, const char* data,
+        size_t len, size_t* newLen) {
+    reclaim_released(store);
+    begin_write(store);
+    migrate(store, MIGRATE_SLOTS);
+    uint64_t hash = hash_key(key);
+    Entry* entry = find_live_entry(store, key, hash);
+    if (!entry) {
+        *newLen = len;
+        return add_entry(store, key, hash, data, len);
+    }
+
+    Value* val = entry->val;
+    size_t total = (val->plainLen ? val->plainLen : val->len) + len;
+    if (!can_fit(store, key, total)) {
+        return 0;
+    }
+    // Append in place unless a reader holds the value, it is full or it is
+    // compressed
+    if (val->refCount != 1 || total >= val->capacity || val->plainLen) {
+        Value* grown = value_grow(store, val, len);
+        if (!grown) {
+            return 0;
+        }
+        store->usedBytes += grown->capacity;
+        store->usedBytes -= val->capacity;
+        count_compression(store, val, false);
+        value_put(store, val);
+        entry->val = val = grown;
+    }
+    memcpy(val->data + val->len, data, len);
+    val->data[total] = '\0';
+    val->len = (uint32_t)total;
+    val->version = store->writeVersion;
+    entry->referenced = true;
+    *newLen = total;
+    if (store->maxBytes) {
+        evict_to_fit(store, entry->key);
+    }
+    return 1;
+}
+
+/* Attempt to retrieve the value associated with a particular 'key' in the
+ * StringStore 'store'.
+ *
+ * Params:
+ *      store: The database to delete the key from.
+ *      key: The key for the key value pair to retrieve.
+ *
+ * Return:
+ *      The string representing the value associated with the key. If the key
+ *      does not exist in the StringStore database then a NULL pointer is
+ *      returned instead.
  */
+const char* stringstore_retrieve(StringStore* store, const char* key) {
+    Entry* entry = find_entry(store, key, hash_key(key));
+    if (!entry || is_expired(entry)) {
+        return NULL;
+    }
+    mark_referenced(entry);
+    return value_plain(entry->val);
+}
 
-#include <stdlib.h>
-#include <string.h>
-#include "stringstore.h"
+const char* stringstore_retrieve_ref(StringStore* store, const char* key) {
+    Entry* entry = find_entry(store, key, hash_key(key));
+    if (!entry || is_expired(entry)) {
+        return NULL;
+    }
+    mark_referenced(entry);
+    return value_pin(entry->val);
+}
 
-#define INIT_BUFFERSIZE 20
+const char* stringstore_retrieve_encoded(StringStore* store, const char* key,
+        size_t* plainLen) {
+    Entry* entry = find_entry(store, key, hash_key(key));
+    if (!entry || is_expired(entry)) {
+        return NULL;
+    }
+    mark_referenced(entry);
+    Value* val = entry->val;
+    __atomic_add_fetch(&val->refCount, 1, __ATOMIC_RELAXED);
+    *plainLen = val->plainLen;
+    return val->data;
+}
 
-// A struct for the key:value database
-struct StringStore {
-    char** keys;
-    char** vals;
-    int numKeys;
-    int bufferSize;
-};
+/* Give up a thread's reader slot when the thread exits, so another thread
+ * can use it.
+ *
+ * Params:
+ *      arg: The thread's Reader.
+ */
+static void reader_thread_exit(void* arg) {
+    Reader* reader = (Reader*)arg;
+    pthread_mutex_lock(&readerLock);
+    reader->inUse = false;
+    pthread_mutex_unlock(&readerLock);
+}
 
-// Creates a new StringStore instance and returns a pointer to it.
-StringStore* stringstore_init(void) {
-    StringStore* store = malloc(sizeof(StringStore));
-    store->numKeys = 0;
-    store->bufferSize = INIT_BUFFERSIZE;
-    store->keys = malloc(sizeof(char) * store->bufferSize);
-    store->vals = malloc(sizeof(char) * store->bufferSize);
-    return store;
+/* Create the key that each thread's reader slot is kept under.*/
+static void reader_key_init(void) {
+    pthread_key_create(&readerKey, reader_thread_exit);
 }
 
-// Free all memort associated with the given StringStore and return NYLL
-StringStore* stringstore_free(StringStore* store) {
-    // Must free all the keys and vals in the stringstore...
-    for (int i = 0; i < store->numKeys; i++) {
-        free(store->keys[i]);
-        free(store->vals[i]);
+/* Get the calling thread's reader slot, reusing the slot of a thread that
+ * has exited or adding a new one the first time the thread reads.
+ *
+ * Return:
+ *      The thread's slot or NULL if one could not be allocated.
+ */
+static Reader* get_reader(void) {
+    pthread_once(&readerOnce, reader_key_init);
+    Reader* reader = pthread_getspecific(readerKey);
+    if (reader) {
+        return reader;
+    }
+
+    pthread_mutex_lock(&readerLock);
+    for (reader = readers; reader && reader->inUse; reader = reader->next) {
+        // Look for a free slot
+    }
+    if (!reader) {
+        if (posix_memalign((void**)&reader, CACHE_LINE, sizeof(Reader))) {
+            pthread_mutex_unlock(&readerLock);
+            return NULL;
+        }
+        reader->epoch = 0;
+        reader->next = readers;
+        __atomic_store_n(&readers, reader, __ATOMIC_RELEASE);
+    }
+    reader->inUse = true;
+    pthread_mutex_unlock(&readerLock);
+    if (pthread_setspecific(readerKey, reader)) {
+        reader_thread_exit(reader);
+        return NULL;
+    }
+    return reader;
+}
+
+/* Check that a store hasn't changed since an unlocked reader started.
+ *
+ * Params:
+ *      store: The store being read.
+ *      seq: Its sequence count when the reader started.
+ *
+ * Return:
+ *      true if nothing has been changed in the meantime.
+ */
+static bool seq_unchanged(StringStore* store, uint32_t seq) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&store->seq, __ATOMIC_RELAXED) == seq;
+}
+
+/* Look for a key in a table like find_slot() while the table may be changing
+ * underneath. The probe is bounded, since entries that move while it runs
+ * could otherwise keep it going, and anything found must be checked with
+ * seq_unchanged() before it is trusted.
+ *
+ * Params:
+ *      table: A copy of the table to search.
+ *      key: The key to look for.
+ *      hash: The hash of the key.
+ *
+ * Return:
+ *      The entry that seemed to hold the key or NULL.
+ */
+static Entry* find_unlocked(const Table* table, const char* key,
+        uint64_t hash) {
+    size_t mask = table->size - 1;
+    size_t i = hash & mask;
+    for (size_t probes = 0; probes < table->size; probes++) {
+        Entry* entry = &table->entries[i];
+        const char* entryKey = __atomic_load_n(&entry->key, __ATOMIC_RELAXED);
+        if (!entryKey) {
+            return NULL;
+        }
+        if (__atomic_load_n(&entry->hash, __ATOMIC_RELAXED) == hash &&
+                !strcmp(entryKey, key)) {
+            return entry;
+        }
+        i = (i + 1) & mask;
     }
-    free(store->keys);
-    free(store->vals);
-    free(store);
     return NULL;
 }
 
-/* Add the given 'key'/'value' pair to the StringStore 'store'. The 'key' and
- * 'value' strings are copied with strdup() before being added to the database.
- * Returns 1 on success, 0 on failure (e.g. iif strdup() fails).
+/* Take a reference to a value found without the store locked, unless its
+ * last reference has already gone (in which case it is being retired).
  *
  * Params:
- *      store: The StringStore pointer to add the key/val pair to.
- *      key: The key in the key/val pair.
- *      val: The val in the key/val pair.
+ *      val: The value.
+ *
+ * Return:
+ *      true if a reference was taken.
  */
-int stringstore_add(StringStore* store, const char* key, const char* value) {
-    char* key2Add = strdup(key);
-    char* val2Add = strdup(value);
+static bool value_pin_live(Value* val) {
+    int count = __atomic_load_n(&val->refCount, __ATOMIC_RELAXED);
+    do {
+        if (!count) {
+            return false;
+        }
+    } while (!__atomic_compare_exchange_n(&val->refCount, &count, count + 1,
+            true, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+    return true;
+}
+
+/* Try once to look a key up without the store locked. The caller must have
+ * published its reader epoch, which keeps anything this reads from being
+ * freed, but what it reads may be half way through being changed, so the
+ * lookup only counts if the sequence count is even and the same at the end.
+ *
+ * Params:
+ *      store: The store to search.
+ *      key: The key to look for.
+ *      hash: The hash of the key.
+ *      val: Where the value found is saved, with a reference taken to it.
+ *
+ * Return:
+ *      1 if the key was found, 0 if it doesn't exist or -1 if the store was
+ *      changed while looking.
+ */
+static int try_unlocked_lookup(StringStore* store, const char* key,
+        uint64_t hash, Value** val) {
+    uint32_t seq = __atomic_load_n(&store->seq, __ATOMIC_ACQUIRE);
+    if (seq & 1) {
+        return -1;
+    }
+    Table table = {
+            .entries = __atomic_load_n(&store->table.entries,
+                    __ATOMIC_RELAXED),
+            .size = __atomic_load_n(&store->table.size, __ATOMIC_RELAXED)};
+    Table old = {
+            .entries = __atomic_load_n(&store->old.entries, __ATOMIC_RELAXED),
+            .size = __atomic_load_n(&store->old.size, __ATOMIC_RELAXED)};
+    // A table and its size must match before probing it
+    if (!seq_unchanged(store, seq)) {
+        return -1;
+    }
+
+    Entry* entry = find_unlocked(&table, key, hash);
+    if (!entry && old.entries) {
+        entry = find_unlocked(&old, key, hash);
+    }
+    Value* found = NULL;
+    if (entry) {
+        Timer* timer = __atomic_load_n(&entry->timer, __ATOMIC_RELAXED);
+        if (!timer || __atomic_load_n(&timer->expiresAt, __ATOMIC_RELAXED) >
+                current_time_ms()) {
+            found = __atomic_load_n(&entry->val, __ATOMIC_RELAXED);
+        }
+    }
+    if (found && !value_pin_live(found)) {
+        return -1;
+    }
+    if (!seq_unchanged(store, seq)) {
+        // The reference may have been to a value that is gone by now
+        stringstore_release(found ? found->data : NULL);
+        return -1;
+    }
+    if (found) {
+        mark_referenced(entry);
+    }
+    *val = found;
+    return found != NULL;
+}
+
+void stringstore_enable_unlocked_reads(StringStore* store) {
+    store->unlockedReads = true;
+}
+
+void stringstore_write_begin(StringStore* store) {
+    if (!store->unlockedReads) {
+        return;
+    }
+    __atomic_store_n(&store->seq, store->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void stringstore_write_end(StringStore* store) {
+    if (!store->unlockedReads) {
+        return;
+    }
+    __atomic_store_n(&store->seq, store->seq + 1, __ATOMIC_RELEASE);
+    reclaim_retired(store);
+}
+
+int stringstore_retrieve_unlocked(StringStore* store, const char* key,
+        size_t* plainLen, const char** value) {
+    Reader* reader = get_reader();
+    if (!reader) {
+        return -1;
+    }
+
+    uint64_t hash = hash_key(key);
+    Value* val;
+    int found = -1;
+    for (int tries = 0; found < 0 && tries < READ_TRIES; tries++) {
+        __atomic_store_n(&reader->epoch,
+                __atomic_load_n(&readEpoch, __ATOMIC_RELAXED),
+                __ATOMIC_RELAXED);
+        // Publish the epoch before reading anything it protects
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        found = try_unlocked_lookup(store, key, hash, &val);
+        __atomic_store_n(&reader->epoch, 0, __ATOMIC_RELEASE);
+    }
 
-    if (!key2Add || !val2Add) {
+    *value = NULL;
+    if (found < 0) {
+        // A writer is taking a while, so wait for it on its lock rather
+        // than spinning
+        return -1;
+    }
+    if (!found) {
         return 0;
     }
+    // The reference stops the value being changed in place, so it is safe
+    // to read now
+    if (plainLen) {
+        *plainLen = val->plainLen;
+        *value = val->data;
+    } else if (val->plainLen) {
+        Value* copy = value_decompress(val);
+        stringstore_release(val->data);
+        *value = copy ? copy->data : NULL;
+    } else {
+        *value = val->data;
+    }
+    return *value != NULL;
+}
+
+uint64_t stringstore_get_version(StringStore* store, const char* key) {
+    Entry* entry = find_entry(store, key, hash_key(key));
+    return entry && !is_expired(entry) ? entry->val->version : 0;
+}
+
+void stringstore_release(const char* value) {
+    if (!value) {
+        return;
+    }
 
-    // Check if the key already exists
-    for (int i = 0; i < store->numKeys; i++) {
-        if (!strcmp(store->keys[i], key)) {
-            free(store->vals[i]);
-            free(key2Add);
-            store->vals[i] = val2Add;
-            return 1;
+    Value* val = (Value*)(value - offsetof(Value, data));
+    if (__atomic_sub_fetch(&val->refCount, 1, __ATOMIC_ACQ_REL)) {
+        return;
+    }
+    if (!val->store) {
+        // A decompressed copy that only this reader had
+        free(val);
+        return;
+    }
+
+    // The store may not be locked so hand the value back to be reclaimed by
+    // the next writer, except for large values which never used the arenas
+    // (unless an unlocked reader could still be looking at them)
+    StringStore* store = val->store;
+    value_drop_plain(val);
+    if (size_class(sizeof(Value) + val->capacity) == NO_SIZE_CLASS &&
+            !store->unlockedReads) {
+        free(val);
+        return;
+    }
+    val->next = __atomic_load_n(&store->released, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&store->released, &val->next, val,
+            true, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        // val->next was updated to the current head so just try again
+    }
+}
+
+size_t stringstore_value_len(const char* value) {
+    return ((const Value*)(value - offsetof(Value, data)))->len;
+}
+
+uint64_t stringstore_value_version(const char* value) {
+    return ((const Value*)(value - offsetof(Value, data)))->version;
+}
+
+int stringstore_iterate(StringStore* store, size_t* cursor, const char** key,
+        const char** value) {
+    while (*cursor < store->table.size + store->old.size) {
+        Entry* entry = entry_at(store, (*cursor)++);
+        if (entry->key && !is_expired(entry)) {
+            *key = entry->key;
+            *value = value_plain(entry->val);
+            return *value ? 1 : -1;
         }
     }
+    return 0;
+}
 
-    // Check if need to increase the buffer
-    if (store->numKeys == store->bufferSize) {
-        // Why won's reallocarray work???
-        store->keys = realloc(store->keys,
-                sizeof(char*) * 2 * store->bufferSize);
-        store->vals = realloc(store->vals,
-                sizeof(char*) * 2 * store->bufferSize);
-        if (!store->keys || !store->vals) {
-            // realloc failed
+void stringstore_set_max_bytes(StringStore* store, size_t maxBytes) {
+    reclaim_released(store);
+    begin_write(store);
+    store->maxBytes = maxBytes;
+    if (maxBytes) {
+        evict_to_fit(store, NULL);
+    }
+}
+
+size_t stringstore_used_bytes(StringStore* store) {
+    return store->usedBytes;
+}
+
+uint64_t stringstore_evictions(StringStore* store) {
+    return store->evictions;
+}
+
+void stringstore_set_compression(StringStore* store, size_t minLen) {
+    if (minLen && minLen < MIN_COMPRESS_LEN) {
+        minLen = MIN_COMPRESS_LEN;
+    }
+    store->compressMin = minLen;
+}
+
+void stringstore_compression_stats(StringStore* store, size_t* numValues,
+        size_t* plainBytes, size_t* storedBytes) {
+    *numValues = store->numCompressed;
+    *plainBytes = store->plainBytes;
+    *storedBytes = store->packedBytes;
+}
+
+int stringstore_reserve_expiry(StringStore* store) {
+    reclaim_released(store);
+    if (!store->wheel) {
+        store->wheel = calloc(WHEEL_LEVELS * WHEEL_SLOTS, sizeof(Timer*));
+        if (!store->wheel) {
             return 0;
         }
+    }
+    if (!store->spareTimer) {
+        store->spareTimer = slab_alloc(store, sizeof(Timer));
+    }
+    return store->spareTimer != NULL;
+}
 
-        store->bufferSize *= 2;
+int stringstore_set_expiry(StringStore* store, const char* key,
+        uint64_t expiresAt) {
+    reclaim_released(store);
+    Entry* entry = find_entry(store, key, hash_key(key));
+    if (!entry) {
+        return 0;
     }
 
-    store->keys[store->numKeys] = key2Add;
-    store->vals[store->numKeys] = val2Add;
-    store->numKeys++;
+    // Allocate the new timer before cancelling the old one, so the key keeps
+    // its expiry if this fails
+    if (expiresAt && !stringstore_reserve_expiry(store)) {
+        return 0;
+    }
+    snapshot_save(store, entry);
+    timer_cancel(store, entry);
+    if (!expiresAt) {
+        return 1;
+    }
+
+    if (!store->numTimers) {
+        // The wheel may have been idle so catch it up to now
+        store->wheelTick = current_time_ms() / WHEEL_TICK_MS;
+    }
+    Timer* timer = store->spareTimer;
+    store->spareTimer = NULL;
+    timer->key = entry->key;
+    timer->expiresAt = expiresAt;
+    timer_place(store, timer);
+    entry->timer = timer;
+    store->numTimers++;
     return 1;
 }
 
-/* Attempt to retrieve the value associated with a particular 'key' in the
- * StringStore 'store'.
+uint64_t stringstore_get_expiry(StringStore* store, const char* key) {
+    Entry* entry = find_entry(store, key, hash_key(key));
+    return entry && entry->timer ? entry->timer->expiresAt : 0;
+}
+
+int stringstore_expire(StringStore* store, int maxWork) {
+    reclaim_released(store);
+    begin_write(store);
+    uint64_t nowTick = current_time_ms() / WHEEL_TICK_MS;
+    int work = 0;
+    int expired = 0;
+
+    // Each timer moved or expired is a unit of work, as is each tick. If the
+    // work runs out part way through a tick, the next call carries on from
+    // the same tick (cascading a slot empties it, so redoing that is cheap).
+    while (store->numTimers && store->wheelTick <= nowTick) {
+        uint64_t tick = store->wheelTick;
+        for (int level = 1; level < WHEEL_LEVELS &&
+                !(tick & (((uint64_t)1 << (WHEEL_BITS * level)) - 1));
+                level++) {
+            Timer** slot = &store->wheel[level * WHEEL_SLOTS +
+                    ((tick >> (WHEEL_BITS * level)) & WHEEL_MASK)];
+            while (*slot && work < maxWork) {
+                Timer* timer = *slot;
+                timer_unlink(timer);
+                timer_place(store, timer);
+                work++;
+            }
+        }
+
+        Timer** slot = &store->wheel[tick & WHEEL_MASK];
+        while (*slot && work < maxWork) {
+            const char* key = (*slot)->key;
+            remove_entry(store, find_entry(store, key, hash_key(key)));
+            expired++;
+            work++;
+        }
+        if (work >= maxWork) {
+            return expired;
+        }
+        store->wheelTick++;
+        work++;
+    }
+    if (!store->numTimers && store->wheelTick <= nowTick) {
+        store->wheelTick = nowTick + 1;
+    }
+    return expired;
+}
+
+int stringstore_enable_index(StringStore* store) {
+    if (store->index) {
+        return 1;
+    }
+
+    reclaim_released(store);
+    store->index = slab_alloc(store, skip_node_size(SKIP_MAX_LEVEL));
+    if (!store->index) {
+        return 0;
+    }
+    memset(store->index, 0, skip_node_size(SKIP_MAX_LEVEL));
+    store->index->height = SKIP_MAX_LEVEL;
+    store->indexLevel = 1;
+
+    for (size_t i = 0; i < store->table.size + store->old.size; i++) {
+        Entry* entry = entry_at(store, i);
+        if (entry->key && !index_insert(store, entry->key)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int stringstore_scan(StringStore* store, const char* prefix, const char* after,
+        int limit, char** keys, const char** values) {
+    if (!store->index) {
+        return -1;
+    }
+
+    // Start from whichever comes later of the prefix or the cursor
+    SkipNode* update[SKIP_MAX_LEVEL];
+    SkipNode* node;
+    if (after && strcmp(after, prefix) >= 0) {
+        node = index_search(store, after, update);
+        if (node && !strcmp(node->key, after)) {
+            node = node->next[0];
+        }
+    } else {
+        node = index_search(store, prefix, update);
+    }
+
+    size_t prefixLen = strlen(prefix);
+    int count = 0;
+    while (node && count < limit && !strncmp(node->key, prefix, prefixLen)) {
+        // Expired keys are skipped
+        const char* value = stringstore_retrieve_ref(store, node->key);
+        if (value) {
+            keys[count] = strdup(node->key);
+            values[count++] = value;
+        }
+        if (value && !keys[count - 1]) {
+            for (int i = 0; i < count; i++) {
+                free(keys[i]);
+                stringstore_release(values[i]);
+            }
+            return -2;
+        }
+        node = node->next[0];
+    }
+    return count;
+}
+
+int stringstore_migrate(StringStore* store, size_t maxSlots) {
+    migrate(store, maxSlots);
+    return store->old.entries != NULL;
+}
+
+int stringstore_snapshot_begin(StringStore* store) {
+    if (store->snap.active) {
+        return 0;
+    }
+    reclaim_released(store);
+    store->snap.active = true;
+    store->snap.failed = false;
+    store->snap.epoch++;
+    store->snap.saved = NULL;
+    store->snap.tables[0] = store->table.id;
+    store->snap.tables[1] = store->old.entries ? store->old.id : 0;
+    store->snap.table = 0;
+    store->snap.cursor = 0;
+    return 1;
+}
+
+/* Find the next pending entry for a snapshot in the tables it is walking.
+ * Tables that have been freed since the snapshot started are skipped since
+ * every pending entry in them was saved as it was moved out.
  *
  * Params:
- *      store: The database to delete the key from.
- *      key: The key for the key value pair to retrieve.
- * 
+ *      store: The store whose snapshot is being read.
+ *
  * Return:
- *      The string representing the value associated with the key. If the key
- *      does not exist in the StringStore database then a NULL pointer is
- *      returned instead.
+ *      The next pending entry (which is stamped so it isn't found again) or
+ *      NULL if the walk is finished.
  */
-const char* stringstore_retrieve(StringStore* store, const char* key) {
-    // Perhaps more likely to get keys which have been recently added to end
-    // of list of keys
-    for (int i = store->numKeys - 1; i >= 0; i--) {
-        if (!strcmp(store->keys[i], key)) {
-            const char* val = store->vals[i];
-            return val;
+static Entry* snapshot_walk(StringStore* store) {
+    Snapshot* snap = &store->snap;
+    while (snap->table < 2) {
+        Table* table = NULL;
+        if (snap->tables[snap->table] == store->table.id) {
+            table = &store->table;
+        } else if (store->old.entries &&
+                snap->tables[snap->table] == store->old.id) {
+            table = &store->old;
+        }
+        if (!table || snap->cursor >= table->size) {
+            snap->table++;
+            snap->cursor = 0;
+            continue;
+        }
+
+        Entry* entry = &table->entries[snap->cursor++];
+        if (entry->key && entry->epoch != snap->epoch) {
+            entry->epoch = snap->epoch;
+            return entry;
         }
     }
     return NULL;
 }
 
+int stringstore_snapshot_read(StringStore* store, SnapshotItem* items,
+        int maxItems) {
+    Snapshot* snap = &store->snap;
+    if (!snap->active) {
+        return 0;
+    }
+
+    uint64_t now = current_time_ms();
+    int count = 0;
+    while (count < maxItems && !snap->failed) {
+        SnapshotItem* item = &items[count];
+        if (snap->saved) {
+            // The saved entry's key and reference are handed straight over
+            SavedEntry* saved = snap->saved;
+            snap->saved = saved->next;
+            item->key = saved->key;
+            item->value = saved->val->data;
+            item->expiresAt = saved->expiresAt;
+            if (saved->val->plainLen) {
+                // Swap the reference for one to a decompressed copy
+                item->value = value_pin(saved->val);
+                stringstore_release(saved->val->data);
+            }
+            free(saved);
+            if (!item->value) {
+                free(item->key);
+                snap->failed = true;
+                break;
+            }
+        } else {
+            Entry* entry = snapshot_walk(store);
+            if (!entry) {
+                break;
+            }
+            item->key = strdup(entry->key);
+            if (!item->key) {
+                snap->failed = true;
+                break;
+            }
+            item->value = value_pin(entry->val);
+            if (!item->value) {
+                free(item->key);
+                snap->failed = true;
+                break;
+            }
+            item->expiresAt = entry->timer ? entry->timer->expiresAt : 0;
+        }
+
+        // Keys that have expired are left out
+        if (item->expiresAt && item->expiresAt <= now) {
+            free(item->key);
+            stringstore_release(item->value);
+        } else {
+            count++;
+        }
+    }
+
+    if (snap->failed) {
+        for (int i = 0; i < count; i++) {
+            free(items[i].key);
+            stringstore_release(items[i].value);
+        }
+        return -1;
+    }
+    if (!count) {
+        snap->active = false;
+    }
+    return count;
+}
+
+void stringstore_snapshot_end(StringStore* store) {
+    while (store->snap.saved) {
+        SavedEntry* saved = store->snap.saved;
+        store->snap.saved = saved->next;
+        free(saved->key);
+        value_put(store, saved->val);
+        free(saved);
+    }
+    store->snap.active = false;
+}
+
+uint64_t stringstore_view_open(uint64_t expiresAt) {
+    pthread_mutex_lock(&viewLock);
+    if (numViews == viewCapacity) {
+        size_t capacity = viewCapacity ? viewCapacity * 2 : INIT_VIEWS;
+        ReadView* grown = realloc(views, capacity * sizeof(ReadView));
+        if (!grown) {
+            pthread_mutex_unlock(&viewLock);
+            return 0;
+        }
+        views = grown;
+        viewCapacity = capacity;
+    }
+
+    // Writers must start keeping old versions before the view's time is
+    // taken, so publish a time no later than it first
+    uint64_t now = __atomic_load_n(&commitClock, __ATOMIC_SEQ_CST);
+    if (now < __atomic_load_n(&oldestView, __ATOMIC_SEQ_CST)) {
+        __atomic_store_n(&oldestView, now, __ATOMIC_SEQ_CST);
+    }
+    uint64_t time = __atomic_fetch_add(&commitClock, 1, __ATOMIC_SEQ_CST);
+    views[numViews].time = time;
+    views[numViews].expiresAt = expiresAt;
+    numViews++;
+    update_oldest_view();
+    pthread_mutex_unlock(&viewLock);
+    return time;
+}
+
+int stringstore_view_close(uint64_t view) {
+    int closed = 0;
+    pthread_mutex_lock(&viewLock);
+    for (size_t i = 0; i < numViews; i++) {
+        if (views[i].time == view) {
+            views[i] = views[--numViews];
+            closed = 1;
+            break;
+        }
+    }
+    update_oldest_view();
+    pthread_mutex_unlock(&viewLock);
+    return closed;
+}
+
+size_t stringstore_num_views(void) {
+    pthread_mutex_lock(&viewLock);
+    size_t count = numViews;
+    pthread_mutex_unlock(&viewLock);
+    return count;
+}
+
+int stringstore_retrieve_at(StringStore* store, const char* key,
+        uint64_t view, const char** value) {
+    if (view >= __atomic_load_n(&commitClock, __ATOMIC_SEQ_CST) ||
+            view < store->history.horizon) {
+        return -1;
+    }
+    uint64_t hash = hash_key(key);
+    Entry* entry = find_entry(store, key, hash);
+    Value* val;
+    if (entry && !is_expired(entry) && entry->val->version < view) {
+        val = entry->val;
+    } else {
+        val = history_find(store, key, hash, view);
+    }
+    if (!val) {
+        *value = NULL;
+        return 0;
+    }
+    *value = value_pin(val);
+    return *value ? 1 : -1;
+}
+
+size_t stringstore_prune_versions(StringStore* store) {
+    reclaim_released(store);
+    expire_views();
+    History* history = &store->history;
+
+    // A version is only seen by views from before it was replaced, so once
+    // every view is newer than that it can go. Views that open from now on
+    // are no older than the clock.
+    uint64_t limit = __atomic_load_n(&commitClock, __ATOMIC_SEQ_CST);
+    uint64_t oldest = __atomic_load_n(&oldestView, __ATOMIC_SEQ_CST);
+    if (oldest < limit) {
+        limit = oldest;
+    }
+    if (history->horizon < limit) {
+        history->horizon = limit;
+    }
+
+    size_t pruned = 0;
+    for (size_t i = 0; i < history->numBuckets && history->count; i++) {
+        OldVersion** link = &history->buckets[i];
+        while (*link) {
+            OldVersion* old = *link;
+            if (old->to < limit) {
+                *link = old->next;
+                free(old->key);
+                value_put(store, old->val);
+                free(old);
+                history->count--;
+                pruned++;
+            } else {
+                link = &old->next;
+            }
+        }
+    }
+    return pruned;
+}
+
 /* Attempt to delete the key/value pair associated with a particular 'key' in
  * the StringStore 'store'.
  *
@@ -128,25 +2744,17 @@ const char* stringstore_retrieve(StringStore* store, const char* key) {
  *      1 if the key exists and deletion succeeds or 0 otherwise.
  */
 int stringstore_delete(StringStore* store, const char* key) {
-    // Check the rest of the keys
-    for (int i = 0; i < store->numKeys; i++) {
-        if (!strcmp(store->keys[i], key)) {
-            store->numKeys--;
-            free(store->keys[i]);
-            free(store->vals[i]);
-            
-            // Replace the deleted key/val with the key/val at the end
-            if (i != store->numKeys) {
-                store->keys[i] = store->keys[store->numKeys];
-                store->vals[i] = store->vals[store->numKeys];
-            }
-
-            store->keys[store->numKeys] = NULL;
-            store->vals[store->numKeys] = NULL;
-            return 1;
-        }
+    reclaim_released(store);
+    begin_write(store);
+    migrate(store, MIGRATE_SLOTS);
+    Entry* entry = find_entry(store, key, hash_key(key));
+    if (!entry) {
+        // Key doesn't exist
+        return 0;
     }
-            
-    // Key doesn't exist
-    return 0;
+
+    // A key that has expired is removed but doesn't count as deleted
+    bool expired = is_expired(entry);
+    remove_entry(store, entry);
+    return !expired;
 }
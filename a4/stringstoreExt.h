@@ -0,0 +1,507 @@
+/* FILE: stringstoreExt.h
+ *
+ * AUTHOR: Tariq Soliman
+ * STUDENT NO.: 45287316
+ *
+ * DESCRIPTION:
+ * Extensions to the StringStore API in stringstore.h that are provided by
+ * this implementation of libstringstore.so. As with the rest of the API, a
+ * StringStore is not thread safe so callers must lock it themselves, except
+ * that a store with unlocked reads enabled can be read with
+ * stringstore_retrieve_unlocked() while another thread changes it.
+ */
+
+#ifndef STRINGSTORE_EXT_H
+#define STRINGSTORE_EXT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stringstore.h>
+
+/* A key/value pair read from a snapshot of a store.*/
+typedef struct SnapshotItem {
+    char* key;          // A copy of the key that must be freed
+    const char* value;  // A reference that must be released
+    uint64_t expiresAt; // When the key expires or 0 if it never does
+} SnapshotItem;
+
+/* Retrieve the value associated with 'key' like stringstore_retrieve() but
+ * also take a reference to it. The returned string stays valid, even if the
+ * key is replaced or deleted, until it is passed to stringstore_release().
+ * The store must be locked for this call but not while using the value.
+ *
+ * Params:
+ *      store: The database to retrieve the value from.
+ *      key: The key for the key value pair to retrieve.
+ *
+ * Return:
+ *      The value associated with the key or NULL if the key does not exist.
+ */
+const char* stringstore_retrieve_ref(StringStore* store, const char* key);
+
+/* Release a value returned by stringstore_retrieve_ref(). The store does not
+ * need to be locked.
+ *
+ * Params:
+ *      value: The value to release (may be NULL).
+ */
+void stringstore_release(const char* value);
+
+/* Add a key/value pair like stringstore_add() where the value may contain
+ * any bytes, including '\0'. The stored value is still followed by a '\0'.
+ *
+ * Params:
+ *      store: The store to add the key/value pair to.
+ *      key: The key to add.
+ *      value: The value of the key.
+ *      len: The number of bytes in the value.
+ *
+ * Return:
+ *      1 on success or 0 on failure.
+ */
+int stringstore_add_len(StringStore* store, const char* key,
+        const char* value, size_t len);
+
+/* Get the length of a value returned by the store (e.g. by
+ * stringstore_retrieve() or stringstore_retrieve_ref()). The value must
+ * still be valid: either the store is locked or a reference is held.
+ *
+ * Params:
+ *      value: The value of interest.
+ *
+ * Return:
+ *      The number of bytes in the value, not including the '\0' after it.
+ */
+size_t stringstore_value_len(const char* value);
+
+/* Get the version of a value returned by the store. Every change to a key
+ * gives it a new version from a commit clock shared by every store in the
+ * process, so it is greater than any version used before, including (as the
+ * clock starts from the current time in microseconds) the versions of an
+ * earlier run. The value must still be valid.
+ *
+ * Params:
+ *      value: The value of interest.
+ *
+ * Return:
+ *      The version of the value.
+ */
+uint64_t stringstore_value_version(const char* value);
+
+/* Retrieve the value of a key as it is stored, taking a reference to it like
+ * stringstore_retrieve_ref() but without decompressing it. A compressed value
+ * is an LZ4 block and stringstore_value_len() gives the length of the block.
+ *
+ * Params:
+ *      store: The database to retrieve the value from.
+ *      key: The key for the key value pair to retrieve.
+ *      plainLen: Where the length of the value once decompressed is saved,
+ *      or 0 if the value isn't compressed.
+ *
+ * Return:
+ *      The stored value or NULL if the key does not exist.
+ */
+const char* stringstore_retrieve_encoded(StringStore* store, const char* key,
+        size_t* plainLen);
+
+/* Get the version of a key's value without reading the value.
+ *
+ * Params:
+ *      store: The store of interest.
+ *      key: The key of interest.
+ *
+ * Return:
+ *      The version of the key's value or 0 if the key doesn't exist.
+ */
+uint64_t stringstore_get_version(StringStore* store, const char* key);
+
+/* Add many key/value pairs to the store at once, as if stringstore_add_len()
+ * was called for each pair in order. The hash table is grown once up front
+ * to fit all of the new keys.
+ *
+ * Params:
+ *      store: The store to add to.
+ *      count: The number of pairs to add.
+ *      keys: The keys to add.
+ *      values: The value of each key.
+ *      lens: The length of each value, or NULL if the values are strings.
+ *      results: An array of count elements where the result of adding each
+ *      pair (1 on success or 0 on failure) is saved.
+ *
+ * Return:
+ *      The number of pairs that were added successfully.
+ */
+int stringstore_add_many(StringStore* store, int count, const char** keys,
+        const char** values, const size_t* lens, int* results);
+
+/* Atomically add to the value of a key that holds a decimal integer. A key
+ * that doesn't exist is treated as 0 and added. The key keeps its expiry.
+ *
+ * Params:
+ *      store: The store the key is in.
+ *      key: The key to increment.
+ *      delta: The amount to add (may be negative).
+ *      result: Where the new value is saved.
+ *
+ * Return:
+ *      1 on success, 0 if the new value could not be stored or -1 if the
+ *      current value isn't an integer or the result would overflow.
+ */
+int stringstore_increment(StringStore* store, const char* key,
+        int64_t delta, int64_t* result);
+
+/* Atomically append data to the value of a key. A key that doesn't exist is
+ * added with the data as its value. The key keeps its expiry. The value is
+ * extended in place when there is room, and otherwise copied to a value with
+ * at least twice the room, so appending repeatedly is cheap.
+ *
+ * Params:
+ *      store: The store the key is in.
+ *      key: The key to append to.
+ *      data: The data to append (which may contain '\0's).
+ *      len: The number of bytes of data.
+ *      newLen: Where the length of the new value is saved.
+ *
+ * Return:
+ *      1 on success or 0 on failure.
+ */
+int stringstore_append(StringStore* store, const char* key, const char* data,
+        size_t len, size_t* newLen);
+
+/* Open a read view: a point on the commit clock that keys can be read at
+ * with stringstore_retrieve_at() for as long as the view is open. Views are
+ * shared by every store in the process, so reads from several stores (e.g.
+ * the shards of a database) at the same view are consistent with each
+ * other. While a view is open, stores keep the versions of keys it could
+ * see when they are replaced or deleted. Opening a view doesn't lock any
+ * store, so it never waits for a writer (or makes one wait).
+ *
+ * Params:
+ *      expiresAt: When the view closes itself, in milliseconds since the
+ *      Unix epoch, or 0 if it stays open until closed.
+ *
+ * Return:
+ *      The time of the view, which identifies it, or 0 if it could not be
+ *      opened.
+ */
+uint64_t stringstore_view_open(uint64_t expiresAt);
+
+/* Close a read view so the versions only it could see can be pruned.
+ *
+ * Params:
+ *      view: The time of the view.
+ *
+ * Return:
+ *      1 if the view was closed or 0 if it wasn't open.
+ */
+int stringstore_view_close(uint64_t view);
+
+/* Get the number of read views that are open.
+ *
+ * Return:
+ *      The number of views.
+ */
+size_t stringstore_num_views(void);
+
+/* Get the value a key had at a read view, taking a reference to it like
+ * stringstore_retrieve_ref(). This is the newest version of the key that
+ * was written before the view was opened, though a key that has expired by
+ * now counts as deleted. The store only needs to be locked for reading.
+ *
+ * Params:
+ *      store: The store to read from.
+ *      key: The key to look up.
+ *      view: The time of the view.
+ *      value: Where the value is saved (NULL if the key didn't exist).
+ *
+ * Return:
+ *      1 if the key was found, 0 if it didn't exist at the view or -1 if the
+ *      view isn't (or is no longer) open so the store may not have kept the
+ *      versions it needs (or the value could not be decompressed).
+ */
+int stringstore_retrieve_at(StringStore* store, const char* key,
+        uint64_t view, const char** value);
+
+/* Free the old versions that no open read view can see any more, first
+ * closing any views that have expired. This should be called regularly
+ * while the store is locked for writing.
+ *
+ * Params:
+ *      store: The store to prune.
+ *
+ * Return:
+ *      The number of versions freed.
+ */
+size_t stringstore_prune_versions(StringStore* store);
+
+/* Step through every key/value pair in the store. Set *cursor to 0 before the
+ * first call and keep passing the same cursor in. The store must stay locked
+ * (at least for reading) for the whole iteration.
+ *
+ * Params:
+ *      store: The store to iterate over.
+ *      cursor: The position of the iteration in the store.
+ *      key: Where a pointer to the next key is saved.
+ *      value: Where a pointer to the next key's value is saved.
+ *
+ * Return:
+ *      1 if the next key/value pair was saved, 0 if there are no more or -1
+ *      if the next value could not be decompressed.
+ */
+int stringstore_iterate(StringStore* store, size_t* cursor, const char** key,
+        const char** value);
+
+/* Limit the number of bytes the store's keys and values may use. Once the
+ * limit is reached, adding a key evicts the keys that have been used least
+ * recently (approximately) until the store fits again. Adding a key and
+ * value that is bigger than the whole limit fails.
+ *
+ * Params:
+ *      store: The store to limit.
+ *      maxBytes: The most bytes to use or 0 for no limit. If the store is
+ *      already bigger than this, keys are evicted straight away.
+ */
+void stringstore_set_max_bytes(StringStore* store, size_t maxBytes);
+
+/* Get the number of bytes used by the store's keys and values. The store
+ * must be locked (at least for reading).
+ *
+ * Params:
+ *      store: The store of interest.
+ *
+ * Return:
+ *      The number of bytes used.
+ */
+size_t stringstore_used_bytes(StringStore* store);
+
+/* Get the number of keys that have been evicted from the store to keep it
+ * within its limit. The store must be locked (at least for reading).
+ *
+ * Params:
+ *      store: The store of interest.
+ *
+ * Return:
+ *      The number of keys evicted.
+ */
+uint64_t stringstore_evictions(StringStore* store);
+
+/* Compress values added to the store from now on that are at least a given
+ * length, if compressing them saves enough to be worth it. Compressed values
+ * are decompressed as they are read. Values already in the store are left as
+ * they are.
+ *
+ * Params:
+ *      store: The store to compress values in.
+ *      minLen: The shortest value to compress (raised to a minimum of 64
+ *      bytes) or 0 to stop compressing values.
+ */
+void stringstore_set_compression(StringStore* store, size_t minLen);
+
+/* Get how much the store's compressed values have been compressed by. The
+ * store must be locked (at least for reading).
+ *
+ * Params:
+ *      store: The store of interest.
+ *      numValues: Where the number of compressed values is saved.
+ *      plainBytes: Where their total length before compression is saved.
+ *      storedBytes: Where their total length after compression is saved.
+ */
+void stringstore_compression_stats(StringStore* store, size_t* numValues,
+        size_t* plainBytes, size_t* storedBytes);
+
+/* Allocate what the next call to stringstore_set_expiry() needs, so that it
+ * can't fail for a key that exists. This lets a caller make sure a key can
+ * be given an expiry before changing it.
+ *
+ * Params:
+ *      store: The store to reserve an expiry in.
+ *
+ * Return:
+ *      1 on success or 0 if memory ran out.
+ */
+int stringstore_reserve_expiry(StringStore* store);
+
+/* Set the time a key expires. Once it has expired the key can no longer be
+ * retrieved and it is removed by a later call to stringstore_expire(). Adding
+ * the key again with stringstore_add() clears its expiry.
+ *
+ * Params:
+ *      store: The store the key is in.
+ *      key: The key to expire.
+ *      expiresAt: The time the key expires in milliseconds since the Unix
+ *      epoch, or 0 for the key to never expire.
+ *
+ * Return:
+ *      1 on success or 0 if the key doesn't exist or the expiry could not be
+ *      allocated, in which case the key keeps its old expiry.
+ */
+int stringstore_set_expiry(StringStore* store, const char* key,
+        uint64_t expiresAt);
+
+/* Get the time a key expires. The store must be locked (at least for
+ * reading).
+ *
+ * Params:
+ *      store: The store the key is in.
+ *      key: The key of interest.
+ *
+ * Return:
+ *      The time the key expires in milliseconds since the Unix epoch, or 0 if
+ *      the key doesn't exist or never expires.
+ */
+uint64_t stringstore_get_expiry(StringStore* store, const char* key);
+
+/* Remove keys that have expired. This should be called regularly (e.g. every
+ * 100 milliseconds) and does a bounded amount of work each time, carrying on
+ * where it left off on the next call if there is more to do.
+ *
+ * Params:
+ *      store: The store to remove expired keys from.
+ *      maxWork: The most timers to process in this call.
+ *
+ * Return:
+ *      The number of keys removed.
+ */
+int stringstore_expire(StringStore* store, int maxWork);
+
+/* Carry on growing the store's hash table in the background. Writes to the
+ * store already move a few entries from the old table to the new one each,
+ * so this is only needed to finish growing a store that is mostly read.
+ *
+ * Params:
+ *      store: The store to grow.
+ *      maxSlots: The most slots of the old table to migrate.
+ *
+ * Return:
+ *      1 if the store is still growing or 0 once it has finished.
+ */
+int stringstore_migrate(StringStore* store, size_t maxSlots);
+
+/* Start a snapshot of the store's contents, which can then be read a chunk
+ * at a time with stringstore_snapshot_read(). The snapshot holds every key as
+ * it was when the snapshot started, however the store is changed while it is
+ * read. Only one snapshot of a store can be read at a time. The store must be
+ * locked for writing.
+ *
+ * Params:
+ *      store: The store to take a snapshot of.
+ *
+ * Return:
+ *      1 if the snapshot was started or 0 if one is already being read.
+ */
+int stringstore_snapshot_begin(StringStore* store);
+
+/* Read the next key/value pairs from the store's snapshot. The store must be
+ * locked for writing for this call, as it moves the snapshot along, but can
+ * be unlocked and changed between calls.
+ * Keys that have expired are left out.
+ *
+ * Params:
+ *      store: The store whose snapshot to read.
+ *      items: An array of at least maxItems elements where the pairs read are
+ *      saved. Each key must be freed and each value released with
+ *      stringstore_release() by the caller.
+ *      maxItems: The most pairs to read.
+ *
+ * Return:
+ *      The number of pairs read, 0 once the whole snapshot has been read (at
+ *      which point it is finished) or -1 if the snapshot failed because
+ *      memory ran out. A failed snapshot must still be ended.
+ */
+int stringstore_snapshot_read(StringStore* store, SnapshotItem* items,
+        int maxItems);
+
+/* Abandon the store's snapshot, if there is one, before it has been read to
+ * the end. The store must be locked for writing.
+ *
+ * Params:
+ *      store: The store whose snapshot to end.
+ */
+void stringstore_snapshot_end(StringStore* store);
+
+/* Keep an ordered index of the store's keys so that it can be scanned with
+ * stringstore_scan(). Once enabled, adding a new key or deleting a key also
+ * updates the index, which takes O(log n) time.
+ *
+ * Params:
+ *      store: The store to index.
+ *
+ * Return:
+ *      1 on success or 0 if the index could not be allocated.
+ */
+int stringstore_enable_index(StringStore* store);
+
+/* Find keys that start with a prefix in order. The store must have an
+ * ordered index and be locked (at least for reading) for this call.
+ *
+ * Params:
+ *      store: The store to scan.
+ *      prefix: Only keys starting with this are found ("" for all keys).
+ *      after: Only keys greater than this are found, so the key last found
+ *      by a previous scan can be used to continue it (NULL to start from the
+ *      first key).
+ *      limit: The most keys to find.
+ *      keys: An array of at least limit elements. Copies of the keys found
+ *      are saved here and must be freed by the caller.
+ *      values: An array of at least limit elements. References to the values
+ *      of the keys found are saved here and must be released with
+ *      stringstore_release().
+ *
+ * Return:
+ *      The number of keys found, -1 if the store has no ordered index or -2
+ *      if memory ran out (in which case nothing is saved in keys or values).
+ */
+int stringstore_scan(StringStore* store, const char* prefix, const char* after,
+        int limit, char** keys, const char** values);
+
+/* Allow the store to be read with stringstore_retrieve_unlocked(). From now
+ * on every change must be made between stringstore_write_begin() and
+ * stringstore_write_end(), and memory that readers could be looking at is
+ * only freed once they have finished with it. This must be called before
+ * the store is shared.
+ *
+ * Params:
+ *      store: The store to allow unlocked reads of.
+ */
+void stringstore_enable_unlocked_reads(StringStore* store);
+
+/* Mark the start of a change to a store, once it is locked for writing.
+ * This does nothing unless unlocked reads are enabled.
+ *
+ * Params:
+ *      store: The store about to be changed.
+ */
+void stringstore_write_begin(StringStore* store);
+
+/* Mark the end of a change to a store, before it is unlocked. This also
+ * frees any memory that unlocked readers have finished with.
+ *
+ * Params:
+ *      store: The store that was changed.
+ */
+void stringstore_write_end(StringStore* store);
+
+/* Retrieve a key's value like stringstore_retrieve_ref() (or
+ * stringstore_retrieve_encoded() if plainLen isn't NULL) without locking the
+ * store, which must have unlocked reads enabled. Readers never wait for
+ * each other; a reader that overlaps a change looks the key up again, and
+ * gives up if the store keeps changing (e.g. a writer was descheduled while
+ * changing it) so the caller can wait for the writer on its lock.
+ *
+ * Params:
+ *      store: The store to retrieve the value from.
+ *      key: The key of the value.
+ *      plainLen: Where the length of the value once decompressed is saved
+ *      (0 if it isn't compressed), or NULL for the value to be decompressed.
+ *      value: Where a reference to the value (to be released with
+ *      stringstore_release()) or NULL is saved.
+ *
+ * Return:
+ *      1 if the key was found, 0 if it wasn't or -1 if the store kept
+ *      changing or the calling thread could not be set up to read, in which
+ *      case the store must be locked and read the usual way.
+ */
+int stringstore_retrieve_unlocked(StringStore* store, const char* key,
+        size_t* plainLen, const char** value);
+
+#endif
@@ -0,0 +1,156 @@
+/* FILE: workerpool.c
+ *
+ * AUTHOR: Tariq Soliman
+ * STUDENT NO.: 45287316
+ *
+ * DESCRIPTION:
+ * A fixed pool of worker threads fed by a bounded queue. See workerpool.h.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include "workerpool.h"
+
+#define USECS_PER_SEC 1000000L
+#define NSECS_PER_USEC 1000L
+
+// An item waiting for a worker and when it was queued.
+typedef struct QueuedItem {
+    void* arg;
+    struct timespec queuedAt;
+} QueuedItem;
+
+struct WorkerPool {
+    WorkHandler handler;
+    pthread_mutex_t lock;
+    pthread_cond_t notEmpty;
+    pthread_cond_t notFull;
+    QueuedItem* items;  // A ring buffer of queueSize items
+    int queueSize;
+    int head;           // The next item to take
+    int depth;          // The number of items queued
+    int numWorkers;
+    int busyWorkers;
+    int maxDepth;
+    unsigned long numQueued;
+    unsigned long numFull;      // Submits that had to wait for room
+    uint64_t totalWaitUsecs;
+    unsigned long maxWaitUsecs;
+};
+
+/* Get the number of microseconds from one time to another.
+ *
+ * Params:
+ *      from: The earlier time.
+ *      to: The later time.
+ *
+ * Return:
+ *      The number of microseconds between the times.
+ */
+static unsigned long usecs_between(struct timespec* from,
+        struct timespec* to) {
+    return (to->tv_sec - from->tv_sec) * USECS_PER_SEC +
+            (to->tv_nsec - from->tv_nsec) / NSECS_PER_USEC;
+}
+
+/* A worker thread, which runs the handler for each item it takes from the
+ * queue, waiting for one whenever the queue is empty.
+ *
+ * Params:
+ *      arg: A pointer to the WorkerPool.
+ */
+static void* worker_thread(void* arg) {
+    WorkerPool* pool = (WorkerPool*)arg;
+    pthread_mutex_lock(&pool->lock);
+    while (1) {
+        while (!pool->depth) {
+            pthread_cond_wait(&pool->notEmpty, &pool->lock);
+        }
+        QueuedItem item = pool->items[pool->head];
+        pool->head = (pool->head + 1) % pool->queueSize;
+        pool->depth--;
+        pool->busyWorkers++;
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        unsigned long waitUsecs = usecs_between(&item.queuedAt, &now);
+        pool->totalWaitUsecs += waitUsecs;
+        if (waitUsecs > pool->maxWaitUsecs) {
+            pool->maxWaitUsecs = waitUsecs;
+        }
+        pthread_cond_signal(&pool->notFull);
+        pthread_mutex_unlock(&pool->lock);
+
+        pool->handler(item.arg);
+
+        pthread_mutex_lock(&pool->lock);
+        pool->busyWorkers--;
+    }
+    return NULL;
+}
+
+WorkerPool* workerpool_init(int numWorkers, int queueSize,
+        WorkHandler handler) {
+    WorkerPool* pool = calloc(1, sizeof(WorkerPool));
+    if (!pool) {
+        return NULL;
+    }
+    pool->items = malloc(sizeof(QueuedItem) * queueSize);
+    if (!pool->items) {
+        free(pool);
+        return NULL;
+    }
+    pool->handler = handler;
+    pool->queueSize = queueSize;
+    pool->numWorkers = numWorkers;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->notEmpty, NULL);
+    pthread_cond_init(&pool->notFull, NULL);
+
+    for (int i = 0; i < numWorkers; i++) {
+        pthread_t threadId;
+        if (pthread_create(&threadId, NULL, worker_thread, pool)) {
+            return NULL;
+        }
+        pthread_detach(threadId);
+    }
+    return pool;
+}
+
+void workerpool_submit(WorkerPool* pool, void* arg) {
+    pthread_mutex_lock(&pool->lock);
+    if (pool->depth == pool->queueSize) {
+        pool->numFull++;
+    }
+    while (pool->depth == pool->queueSize) {
+        pthread_cond_wait(&pool->notFull, &pool->lock);
+    }
+    QueuedItem* item = &pool->items[(pool->head + pool->depth) %
+            pool->queueSize];
+    item->arg = arg;
+    clock_gettime(CLOCK_MONOTONIC, &item->queuedAt);
+    pool->depth++;
+    pool->numQueued++;
+    if (pool->depth > pool->maxDepth) {
+        pool->maxDepth = pool->depth;
+    }
+    pthread_cond_signal(&pool->notEmpty);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void workerpool_print_stats(WorkerPool* pool, FILE* out) {
+    pthread_mutex_lock(&pool->lock);
+    // Only items that have been taken off the queue have a wait time yet
+    unsigned long numTaken = pool->numQueued - pool->depth;
+    fprintf(out, "Workers busy:%d/%d\n", pool->busyWorkers, pool->numWorkers);
+    fprintf(out, "Worker queue depth:%d\n", pool->depth);
+    fprintf(out, "Worker queue max depth:%d\n", pool->maxDepth);
+    fprintf(out, "Worker queue items:%lu\n", pool->numQueued);
+    fprintf(out, "Worker queue full:%lu\n", pool->numFull);
+    fprintf(out, "Worker queue avg wait (us):%lu\n",
+            numTaken ? (unsigned long)(pool->totalWaitUsecs / numTaken) : 0);
+    fprintf(out, "Worker queue max wait (us):%lu\n", pool->maxWaitUsecs);
+    pthread_mutex_unlock(&pool->lock);
+}
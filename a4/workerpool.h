@@ -0,0 +1,60 @@
+/* FILE: workerpool.h
+ *
+ * AUTHOR: Tariq Soliman
+ * STUDENT NO.: 45287316
+ *
+ * DESCRIPTION:
+ * A fixed pool of worker threads that are started once and fed work through
+ * a bounded queue, so handing out work doesn't pay to create and destroy a
+ * thread each time. The queue is a ring buffer guarded by a mutex, with
+ * condition variables for workers waiting for work and for a submitter
+ * waiting for room. Submitting to a full queue blocks until a worker takes
+ * something off it.
+ *
+ * The depth of the queue and how long each item waited in it are recorded.
+ */
+
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <stdio.h>
+
+/* A function that a worker runs for each item of work.*/
+typedef void (*WorkHandler)(void* arg);
+
+/* A pool of worker threads and their queue.*/
+typedef struct WorkerPool WorkerPool;
+
+/* Start a pool of worker threads.
+ *
+ * Params:
+ *      numWorkers: The number of worker threads.
+ *      queueSize: The most items that can wait in the queue.
+ *      handler: The function to run for each item.
+ *
+ * Return:
+ *      The WorkerPool or NULL if it could not be started.
+ */
+WorkerPool* workerpool_init(int numWorkers, int queueSize,
+        WorkHandler handler);
+
+/* Queue an item for the next free worker, waiting for room if the queue is
+ * full.
+ *
+ * Params:
+ *      pool: The pool to give the item to.
+ *      arg: The item, which is passed to the pool's handler.
+ */
+void workerpool_submit(WorkerPool* pool, void* arg);
+
+/* Print statistics about the pool's queue: its current and greatest depth,
+ * the number of items queued, how long they waited for a worker on average
+ * and at most, and how often the queue was full.
+ *
+ * Params:
+ *      pool: The pool of interest.
+ *      out: Where to print the statistics.
+ */
+void workerpool_print_stats(WorkerPool* pool, FILE* out);
+
+#endif